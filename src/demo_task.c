@@ -26,15 +26,22 @@ static void demo_task_run(mj_scheduler* scheduler, void* ctx) {
  *
  * The returned pointer is owned by the caller; it should be passed
  * to `mj_scheduler_task_add`. The Scheduler frees the memory when
- * the task is removed.
+ * the task is removed, so it is allocated with the scheduler's allocator.
  * ------------------------------------------------------------------ */
-mj_task* demo_task_counter_create_task(int count_to) {
+mj_task* demo_task_counter_create_task(mj_scheduler* scheduler, int count_to) {
     // Allocate the container that holds the function pointers
     // This gets freed by the scheduler after it runs the tasks destroy()
-    mj_task* new_task = calloc(1, sizeof(*new_task));
+    mj_task* new_task = mj_scheduler_calloc(scheduler, 1, sizeof(*new_task));
+    if (new_task == NULL) {
+        return NULL;
+    }
 
     // Create the context
-    demo_task_ctx* ctx = malloc(sizeof(*ctx));
+    demo_task_ctx* ctx = mj_scheduler_alloc(scheduler, sizeof(*ctx));
+    if (ctx == NULL) {
+        mj_scheduler_free(scheduler, new_task, sizeof(*new_task));
+        return NULL;
+    }
     ctx->count_to = count_to;
     ctx->count = 0; // always start count at zero
 
@@ -44,11 +51,13 @@ mj_task* demo_task_counter_create_task(int count_to) {
 
     // set the context
     new_task->ctx = ctx;
+    new_task->ctx_size = sizeof(*ctx);
 
     // set up the tasks functions, only run is mandatory
     new_task->create = NULL;
     new_task->run = demo_task_run;
     new_task->cleanup = NULL;
+    new_task->name = "demo_counter";
 
     printf("ADDED COUNTER COUNTING TO: %d\n", ctx->count_to);
 
@@ -2,7 +2,7 @@
  * demo_task.h
  *
  * Example usage:
- *   mj_task *t = demo_task_create_task();      // Create a task instance.
+ *   mj_task *t = demo_task_counter_create_task(sched, 3); // Create a task instance.
  *   mj_scheduler_task_add(sched, t);           // Scheduler takes ownership of `t`.
  *
  * Overview
@@ -49,4 +49,4 @@ typedef struct demo_task_ctx {
     void* unused_heap_ptr; // Any pointers here needs to be allocated and freed in the create / destroy functions
 } demo_task_ctx;
 
-mj_task* demo_task_counter_create_task(int count_to);
+mj_task* demo_task_counter_create_task(mj_scheduler* scheduler, int count_to);
@@ -1,5 +1,9 @@
 #include "majjen.h"
+#include "mj_probes.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,137 +11,1884 @@
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+// -DMJ_NO_SIMD keeps the bitmap scan scalar whatever the target supports
+#if defined(__AVX2__) && !defined(MJ_NO_SIMD)
+#define MJ_BITMAP_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(MJ_NO_SIMD)
+#define MJ_BITMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#define MJ_TASK_WORDS ((MAX_TASKS + 63) / 64)
+// First size of the timer heap and the poll array, both double from there. Not MAX_TASKS, which may be huge.
+#define MJ_INITIAL_CAPACITY 16
 
 typedef struct mj_scheduler {
+    mj_allocator allocator;
     mj_task* task_list[MAX_TASKS];
     mj_task** current_task; // double pointer, so we dont have to search array to remove task
     size_t task_count;
+    mj_mem_limit_fn mem_limit_callback;
+    mj_arena_chunk* arena_pool; // free arena chunks, all MJ_ARENA_CHUNK_SIZE
+    size_t arena_pool_count;
+    size_t runnable_count;
+    uint64_t runnable_bits[MJ_TASK_WORDS]; // one bit per runnable slot, kept in step with runnable_count
+    size_t free_hint;                      // no free slot below this one
+    mj_timer** timer_heap; // min-heap on deadline_ns
+    size_t timer_count;
+    size_t timer_capacity;
+    mj_wait_queue io_waiters; // tasks parked in mj_scheduler_task_wait_fd
+    struct pollfd* io_fds;    // poll() scratch array, wake pipe plus one entry per io waiter
+    size_t io_capacity;
+    int wake_fds[2];     // self-pipe, other threads write a byte to break poll()
+    int wake_signalled;  // atomic, 1 while a wake byte is pending
+    mj_task* inbox;      // atomic, lock-free stack of tasks posted or migrated from other threads
+    size_t inbound;      // atomic, tasks promised to this scheduler but not yet drained
+    size_t holds;        // atomic, mj_scheduler_hold count
+    mj_task* incoming;   // drained from the inbox, waiting for a free slot
+    mj_task* incoming_tail;
+    mj_task* migrating;  // current task, pushed to its target once its run returns
+    bool in_pass;        // the run loop is sweeping the task list, timers and the microtasks around them run outside
+    mj_task* spawned;    // added during the pass, attached in order once it ends, slots are reserved for them
+    mj_task* spawned_tail;
+    size_t spawned_count;
+    mj_timer* timer_inbox; // atomic, lock-free stack of timers posted from other threads
+    mj_task* wake_inbox;   // atomic, lock-free stack of tasks woken from other threads
+    struct mj_epoch_slot* epoch_slot; // claimed while mj_scheduler_run runs
+    mj_retired* retired;   // waiting for reclamation, oldest epoch first
+    mj_retired* retired_tail;
+    uint64_t pass;         // run loop iterations, tasks run out of slot order are marked with it so they run once per pass
+    mj_task* lifo;         // wake slot, the task woken last during the current pass
+    mj_microtask* microtask_head;
+    mj_microtask* microtask_tail;
+    mj_task_fn batch_run[MJ_BATCH_TYPES];
+    mj_task_batch_fn batch_fn[MJ_BATCH_TYPES];
+    size_t batch_type_count;
+    void* batch_contexts[MAX_TASKS]; // the batch being run, only valid inside run_batch
+    mj_task* batch_tasks[MAX_TASKS];
+    mj_task** batch_slots[MAX_TASKS];
+    size_t batch_count;
 } mj_scheduler;
 
-int mj_scheduler_run(mj_scheduler* scheduler) {
+typedef enum mj_task_state {
+    MJ_TASK_RUNNABLE = 0, // zeroed tasks start runnable
+    MJ_TASK_WAITING,
+    MJ_TASK_REMOVED, // retired, waiting for epoch reclamation
+} mj_task_state;
+
+// Arena chunk header, the payload follows at MJ_ARENA_HEADER
+struct mj_arena_chunk {
+    mj_arena_chunk* next;
+    size_t size; // payload bytes
+};
+
+#define MJ_ARENA_ALIGN 16
+#define MJ_ARENA_ROUND(n) (((n) + MJ_ARENA_ALIGN - 1) & ~(size_t)(MJ_ARENA_ALIGN - 1))
+#define MJ_ARENA_HEADER MJ_ARENA_ROUND(sizeof(mj_arena_chunk))
+
+// Task-local storage keys are process-wide, every task has one slot per key
+static mj_tls_destructor tls_destructors[MJ_TLS_SLOTS];
+static size_t tls_key_count = 0;
+
+// Process-wide task ids, 0 means not yet added
+static uint64_t mj_next_task_id = 0;
+
+// The task the calling thread is running, copied out of the task so signal handlers never touch a task
+// that is being freed
+static __thread uint64_t mj_thread_task_id = 0;
+static __thread const char* mj_thread_task_name = NULL;
+static __thread uint64_t mj_thread_runs = 0; // task runs and batches started on this thread
+
+// Epoch reclamation. Every thread that may hold task handles owns a slot and announces the global epoch
+// in it, running schedulers once per loop iteration. The global epoch only advances once every online slot
+// has announced it, so memory retired in epoch e is unreachable by the time the global epoch is e + 2.
+typedef struct mj_epoch_slot {
+    uint64_t epoch; // atomic, last epoch announced, 0 while the thread is offline
+    int used;       // atomic
+    char pad[64 - sizeof(uint64_t) - sizeof(int)]; // one cache line each, slots are written every iteration
+} mj_epoch_slot;
+
+static mj_epoch_slot mj_epoch_slots[MJ_EPOCH_MAX_THREADS];
+static uint64_t mj_epoch_global = 1;
+static __thread mj_epoch_slot* mj_epoch_run_slot = NULL;   // slot of the scheduler this thread runs
+static __thread mj_scheduler* mj_thread_scheduler = NULL;  // the scheduler this thread runs, for calls not handed it
+static __thread mj_epoch_slot* mj_epoch_enter_slot = NULL; // slot taken by mj_epoch_enter
+static __thread int mj_epoch_depth = 0;
+
+// Default allocator, plain libc
+static void* mj_libc_alloc(void* user, size_t size) {
+    return malloc(size);
+}
+
+static void mj_libc_free(void* user, void* ptr, size_t size) {
+    free(ptr);
+}
+
+static void* mj_libc_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+static const mj_allocator mj_libc_allocator = {
+    .alloc = mj_libc_alloc,
+    .free = mj_libc_free,
+    .realloc = mj_libc_realloc,
+    .user = NULL,
+};
+
+static mj_task* mj_current(const mj_scheduler* scheduler) {
+    return scheduler->current_task ? *scheduler->current_task : NULL;
+}
+
+// Memory accounting, a counter update on the existing allocation paths
+static void mj_mem_charge(mj_scheduler* scheduler, mj_task* task, size_t bytes) {
+    if (task == NULL || bytes == 0) {
+        return;
+    }
+
+    bool task_was_under = task->mem_bytes <= task->mem_budget;
+    task->mem_bytes += bytes;
+
+    mj_mem_group* group = task->mem_group;
+    bool group_was_under = group && group->bytes <= group->budget;
+    if (group) {
+        group->bytes += bytes;
+    }
+
+    if (scheduler->mem_limit_callback == NULL) {
+        return;
+    }
+    // Only fire on the crossing, not on every allocation above the budget
+    if (task->mem_budget && task_was_under && task->mem_bytes > task->mem_budget) {
+        scheduler->mem_limit_callback(scheduler, task, NULL);
+    }
+    if (group && group->budget && group_was_under && group->bytes > group->budget) {
+        scheduler->mem_limit_callback(scheduler, task, group);
+    }
+}
+
+static void mj_mem_uncharge(mj_task* task, size_t bytes) {
+    if (task == NULL || bytes == 0) {
+        return;
+    }
+
+    // Saturate, size hints of 0 or mismatched hints must not wrap the counters
+    task->mem_bytes = task->mem_bytes > bytes ? task->mem_bytes - bytes : 0;
+    if (task->mem_group) {
+        task->mem_group->bytes = task->mem_group->bytes > bytes ? task->mem_group->bytes - bytes : 0;
+    }
+}
+
+// Takes a chunk from the pool, or from the allocator when the pool is empty
+static mj_arena_chunk* mj_arena_chunk_get(mj_scheduler* scheduler) {
+    mj_arena_chunk* chunk = scheduler->arena_pool;
+    if (chunk) {
+        scheduler->arena_pool = chunk->next;
+        scheduler->arena_pool_count--;
+        return chunk;
+    }
+
+    chunk = scheduler->allocator.alloc(scheduler->allocator.user, MJ_ARENA_HEADER + MJ_ARENA_CHUNK_SIZE);
+    if (chunk) {
+        chunk->size = MJ_ARENA_CHUNK_SIZE;
+    }
+    return chunk;
+}
+
+// Hands the task's chunks back to the pool in one splice, only oversized allocations are freed individually
+static void mj_arena_release(mj_scheduler* scheduler, mj_task* task) {
+    if (task->arena_head) {
+        task->arena_tail->next = scheduler->arena_pool;
+        scheduler->arena_pool = task->arena_head;
+        scheduler->arena_pool_count += task->arena_chunks;
+    }
+
+    mj_arena_chunk* large = task->arena_large;
+    while (large) {
+        mj_arena_chunk* next = large->next;
+        scheduler->allocator.free(scheduler->allocator.user, large, MJ_ARENA_HEADER + large->size);
+        large = next;
+    }
+
+    mj_mem_uncharge(task, task->arena_bytes);
+
+    task->arena_head = NULL;
+    task->arena_tail = NULL;
+    task->arena_large = NULL;
+    task->arena_offset = 0;
+    task->arena_chunks = 0;
+    task->arena_bytes = 0;
+}
+
+// Timer min-heap, timers keep their heap_index so any entry can be removed in O(log n)
+static void mj_heap_swap(mj_timer** heap, size_t a, size_t b) {
+    mj_timer* tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->heap_index = a;
+    heap[b]->heap_index = b;
+}
+
+static void mj_heap_bubble_up(mj_timer** heap, size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent]->deadline_ns <= heap[index]->deadline_ns) {
+            break;
+        }
+        mj_heap_swap(heap, parent, index);
+        index = parent;
+    }
+}
+
+static void mj_heap_bubble_down(mj_timer** heap, size_t count, size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = 2 * index + 2;
+
+        if (left < count && heap[left]->deadline_ns < heap[smallest]->deadline_ns) {
+            smallest = left;
+        }
+        if (right < count && heap[right]->deadline_ns < heap[smallest]->deadline_ns) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        mj_heap_swap(heap, index, smallest);
+        index = smallest;
+    }
+}
+
+static int mj_timer_insert(mj_scheduler* scheduler, mj_timer* timer) {
+    if (scheduler->timer_count >= scheduler->timer_capacity) {
+        size_t old_capacity = scheduler->timer_capacity;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : MJ_INITIAL_CAPACITY;
+        mj_timer** heap = scheduler->allocator.realloc(scheduler->allocator.user, scheduler->timer_heap, old_capacity * sizeof(*heap),
+                                                       new_capacity * sizeof(*heap));
+        if (heap == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        scheduler->timer_heap = heap;
+        scheduler->timer_capacity = new_capacity;
+    }
+
+    size_t index = scheduler->timer_count++;
+    scheduler->timer_heap[index] = timer;
+    timer->heap_index = index;
+    mj_heap_bubble_up(scheduler->timer_heap, index);
+    return 0;
+}
+
+static void mj_timer_remove(mj_scheduler* scheduler, mj_timer* timer) {
+    size_t index = timer->heap_index;
+    size_t last = --scheduler->timer_count;
+
+    if (index != last) {
+        mj_heap_swap(scheduler->timer_heap, index, last);
+        // The moved entry can go either way
+        mj_heap_bubble_up(scheduler->timer_heap, index);
+        mj_heap_bubble_down(scheduler->timer_heap, scheduler->timer_count, scheduler->timer_heap[index]->heap_index);
+    }
+    timer->deadline_ns = 0;
+}
+
+static void mj_waiter_link(mj_waiter* waiter, mj_wait_queue* queue) {
+    waiter->queue = queue;
+    waiter->next = NULL;
+    waiter->prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = waiter;
+    } else {
+        queue->head = waiter;
+    }
+    queue->tail = waiter;
+    queue->count++;
+}
+
+static void mj_waiter_unlink(mj_waiter* waiter) {
+    mj_wait_queue* queue = waiter->queue;
+    if (queue == NULL) {
+        return;
+    }
+
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        queue->head = waiter->next;
+    }
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        queue->tail = waiter->prev;
+    }
+    queue->count--;
+    waiter->prev = NULL;
+    waiter->next = NULL;
+    waiter->queue = NULL;
+}
+
+static void mj_runnable_set(mj_scheduler* scheduler, size_t slot) {
+    scheduler->runnable_bits[slot / 64] |= (uint64_t)1 << (slot % 64);
+    scheduler->runnable_count++;
+}
+
+static void mj_runnable_clear(mj_scheduler* scheduler, size_t slot) {
+    scheduler->runnable_bits[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    scheduler->runnable_count--;
+}
+
+// First word from word on with any bit set, words if there is none. Checks four words per compare with
+// AVX2 and two with SSE2, so long stretches of parked or empty slots are skimmed at memory speed.
+static size_t mj_bitmap_next_word(const uint64_t* bits, size_t word, size_t words) {
+#if defined(MJ_BITMAP_AVX2)
+    for (; word + 4 <= words; word += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&bits[word]);
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+    }
+#elif defined(MJ_BITMAP_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; word + 2 <= words; word += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&bits[word]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    while (word < words && bits[word] == 0) {
+        word++;
+    }
+    return word;
+}
+
+// First runnable slot from slot on, MAX_TASKS if there is none
+static size_t mj_runnable_next(const mj_scheduler* scheduler, size_t slot) {
+    if (slot >= MAX_TASKS) {
+        return MAX_TASKS;
+    }
+    size_t word = slot / 64;
+    uint64_t bits = scheduler->runnable_bits[word] & (~(uint64_t)0 << (slot % 64));
+    if (bits == 0) {
+        word = mj_bitmap_next_word(scheduler->runnable_bits, word + 1, MJ_TASK_WORDS);
+        if (word == MJ_TASK_WORDS) {
+            return MAX_TASKS;
+        }
+        bits = scheduler->runnable_bits[word];
+    }
+    return word * 64 + (size_t)__builtin_ctzll(bits); // tzcnt where the target has it
+}
+
+// Ends a wait, whatever the reason: unlink from the wait queue, the token and the timer heap
+static void mj_task_wake(mj_task* task, int result) {
+    if (task->state != MJ_TASK_WAITING) {
+        return;
+    }
+
+    // A select learns which of its sources fired, then leaves all of them
+    task->select_fired = -1;
+    if (task->woken_by && result == 0) {
+        if (task->woken_by == &task->wait_node && task->io_fd >= 0) {
+            task->select_fired = MJ_SELECT_FD;
+        } else if (task->select_cases) {
+            mj_select_case* fired = (mj_select_case*)((char*)task->woken_by - offsetof(mj_select_case, node));
+            task->select_fired = (int)(fired - task->select_cases);
+        }
+    }
+    for (size_t i = 0; i < task->select_count; i++) {
+        mj_waiter_unlink(&task->select_cases[i].node);
+    }
+    task->select_cases = NULL;
+    task->select_count = 0;
+    task->woken_by = NULL;
+
+    mj_waiter_unlink(&task->wait_node);
+    mj_waiter_unlink(&task->cancel_node);
+    if (task->deadline.deadline_ns) {
+        mj_timer_remove(task->scheduler, &task->deadline);
+    }
+    task->io_fd = -1;
+
+    task->wait_result = result;
+    task->state = MJ_TASK_RUNNABLE;
+    mj_runnable_set(task->scheduler, task->slot);
+    if (task->scheduler->current_task == NULL || *task->scheduler->current_task != task) {
+        task->scheduler->lifo = task; // a task removing itself wakes itself, that is no handoff
+    }
+    MJ_PROBE3(task__wake, task->scheduler, task->id, result);
+}
+
+// Wake through a specific waiter, so a select knows which of its sources fired
+static void mj_waiter_wake(mj_waiter* waiter, int result) {
+    mj_task* task = waiter->task;
+    if (task->state == MJ_TASK_WAITING) {
+        task->woken_by = waiter;
+        mj_task_wake(task, result);
+    }
+}
+
+static void mj_task_deadline_fired(mj_scheduler* scheduler, void* arg) {
+    mj_task_wake(arg, ETIMEDOUT);
+}
+
+static void mj_timers_expire(mj_scheduler* scheduler, uint64_t now) {
+    while (scheduler->timer_count > 0 && scheduler->timer_heap[0]->deadline_ns <= now) {
+        mj_timer* timer = scheduler->timer_heap[0];
+        MJ_PROBE3(timer__fire, scheduler, timer, timer->deadline_ns);
+        mj_timer_remove(scheduler, timer);
+        timer->fn(scheduler, timer->arg);
+    }
+}
+
+// The task struct and ctx were charged to the task that allocated them, if any. Called by add and post on
+// the spawner's own thread, a posted task may be adopted long after its spawner was removed.
+static void mj_task_release_spawner(mj_task* spawner, mj_task* task) {
+    mj_mem_uncharge(spawner, sizeof(*task) + task->ctx_size);
+}
+
+// New tasks start runnable and are charged to themselves, not to whoever allocated them
+static void mj_task_adopt(mj_scheduler* scheduler, mj_task* task) {
+    task->state = MJ_TASK_RUNNABLE;
+    task->io_fd = -1;
+    task->id = __atomic_add_fetch(&mj_next_task_id, 1, __ATOMIC_RELAXED);
+    MJ_PROBE3(task__add, scheduler, task->id, task->name);
+
+    task->mem_bytes = 0;
+    mj_mem_charge(scheduler, task, sizeof(*task) + task->ctx_size);
+}
+
+// Puts a task into a free slot. New tasks are adopted first, migrated tasks keep their state and get their
+// fd wait and deadline registered again on this scheduler.
+static void mj_task_attach(mj_scheduler* scheduler, mj_task* task, bool is_new) {
+    size_t slot = scheduler->free_hint;
+    while (scheduler->task_list[slot] != NULL) {
+        slot++;
+    }
+    scheduler->task_list[slot] = task;
+    scheduler->free_hint = slot + 1;
+    task->slot = slot;
+    scheduler->task_count++;
+    task->migrate_target = NULL;
+    task->ran_pass = 0; // passes are counted per scheduler
+    __atomic_store_n(&task->scheduler, scheduler, __ATOMIC_RELEASE); // remote wakes can find it again
+
+    if (is_new) {
+        mj_task_adopt(scheduler, task);
+    }
+
+    if (task->state == MJ_TASK_RUNNABLE) {
+        mj_runnable_set(scheduler, slot);
+        return;
+    }
+
+    if (task->io_fd >= 0) {
+        mj_waiter_link(&task->wait_node, &scheduler->io_waiters);
+    }
+    if (task->resume_deadline_ns) {
+        uint64_t deadline = task->resume_deadline_ns;
+        task->resume_deadline_ns = 0;
+        if (mj_scheduler_timer_arm(scheduler, &task->deadline, deadline) != 0) {
+            mj_task_wake(task, ETIMEDOUT); // no room in the heap, better early than never
+        }
+    }
+}
+
+static mj_epoch_slot* mj_epoch_claim(void) {
+    for (size_t i = 0; i < MJ_EPOCH_MAX_THREADS; i++) {
+        int expected = 0;
+        if (__atomic_load_n(&mj_epoch_slots[i].used, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&mj_epoch_slots[i].used, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return &mj_epoch_slots[i];
+        }
+    }
+    errno = EAGAIN;
+    return NULL;
+}
+
+static void mj_epoch_announce(mj_epoch_slot* slot) {
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // handle reads that follow must not move above the announcement
+}
+
+static void mj_epoch_offline(mj_epoch_slot* slot) {
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+static void mj_epoch_release(mj_epoch_slot* slot) {
+    mj_epoch_offline(slot);
+    __atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+}
+
+static void mj_epoch_try_advance(void) {
+    uint64_t global = __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < MJ_EPOCH_MAX_THREADS; i++) {
+        if (__atomic_load_n(&mj_epoch_slots[i].used, __ATOMIC_ACQUIRE)) {
+            uint64_t epoch = __atomic_load_n(&mj_epoch_slots[i].epoch, __ATOMIC_SEQ_CST);
+            if (epoch != 0 && epoch != global) {
+                return; // someone is still in the previous epoch
+            }
+        }
+    }
+    __atomic_compare_exchange_n(&mj_epoch_global, &global, global + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// Runs the callbacks of everything retired at least two epochs ago
+static void mj_epoch_reclaim(mj_scheduler* scheduler) {
+    mj_epoch_try_advance();
+    uint64_t global = __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST);
+
+    while (scheduler->retired && scheduler->retired->epoch + 2 <= global) {
+        mj_retired* node = scheduler->retired;
+        scheduler->retired = node->next;
+        if (scheduler->retired == NULL) {
+            scheduler->retired_tail = NULL;
+        }
+        node->next = NULL;
+        node->fn(scheduler, node); // may retire it again, which appends with the current epoch
+    }
+}
+
+static void mj_task_reclaim(mj_scheduler* scheduler, mj_retired* node) {
+    mj_task* task = (mj_task*)((char*)node - offsetof(mj_task, retired));
+
+    // Still sitting in a wake inbox, whoever drains it reads the task once more
+    if (scheduler->epoch_slot && __atomic_load_n(&task->wake_posted, __ATOMIC_SEQ_CST)) {
+        mj_scheduler_retire(scheduler, node, mj_task_reclaim);
+        return;
+    }
+    scheduler->allocator.free(scheduler->allocator.user, task, sizeof(*task));
+}
+
+// Lock-free MPSC inbox: any thread pushes onto a Treiber stack, the owning scheduler takes the whole stack at once
+static void mj_scheduler_notify(mj_scheduler* scheduler) {
+    // One byte in the pipe is enough to break poll(), skip the syscall while one is already pending
+    if (__atomic_exchange_n(&scheduler->wake_signalled, 1, __ATOMIC_ACQ_REL) == 0) {
+        char byte = 0;
+        ssize_t written = write(scheduler->wake_fds[1], &byte, 1);
+        (void)written;
+    }
+}
+
+static void mj_inbox_push(mj_scheduler* target, mj_task* task) {
+    mj_task* head = __atomic_load_n(&target->inbox, __ATOMIC_RELAXED);
+    do {
+        task->inbox_next = head;
+    } while (!__atomic_compare_exchange_n(&target->inbox, &head, task, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    mj_scheduler_notify(target);
+}
+
+// Applies timer requests posted from other threads, only the latest request per timer counts
+static void mj_timer_inbox_drain(mj_scheduler* scheduler) {
+    mj_timer* stack = __atomic_exchange_n(&scheduler->timer_inbox, NULL, __ATOMIC_ACQUIRE);
+    while (stack) {
+        mj_timer* timer = stack;
+        stack = timer->posted_next;
+
+        // Clear before reading the deadline, a post after this point queues the timer again
+        __atomic_store_n(&timer->posted, 0, __ATOMIC_SEQ_CST);
+        uint64_t deadline = __atomic_load_n(&timer->posted_deadline_ns, __ATOMIC_SEQ_CST);
+        if (deadline) {
+            mj_scheduler_timer_arm(scheduler, timer, deadline);
+        } else {
+            mj_scheduler_timer_cancel(scheduler, timer);
+        }
+    }
+}
+
+static void mj_wake_push(mj_scheduler* target, mj_task* task) {
+    mj_task* head = __atomic_load_n(&target->wake_inbox, __ATOMIC_RELAXED);
+    do {
+        task->wake_next = head;
+    } while (!__atomic_compare_exchange_n(&target->wake_inbox, &head, task, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    mj_scheduler_notify(target);
+}
+
+// Wakes posted with mj_task_post_wake. A task's scheduler field is only set while it is attached, so
+// wakes for tasks that moved on are forwarded and wakes for tasks still in flight are retried.
+static void mj_wake_inbox_drain(mj_scheduler* scheduler) {
+    mj_task* stack = __atomic_exchange_n(&scheduler->wake_inbox, NULL, __ATOMIC_ACQUIRE);
+    mj_task* retry = NULL;
+    while (stack) {
+        mj_task* task = stack;
+        stack = task->wake_next;
+
+        mj_scheduler* owner = __atomic_load_n(&task->scheduler, __ATOMIC_ACQUIRE);
+        if (owner == scheduler) {
+            // Clear before waking, a wake posted after this point queues the task again
+            __atomic_store_n(&task->wake_posted, 0, __ATOMIC_SEQ_CST);
+            if (task->state == MJ_TASK_WAITING) {
+                mj_task_wake(task, 0);
+            }
+        } else if (owner) {
+            mj_wake_push(owner, task);
+        } else {
+            task->wake_next = retry;
+            retry = task;
+        }
+    }
+
+    while (retry) {
+        mj_task* task = retry;
+        retry = task->wake_next;
+        mj_wake_push(scheduler, task);
+    }
+}
+
+static void mj_inbox_drain(mj_scheduler* scheduler) {
+    if (__atomic_load_n(&scheduler->timer_inbox, __ATOMIC_RELAXED) != NULL) {
+        mj_timer_inbox_drain(scheduler);
+    }
+
+    if (__atomic_load_n(&scheduler->inbox, __ATOMIC_RELAXED) != NULL) {
+        mj_task* stack = __atomic_exchange_n(&scheduler->inbox, NULL, __ATOMIC_ACQUIRE);
+
+        // The stack is newest first, reverse it so tasks attach in the order they were posted
+        mj_task* fifo = NULL;
+        size_t drained = 0;
+        while (stack) {
+            mj_task* next = stack->inbox_next;
+            stack->inbox_next = fifo;
+            fifo = stack;
+            stack = next;
+            drained++;
+        }
+        if (scheduler->incoming_tail) {
+            scheduler->incoming_tail->inbox_next = fifo;
+        } else {
+            scheduler->incoming = fifo;
+        }
+        while (fifo && fifo->inbox_next) {
+            fifo = fifo->inbox_next;
+        }
+        if (fifo) {
+            scheduler->incoming_tail = fifo;
+        }
+        __atomic_sub_fetch(&scheduler->inbound, drained, __ATOMIC_RELEASE);
+    }
+
+    // Tasks that do not fit wait here until slots free up
+    while (scheduler->incoming && scheduler->task_count < MAX_TASKS) {
+        mj_task* task = scheduler->incoming;
+        scheduler->incoming = task->inbox_next;
+        if (scheduler->incoming == NULL) {
+            scheduler->incoming_tail = NULL;
+        }
+        task->inbox_next = NULL;
+        mj_task_attach(scheduler, task, task->id == 0);
+    }
+
+    if (__atomic_load_n(&scheduler->wake_inbox, __ATOMIC_RELAXED) != NULL) {
+        mj_wake_inbox_drain(scheduler);
+    }
+}
+
+// True while the run loop has anything left to do or may still be handed work from another thread
+static bool mj_scheduler_alive(mj_scheduler* scheduler) {
+    return scheduler->task_count > 0 || scheduler->incoming != NULL || __atomic_load_n(&scheduler->holds, __ATOMIC_ACQUIRE) > 0 ||
+           __atomic_load_n(&scheduler->inbound, __ATOMIC_ACQUIRE) > 0 || __atomic_load_n(&scheduler->inbox, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// Polls the wake pipe and every fd a task waits on, wakes the ready ones with their revents
+static int mj_scheduler_poll_io(mj_scheduler* scheduler, int timeout_ms) {
+    size_t count = scheduler->io_waiters.count + 1;
+    if (count > scheduler->io_capacity) {
+        size_t old_capacity = scheduler->io_capacity;
+        size_t new_capacity = old_capacity ? old_capacity : MJ_INITIAL_CAPACITY;
+        while (new_capacity < count) {
+            new_capacity *= 2;
+        }
+        struct pollfd* fds = scheduler->allocator.realloc(scheduler->allocator.user, scheduler->io_fds, old_capacity * sizeof(*fds),
+                                                          new_capacity * sizeof(*fds));
+        if (fds == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        scheduler->io_fds = fds;
+        scheduler->io_capacity = new_capacity;
+    }
+
+    scheduler->io_fds[0].fd = scheduler->wake_fds[0];
+    scheduler->io_fds[0].events = POLLIN;
+    scheduler->io_fds[0].revents = 0;
+    size_t n = 1;
+    for (mj_waiter* waiter = scheduler->io_waiters.head; waiter; waiter = waiter->next) {
+        scheduler->io_fds[n].fd = waiter->task->io_fd;
+        scheduler->io_fds[n].events = waiter->task->io_events;
+        scheduler->io_fds[n].revents = 0;
+        n++;
+    }
+
+    MJ_PROBE3(poll__begin, scheduler, n, timeout_ms);
+    // A blocked scheduler holds no handles, do not let it hold up reclamation
+    if (timeout_ms != 0 && scheduler->epoch_slot) {
+        mj_epoch_offline(scheduler->epoch_slot);
+    }
+    int ready = poll(scheduler->io_fds, (nfds_t)n, timeout_ms);
+    if (timeout_ms != 0 && scheduler->epoch_slot) {
+        mj_epoch_announce(scheduler->epoch_slot);
+    }
+    MJ_PROBE2(poll__end, scheduler, ready);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    if (scheduler->io_fds[0].revents) {
+        char drain[64];
+        while (read(scheduler->wake_fds[0], drain, sizeof(drain)) > 0);
+        // Reset before looking at the inbox, a push after this point writes a new byte
+        __atomic_store_n(&scheduler->wake_signalled, 0, __ATOMIC_SEQ_CST);
+        ready--;
+    }
+
+    // Same order as the array, grab next before waking unlinks the waiter
+    mj_waiter* waiter = scheduler->io_waiters.head;
+    for (size_t i = 1; i < n && ready > 0; i++) {
+        mj_waiter* next = waiter->next;
+        if (scheduler->io_fds[i].revents) {
+            waiter->task->io_revents = scheduler->io_fds[i].revents;
+            mj_waiter_wake(waiter, 0);
+            ready--;
+        }
+        waiter = next;
+    }
+    return 0;
+}
+
+// Wait phase. With runnable tasks it only polls fds without blocking, otherwise it blocks
+// until the earliest timer, fd event or wake from another thread.
+static int mj_scheduler_wait(mj_scheduler* scheduler) {
+    if (!mj_scheduler_alive(scheduler)) {
+        return 0; // the loop is about to return
+    }
+
+    // A remote wake pushed after the drain makes the loop go round again instead of blocking or giving up
+    bool idle = scheduler->runnable_count == 0 && scheduler->incoming == NULL && __atomic_load_n(&scheduler->inbox, __ATOMIC_ACQUIRE) == NULL &&
+                __atomic_load_n(&scheduler->wake_inbox, __ATOMIC_ACQUIRE) == NULL;
+    if (!idle && scheduler->io_waiters.count == 0) {
+        return 0;
+    }
+
+    int timeout_ms = 0;
+    if (idle) {
+        if (scheduler->timer_count > 0) {
+            uint64_t now = mj_time_now_ns();
+            uint64_t deadline = scheduler->timer_heap[0]->deadline_ns;
+            uint64_t wait_ns = deadline > now ? deadline - now : 0;
+            uint64_t wait_ms = (wait_ns + 999999) / 1000000; // round up, waking early just spins once more
+            timeout_ms = wait_ms > INT_MAX ? INT_MAX : (int)wait_ms;
+        } else if (scheduler->io_waiters.count > 0 || __atomic_load_n(&scheduler->holds, __ATOMIC_ACQUIRE) > 0 ||
+                   __atomic_load_n(&scheduler->inbound, __ATOMIC_ACQUIRE) > 0) {
+            timeout_ms = -1;
+        } else {
+            errno = EDEADLK; // every task is parked and nothing will ever wake them
+            return -1;
+        }
+    }
+
+    if (mj_scheduler_poll_io(scheduler, timeout_ms) != 0) {
+        return -1;
+    }
+
+    if (scheduler->timer_count > 0) {
+        mj_timers_expire(scheduler, mj_time_now_ns());
+    }
+    return 0;
+}
+
+static mj_task_batch_fn mj_batch_lookup(const mj_scheduler* scheduler, mj_task_fn run) {
+    for (size_t i = 0; i < scheduler->batch_type_count; i++) {
+        if (scheduler->batch_run[i] == run) {
+            return scheduler->batch_fn[i];
+        }
+    }
+    return NULL;
+}
+
+// Gathers the runnable tasks of the type in slot start, from there to the end of the list, and hands them
+// to run_batch in one call. return false if there is only the one, it goes through its own run then.
+static bool mj_scheduler_run_batch(mj_scheduler* scheduler, size_t start, mj_task_batch_fn run_batch) {
+    mj_task_fn run = scheduler->task_list[start]->run;
+    size_t count = 0;
+    for (size_t i = start; i < MAX_TASKS; i = mj_runnable_next(scheduler, i + 1)) {
+        mj_task* task = scheduler->task_list[i];
+        if (task->run == run && task->ran_pass != scheduler->pass) { // not if it already ran from the wake slot
+            scheduler->batch_contexts[count] = task->ctx;
+            scheduler->batch_tasks[count] = task;
+            scheduler->batch_slots[count] = &scheduler->task_list[i];
+            count++;
+        }
+    }
+    if (count < 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        scheduler->batch_tasks[i]->ran_pass = scheduler->pass;
+    }
+    // No task is current until run_batch focuses one, profiles attribute the batch to the type
+    const char* name = scheduler->batch_tasks[0]->name;
+    scheduler->batch_count = count;
+    mj_thread_task_name = name;
+    mj_thread_task_id = scheduler->batch_tasks[0]->id;
+    mj_thread_runs++;
+    MJ_PROBE3(task__batch__begin, scheduler, count, name);
+
+    run_batch(scheduler, scheduler->batch_contexts, count);
+
+    MJ_PROBE3(task__batch__end, scheduler, count, name);
+    scheduler->batch_count = 0;
+    scheduler->current_task = NULL;
+    mj_thread_task_id = 0;
+    mj_thread_task_name = NULL;
+    return true;
+}
+
+// Calls the run function of the task in slot with its context
+static void mj_scheduler_run_task(mj_scheduler* scheduler, mj_task** current_task_slot) {
+    mj_task* current_task = *current_task_slot;
+    scheduler->current_task = current_task_slot; // Note: double pointers
+    mj_thread_task_name = current_task->name;
+    mj_thread_task_id = current_task->id;
+    mj_thread_runs++;
+    MJ_PROBE3(task__run__begin, scheduler, current_task->id, current_task->name);
+
+    current_task->run(scheduler, current_task->ctx);
+
+    // The task may be gone, only report it if it is still in its slot
+    current_task = *current_task_slot;
+    MJ_PROBE3(task__run__end, scheduler, current_task ? current_task->id : 0, current_task ? current_task->name : NULL);
+
+    // Reset current function since it should only be available from the task that just ran
+    scheduler->current_task = NULL;
+    mj_thread_task_id = 0;
+    mj_thread_task_name = NULL;
+
+    // Hand a migrating task over only now that it has stopped running here
+    if (scheduler->migrating) {
+        mj_task* migrating = scheduler->migrating;
+        scheduler->migrating = NULL;
+        mj_inbox_push(migrating->migrate_target, migrating);
+    }
+}
+
+static void mj_microtasks_drain(mj_scheduler* scheduler) {
+    while (scheduler->microtask_head) {
+        mj_microtask* microtask = scheduler->microtask_head;
+        scheduler->microtask_head = microtask->next;
+        if (scheduler->microtask_head == NULL) {
+            scheduler->microtask_tail = NULL;
+        }
+        microtask->next = NULL;
+        microtask->queued = false;
+        microtask->fn(scheduler, microtask->arg);
+    }
+}
+
+// After a run: its microtasks, then the task it woke last while whatever it was woken with is still in
+// cache, and so on up to MJ_LIFO_BUDGET handoffs. A task that already ran this pass, in slot order, in a
+// batch or from the wake slot, is not handed the slot again, so no task runs twice in one pass.
+static void mj_scheduler_run_handoffs(mj_scheduler* scheduler) {
+    mj_microtasks_drain(scheduler);
+    for (int n = 0; n < MJ_LIFO_BUDGET && scheduler->lifo; n++) {
+        mj_task* task = scheduler->lifo;
+        scheduler->lifo = NULL;
+        if (task->run == NULL || task->state != MJ_TASK_RUNNABLE || task->ran_pass == scheduler->pass) {
+            continue;
+        }
+        task->ran_pass = scheduler->pass;
+        mj_scheduler_run_task(scheduler, &scheduler->task_list[task->slot]);
+        mj_microtasks_drain(scheduler);
+    }
+    scheduler->lifo = NULL; // over budget, it runs in slot order
+}
+
+int mj_scheduler_run(mj_scheduler* scheduler) {
+    if (scheduler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    mj_task* current_task = NULL;
+
+    scheduler->epoch_slot = mj_epoch_claim();
+    if (scheduler->epoch_slot == NULL) {
+        return -1;
+    }
+    mj_epoch_run_slot = scheduler->epoch_slot;
+    mj_thread_scheduler = scheduler;
+
+    while (mj_scheduler_alive(scheduler)) {
+        scheduler->pass++;
+        // Quiescent point, no handle read during the previous iteration is held any more
+        mj_epoch_announce(scheduler->epoch_slot);
+        if (scheduler->retired) {
+            mj_epoch_reclaim(scheduler);
+        }
+
+        // Tasks posted or migrated here from other threads
+        mj_inbox_drain(scheduler);
+        mj_microtasks_drain(scheduler); // queued by timers that fired in the wait phase
+        scheduler->lifo = NULL;         // only wakes by tasks of this pass are handoffs
+
+        // Only runnable slots are visited, parked tasks are woken by a wait queue, deadline or cancellation.
+        // The bitmap is read again after every run, which may wake, park or remove tasks. Tasks added in
+        // the meantime are staged, the list does not change under the loop.
+        scheduler->in_pass = true;
+        for (size_t i = mj_runnable_next(scheduler, 0); i < MAX_TASKS; i = mj_runnable_next(scheduler, i + 1)) {
+            current_task = scheduler->task_list[i];
+
+            // Skip if task has no run function
+            if (current_task->run == NULL) {
+                continue;
+            }
+
+            // Already ran this pass, in a batch or from the wake slot
+            if (current_task->ran_pass == scheduler->pass) {
+                continue;
+            }
+            // Batched types run all their runnable tasks at once
+            if (scheduler->batch_type_count > 0) {
+                mj_task_batch_fn run_batch = mj_batch_lookup(scheduler, current_task->run);
+                if (run_batch && mj_scheduler_run_batch(scheduler, i, run_batch)) {
+                    mj_scheduler_run_handoffs(scheduler);
+                    continue;
+                }
+            }
+
+            current_task->ran_pass = scheduler->pass; // a later wake must not hand it the slot again
+            mj_scheduler_run_task(scheduler, &scheduler->task_list[i]);
+            mj_scheduler_run_handoffs(scheduler);
+        }
+        scheduler->in_pass = false;
+
+        // Tasks spawned during the pass, they all first run in the next one
+        while (scheduler->spawned) {
+            mj_task* task = scheduler->spawned;
+            scheduler->spawned = task->inbox_next;
+            task->inbox_next = NULL;
+            mj_task_attach(scheduler, task, false);
+        }
+        scheduler->spawned_tail = NULL;
+        scheduler->spawned_count = 0;
+
+        // Timer phase, a single peek when nothing is due
+        if (scheduler->timer_count > 0) {
+            mj_timers_expire(scheduler, mj_time_now_ns());
+        }
+        mj_microtasks_drain(scheduler);
+
+        // Wait phase, polls fds and blocks only when every remaining task is parked
+        if (mj_scheduler_wait(scheduler) != 0) {
+            int error = errno;
+            mj_epoch_release(scheduler->epoch_slot);
+            scheduler->epoch_slot = NULL;
+            mj_epoch_run_slot = NULL;
+            mj_thread_scheduler = NULL;
+            errno = error;
+            return -1;
+        }
+    }
+
+    mj_epoch_release(scheduler->epoch_slot);
+    scheduler->epoch_slot = NULL;
+    mj_epoch_run_slot = NULL;
+    mj_thread_scheduler = NULL;
+
+    // All tasks completed
+    return 0;
+}
+
+mj_scheduler* mj_scheduler_create(void) {
+    return mj_scheduler_create_with_allocator(NULL);
+}
+
+mj_scheduler* mj_scheduler_create_with_allocator(const mj_allocator* allocator) {
+    if (allocator == NULL) {
+        allocator = &mj_libc_allocator;
+    }
+    if (allocator->alloc == NULL || allocator->free == NULL || allocator->realloc == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // The scheduler itself comes from the allocator too
+    mj_scheduler* scheduler = allocator->alloc(allocator->user, sizeof(*scheduler));
+    if (!scheduler) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(scheduler, 0, sizeof(*scheduler));
+
+    scheduler->allocator = *allocator;
+    scheduler->current_task = NULL;
+    scheduler->task_count = 0;
+
+    // Self-pipe, lets other threads interrupt the wait phase
+    scheduler->wake_fds[0] = -1;
+    scheduler->wake_fds[1] = -1;
+    if (pipe(scheduler->wake_fds) != 0) {
+        int error = errno;
+        mj_scheduler_destroy(&scheduler);
+        errno = error;
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(scheduler->wake_fds[i], F_GETFL, 0);
+        fcntl(scheduler->wake_fds[i], F_SETFL, flags | O_NONBLOCK);
+    }
+
+    return scheduler;
+}
+
+int mj_scheduler_task_add(mj_scheduler* scheduler, mj_task* new_task) {
+    if (scheduler == NULL || new_task == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    // if scheduler is full, counting the slots promised to tasks spawned this pass
+    if (scheduler->task_count + scheduler->spawned_count >= MAX_TASKS) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mj_task_release_spawner(mj_current(scheduler), new_task);
+
+    // Added during a pass, staged so where it lands can not decide whether it runs in this pass
+    if (scheduler->in_pass) {
+        mj_task_adopt(scheduler, new_task);
+        new_task->inbox_next = NULL;
+        if (scheduler->spawned_tail) {
+            scheduler->spawned_tail->inbox_next = new_task;
+        } else {
+            scheduler->spawned = new_task;
+        }
+        scheduler->spawned_tail = new_task;
+        scheduler->spawned_count++;
+        return 0;
+    }
+
+    // Add task to first empty slot in task_list[]
+    mj_task_attach(scheduler, new_task, true);
+    return 0;
+}
+
+int mj_scheduler_task_post(mj_scheduler* target, mj_task* task) {
+    if (target == NULL || task == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    task->scheduler = NULL; // id 0 marks it as new for mj_task_attach
+    if (mj_thread_scheduler) {
+        mj_task_release_spawner(mj_current(mj_thread_scheduler), task);
+    }
+    __atomic_add_fetch(&target->inbound, 1, __ATOMIC_ACQ_REL);
+    mj_inbox_push(target, task);
+    return 0;
+}
+
+// True if an armed timer lives in the task's ctx, its callback would still fire here once the ctx has moved on
+static bool mj_task_has_timers(const mj_scheduler* scheduler, const mj_task* task) {
+    uintptr_t begin = (uintptr_t)task->ctx;
+    uintptr_t end = begin + task->ctx_size;
+    for (size_t i = 0; begin != 0 && i < scheduler->timer_count; i++) {
+        uintptr_t timer = (uintptr_t)scheduler->timer_heap[i];
+        if (timer >= begin && timer < end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int mj_scheduler_task_migrate_current(mj_scheduler* scheduler, mj_scheduler* target) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    if (task == NULL || target == NULL || target == scheduler) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Waits on queues and tokens belong to primitives of this thread, they can not move along, and neither
+    // can timers in this thread's heap. A batch may still touch the task's ctx after it is handed over.
+    if (scheduler->batch_count > 0 || (task->wait_node.queue && task->wait_node.queue != &scheduler->io_waiters) || task->cancel_node.queue || task->select_count ||
+        mj_task_has_timers(scheduler, task)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    MJ_PROBE3(task__migrate, scheduler, task->id, target);
+
+    // Take the deadline and fd wait out of this scheduler, mj_task_attach registers them on the target
+    if (task->deadline.deadline_ns) {
+        task->resume_deadline_ns = task->deadline.deadline_ns;
+        mj_timer_remove(scheduler, &task->deadline);
+    }
+    mj_waiter_unlink(&task->wait_node);
+
+    *scheduler->current_task = NULL; // slot is free, mj_current() is NULL for the rest of this run
+    scheduler->task_count--;
+    if (task->slot < scheduler->free_hint) {
+        scheduler->free_hint = task->slot;
+    }
+    if (task->state == MJ_TASK_RUNNABLE) {
+        mj_runnable_clear(scheduler, task->slot);
+    }
+
+    // Pushed to the target's inbox by the run loop once this run returns. Until the target attaches it
+    // the task has no scheduler, remote wakes look at migrate_target instead.
+    __atomic_store_n(&task->migrate_target, target, __ATOMIC_RELEASE);
+    __atomic_store_n(&task->scheduler, NULL, __ATOMIC_RELEASE);
+    scheduler->migrating = task;
+    __atomic_add_fetch(&target->inbound, 1, __ATOMIC_ACQ_REL);
+    return 0;
+}
+
+void mj_scheduler_hold(mj_scheduler* scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+
+    __atomic_add_fetch(&scheduler->holds, 1, __ATOMIC_ACQ_REL);
+}
+
+void mj_scheduler_release(mj_scheduler* scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+
+    // Wake the loop so it can notice it may exit
+    __atomic_sub_fetch(&scheduler->holds, 1, __ATOMIC_ACQ_REL);
+    mj_scheduler_notify(scheduler);
+}
+
+// Calls the tasks cleanup function and then it frees the task
+int mj_scheduler_task_remove_current(mj_scheduler* scheduler) {
+    if (scheduler == NULL || scheduler->current_task == NULL || *scheduler->current_task == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // helper stack alias for shorter code
+    mj_task* task = *scheduler->current_task;
+
+    MJ_PROBE3(task__remove, scheduler, task->id, task->name);
+
+    // Parked and removed in the same run, drop the wait registrations first
+    mj_task_wake(task, ECANCELED);
+
+    // use custom cleanup for any internal data if availible
+    if (task->cleanup && task->ctx) {
+        task->cleanup(scheduler, task->ctx);
+    }
+
+    // Run task-local storage destructors, after cleanup so it can still read its values
+    for (size_t key = 0; key < tls_key_count; key++) {
+        void* value = task->tls[key];
+        task->tls[key] = NULL;
+        if (value && tls_destructors[key]) {
+            tls_destructors[key](value);
+        }
+    }
+
+    // Arena memory dies with the task, TLS values and cleanup may have pointed into it
+    mj_arena_release(scheduler, task);
+
+    // Free the tasks context
+    mj_scheduler_free(scheduler, task->ctx, task->ctx_size);
+    task->ctx = NULL;
+
+    // Other threads may still hold the handle, the task struct is freed once none can
+    size_t slot = task->slot;
+    task->state = MJ_TASK_REMOVED;
+    mj_mem_uncharge(task, sizeof(*task));
+    mj_scheduler_retire(scheduler, &task->retired, mj_task_reclaim);
+    task = NULL;
+
+    // Clear the slot in scheduler->task_list
+    *scheduler->current_task = NULL;
+    if (slot < scheduler->free_hint) {
+        scheduler->free_hint = slot;
+    }
+
+    // Clear the current_task pointer
+    scheduler->current_task = NULL;
+
+    // Decrement task count, the current task is always runnable
+    if (scheduler->task_count > 0)
+        scheduler->task_count--;
+    if (scheduler->runnable_count > 0)
+        mj_runnable_clear(scheduler, slot);
+
+    return 0;
+}
+
+int mj_scheduler_destroy(mj_scheduler** scheduler) {
+    if (scheduler == NULL || *scheduler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Don't cleanup if tasks are left, or still on their way in
+    if ((*scheduler)->task_count > 0 || (*scheduler)->incoming || __atomic_load_n(&(*scheduler)->inbox, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&(*scheduler)->inbound, __ATOMIC_ACQUIRE)) {
+        errno = EBUSY; // resource busy
+        return 1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if ((*scheduler)->wake_fds[i] >= 0) {
+            close((*scheduler)->wake_fds[i]);
+        }
+    }
+    // Nothing runs any more, whatever is still retired can go
+    while ((*scheduler)->retired) {
+        mj_retired* node = (*scheduler)->retired;
+        (*scheduler)->retired = node->next;
+        node->fn(*scheduler, node);
+    }
+    (*scheduler)->retired_tail = NULL;
+
+    mj_scheduler_arena_trim(*scheduler);
+    mj_scheduler_free(*scheduler, (*scheduler)->timer_heap, (*scheduler)->timer_capacity * sizeof(mj_timer*));
+    mj_scheduler_free(*scheduler, (*scheduler)->io_fds, (*scheduler)->io_capacity * sizeof(struct pollfd));
+
+    // Copy the allocator out, it lives inside the memory being freed
+    mj_allocator allocator = (*scheduler)->allocator;
+    allocator.free(allocator.user, *scheduler, sizeof(**scheduler));
+
+    // Clear caller's pointer to avoid dangling references, this is why we use double pointers
+    *scheduler = NULL;
+
+    return 0;
+}
+
+void* mj_scheduler_alloc(mj_scheduler* scheduler, size_t size) {
+    if (scheduler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* ptr = scheduler->allocator.alloc(scheduler->allocator.user, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mj_mem_charge(scheduler, mj_current(scheduler), size);
+    return ptr;
+}
+
+void* mj_scheduler_calloc(mj_scheduler* scheduler, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* ptr = mj_scheduler_alloc(scheduler, count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void* mj_scheduler_realloc(mj_scheduler* scheduler, void* ptr, size_t old_size, size_t new_size) {
+    if (scheduler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* new_ptr = scheduler->allocator.realloc(scheduler->allocator.user, ptr, old_size, new_size);
+    if (new_ptr == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (new_size > old_size) {
+        mj_mem_charge(scheduler, mj_current(scheduler), new_size - old_size);
+    } else {
+        mj_mem_uncharge(mj_current(scheduler), old_size - new_size);
+    }
+    return new_ptr;
+}
+
+// NULL is ignored, like free()
+void mj_scheduler_free(mj_scheduler* scheduler, void* ptr, size_t size) {
+    if (scheduler == NULL || ptr == NULL) {
+        return;
+    }
+
+    mj_mem_uncharge(mj_current(scheduler), size);
+    scheduler->allocator.free(scheduler->allocator.user, ptr, size);
+}
+
+void* mj_scheduler_arena_alloc(mj_scheduler* scheduler, size_t size) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    if (task == NULL || size == 0 || size > SIZE_MAX - MJ_ARENA_HEADER - MJ_ARENA_ALIGN) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size = MJ_ARENA_ROUND(size);
+
+    // Oversized, give it its own allocation so pooled chunks stay one size
+    if (size > MJ_ARENA_CHUNK_SIZE) {
+        mj_arena_chunk* large = scheduler->allocator.alloc(scheduler->allocator.user, MJ_ARENA_HEADER + size);
+        if (large == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        large->size = size;
+        large->next = task->arena_large;
+        task->arena_large = large;
+
+        task->arena_bytes += MJ_ARENA_HEADER + size;
+        mj_mem_charge(scheduler, task, MJ_ARENA_HEADER + size);
+        return (char*)large + MJ_ARENA_HEADER;
+    }
+
+    if (task->arena_head == NULL || task->arena_offset + size > MJ_ARENA_CHUNK_SIZE) {
+        mj_arena_chunk* chunk = mj_arena_chunk_get(scheduler);
+        if (chunk == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        chunk->next = task->arena_head;
+        if (task->arena_head == NULL) {
+            task->arena_tail = chunk;
+        }
+        task->arena_head = chunk;
+        task->arena_offset = 0;
+        task->arena_chunks++;
+
+        task->arena_bytes += MJ_ARENA_HEADER + MJ_ARENA_CHUNK_SIZE;
+        mj_mem_charge(scheduler, task, MJ_ARENA_HEADER + MJ_ARENA_CHUNK_SIZE);
+    }
+
+    void* ptr = (char*)task->arena_head + MJ_ARENA_HEADER + task->arena_offset;
+    task->arena_offset += size;
+    return ptr;
+}
+
+void mj_scheduler_arena_trim(mj_scheduler* scheduler) {
     if (scheduler == NULL) {
+        return;
+    }
+
+    while (scheduler->arena_pool) {
+        mj_arena_chunk* next = scheduler->arena_pool->next;
+        scheduler->allocator.free(scheduler->allocator.user, scheduler->arena_pool, MJ_ARENA_HEADER + MJ_ARENA_CHUNK_SIZE);
+        scheduler->arena_pool = next;
+    }
+    scheduler->arena_pool_count = 0;
+}
+
+int mj_task_set_mem_group(mj_task* task, mj_mem_group* group) {
+    if (task == NULL) {
         errno = EINVAL;
         return -1;
     }
-    mj_task** current_task_slot = NULL;
-    mj_task* current_task = NULL;
 
-    while (scheduler->task_count > 0) {
-        for (int i = 0; i < MAX_TASKS; i++) {
-            current_task_slot = &scheduler->task_list[i];
-            current_task = *current_task_slot;
-            // Skip to next if no task in slot
-            if (current_task == NULL) {
-                continue;
-            }
+    task->mem_group = group;
+    return 0;
+}
 
-            // Skip if task has no run function
-            if (current_task->run == NULL) {
-                continue;
-            }
+int mj_task_set_mem_budget(mj_task* task, size_t budget) {
+    if (task == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    task->mem_budget = budget;
+    return 0;
+}
+
+size_t mj_task_mem_bytes(const mj_task* task) {
+    return task ? task->mem_bytes : 0;
+}
+
+void mj_scheduler_set_mem_limit_callback(mj_scheduler* scheduler, mj_mem_limit_fn callback) {
+    if (scheduler == NULL) {
+        return;
+    }
+
+    scheduler->mem_limit_callback = callback;
+}
 
-            scheduler->current_task = current_task_slot; // Note: double pointers
+uint64_t mj_time_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+uint64_t mj_deadline_in_ms(uint64_t ms) {
+    return mj_time_now_ns() + ms * 1000000ULL;
+}
 
-            // Call tasks run function with its context
-            current_task->run(scheduler, current_task->ctx);
+// Registers the deadline, queue and token of a wait and parks the task, the caller has validated them
+static int mj_task_park(mj_scheduler* scheduler, mj_task* task, mj_wait_queue* queue, uint64_t deadline_ns, mj_cancel_token* token) {
+    if (task->state != MJ_TASK_RUNNABLE) {
+        errno = EBUSY; // already parked during this run
+        return -1;
+    }
+    if (token && token->cancelled) {
+        errno = ECANCELED;
+        return -1;
+    }
 
-            // Reset current function since it should only be available from the task that just ran
-            scheduler->current_task = NULL;
+    if (deadline_ns) {
+        mj_timer_init(&task->deadline, mj_task_deadline_fired, task);
+        if (mj_scheduler_timer_arm(scheduler, &task->deadline, deadline_ns) != 0) {
+            return -1;
         }
     }
-    // All tasks completed
+
+    task->wait_node.task = task;
+    task->cancel_node.task = task;
+    if (queue) {
+        mj_waiter_link(&task->wait_node, queue);
+    }
+    if (token) {
+        mj_waiter_link(&task->cancel_node, &token->waiters);
+    }
+
+    task->wait_result = 0;
+    task->state = MJ_TASK_WAITING;
+    mj_runnable_clear(scheduler, task->slot);
+    MJ_PROBE3(task__wait, scheduler, task->id, deadline_ns);
     return 0;
 }
 
-mj_scheduler* mj_scheduler_create(void) {
-    mj_scheduler* scheduler = calloc(1, sizeof(*scheduler));
-    if (!scheduler) {
-        errno = ENOMEM;
-        return NULL;
+int mj_scheduler_task_wait(mj_scheduler* scheduler, mj_wait_queue* queue, uint64_t deadline_ns, mj_cancel_token* token) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    if (task == NULL || (queue == NULL && deadline_ns == 0 && token == NULL)) {
+        errno = EINVAL;
+        return -1;
     }
 
-    scheduler->current_task = NULL;
-    scheduler->task_count = 0;
+    return mj_task_park(scheduler, task, queue, deadline_ns, token);
+}
 
-    return scheduler;
+int mj_scheduler_task_select(mj_scheduler* scheduler, mj_select_case* cases, size_t count, int fd, short events, uint64_t deadline_ns,
+                             mj_cancel_token* token) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    if (task == NULL || (count > 0 && cases == NULL) || (fd >= 0 && events == 0) ||
+        (count == 0 && fd < 0 && deadline_ns == 0 && token == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (cases[i].queue == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if (mj_task_park(scheduler, task, fd >= 0 ? &scheduler->io_waiters : NULL, deadline_ns, token) != 0) {
+        return -1;
+    }
+    if (fd >= 0) {
+        task->io_fd = fd;
+        task->io_events = events;
+        task->io_revents = 0;
+    }
+
+    // One waiter per source, whichever is woken first unlinks the rest in mj_task_wake
+    for (size_t i = 0; i < count; i++) {
+        cases[i].node.task = task;
+        mj_waiter_link(&cases[i].node, cases[i].queue);
+    }
+    task->select_cases = cases;
+    task->select_count = count;
+    return 0;
 }
 
-int mj_scheduler_task_add(mj_scheduler* scheduler, mj_task* new_task) {
-    if (scheduler == NULL || new_task == NULL) {
+int mj_scheduler_task_select_fired(const mj_scheduler* scheduler) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    return task ? task->select_fired : -1;
+}
+
+int mj_scheduler_task_sleep_ms(mj_scheduler* scheduler, uint64_t ms) {
+    // Never 0, that would mean no deadline
+    return mj_scheduler_task_wait(scheduler, NULL, mj_deadline_in_ms(ms) | 1, NULL);
+}
+
+int mj_scheduler_task_wait_fd(mj_scheduler* scheduler, int fd, short events, uint64_t deadline_ns, mj_cancel_token* token) {
+    if (fd < 0 || events == 0) {
         errno = EINVAL;
         return -1;
     }
-    // if scheduler is full
-    if (scheduler->task_count >= MAX_TASKS) {
-        errno = ENOMEM;
+    if (mj_scheduler_task_wait(scheduler, &scheduler->io_waiters, deadline_ns, token) != 0) {
         return -1;
     }
 
-    // Add task to first empty slot in task_list[]
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (scheduler->task_list[i] == NULL) {
-            scheduler->task_list[i] = new_task;
-            scheduler->task_count++;
-            return 0;
-        }
+    mj_task* task = mj_current(scheduler);
+    task->io_fd = fd;
+    task->io_events = events;
+    task->io_revents = 0;
+    MJ_PROBE5(task__wait__fd, scheduler, task->id, fd, events, deadline_ns);
+    return 0;
+}
+
+short mj_scheduler_task_io_revents(const mj_scheduler* scheduler) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    return task ? task->io_revents : 0;
+}
+
+void mj_timer_init(mj_timer* timer, mj_timer_fn fn, void* arg) {
+    if (timer == NULL) {
+        return;
     }
-    // Should never happen
-    errno = ENOMEM;
-    return -1;
+
+    timer->deadline_ns = 0;
+    timer->heap_index = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->posted_deadline_ns = 0;
+    timer->posted = 0;
+    timer->posted_next = NULL;
 }
 
-// Calls the tasks cleanup function and then it frees the task
-int mj_scheduler_task_remove_current(mj_scheduler* scheduler) {
-    if (scheduler == NULL || scheduler->current_task == NULL || *scheduler->current_task == NULL) {
+int mj_scheduler_timer_arm(mj_scheduler* scheduler, mj_timer* timer, uint64_t deadline_ns) {
+    if (scheduler == NULL || timer == NULL || timer->fn == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    // helper stack alias for shorter code
-    mj_task* task = *scheduler->current_task;
+    // Re-arming moves the timer
+    if (timer->deadline_ns) {
+        mj_timer_remove(scheduler, timer);
+    }
 
-    // use custom cleanup for any internal data if availible
-    if (task->cleanup && task->ctx) {
-        task->cleanup(scheduler, task->ctx);
+    timer->deadline_ns = deadline_ns ? deadline_ns : 1; // 0 is reserved for "not armed"
+    if (mj_timer_insert(scheduler, timer) != 0) {
+        timer->deadline_ns = 0;
+        return -1;
     }
+    return 0;
+}
 
-    // Free the tasks context
-    free(task->ctx);
-    task->ctx = NULL;
+void mj_scheduler_timer_cancel(mj_scheduler* scheduler, mj_timer* timer) {
+    if (scheduler == NULL || timer == NULL || timer->deadline_ns == 0) {
+        return;
+    }
 
-    // Free the task itself
-    free(task);
-    task = NULL;
+    mj_timer_remove(scheduler, timer);
+}
 
-    // Clear the slot in scheduler->task_list
-    *scheduler->current_task = NULL;
+static int mj_timer_post(mj_scheduler* owner, mj_timer* timer, uint64_t deadline_ns) {
+    if (owner == NULL || timer == NULL || timer->fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    // Clear the current_task pointer
-    scheduler->current_task = NULL;
+    __atomic_store_n(&timer->posted_deadline_ns, deadline_ns, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&timer->posted, 1, __ATOMIC_SEQ_CST) == 1) {
+        return 0; // already queued, the owner reads the new deadline when it gets there
+    }
 
-    // Decrement task count
-    if (scheduler->task_count > 0)
-        scheduler->task_count--;
+    mj_timer* head = __atomic_load_n(&owner->timer_inbox, __ATOMIC_RELAXED);
+    do {
+        timer->posted_next = head;
+    } while (!__atomic_compare_exchange_n(&owner->timer_inbox, &head, timer, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
+    mj_scheduler_notify(owner);
     return 0;
 }
 
-int mj_scheduler_destroy(mj_scheduler** scheduler) {
-    if (scheduler == NULL || *scheduler == NULL) {
+int mj_scheduler_timer_post_arm(mj_scheduler* owner, mj_timer* timer, uint64_t deadline_ns) {
+    return mj_timer_post(owner, timer, deadline_ns ? deadline_ns : 1); // 0 is reserved for cancel
+}
+
+int mj_scheduler_timer_post_cancel(mj_scheduler* owner, mj_timer* timer) {
+    return mj_timer_post(owner, timer, 0);
+}
+
+int mj_epoch_enter(void) {
+    if (mj_epoch_run_slot) {
+        return 0; // scheduler threads are inside an epoch for the whole run
+    }
+    if (mj_epoch_depth++ > 0) {
+        return 0;
+    }
+
+    mj_epoch_enter_slot = mj_epoch_claim();
+    if (mj_epoch_enter_slot == NULL) {
+        mj_epoch_depth = 0;
+        return -1;
+    }
+    mj_epoch_announce(mj_epoch_enter_slot);
+    return 0;
+}
+
+void mj_epoch_exit(void) {
+    if (mj_epoch_run_slot || mj_epoch_depth == 0) {
+        return;
+    }
+    if (--mj_epoch_depth > 0) {
+        return;
+    }
+
+    mj_epoch_release(mj_epoch_enter_slot);
+    mj_epoch_enter_slot = NULL;
+}
+
+int mj_scheduler_retire(mj_scheduler* scheduler, mj_retired* node, mj_retire_fn fn) {
+    if (scheduler == NULL || node == NULL || fn == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    // Don't cleanup if tasks are left
-    if ((*scheduler)->task_count > 0) {
-        errno = EBUSY; // resource busy
-        return 1;
+    node->fn = fn;
+    node->next = NULL;
+    node->epoch = __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST);
+    if (scheduler->retired_tail) {
+        scheduler->retired_tail->next = node;
+    } else {
+        scheduler->retired = node;
     }
+    scheduler->retired_tail = node;
+    return 0;
+}
 
-    free(*scheduler);
+uint64_t mj_epoch_token(void) {
+    return __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST);
+}
 
-    // Clear caller's pointer to avoid dangling references, this is why we use double pointers
-    *scheduler = NULL;
+bool mj_epoch_safe(uint64_t token) {
+    if (__atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST) < token + 2) {
+        mj_epoch_try_advance();
+    }
+    return __atomic_load_n(&mj_epoch_global, __ATOMIC_SEQ_CST) >= token + 2;
+}
+
+int mj_task_post_wake(mj_task* task) {
+    if (task == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (__atomic_exchange_n(&task->wake_posted, 1, __ATOMIC_SEQ_CST) == 1) {
+        return 0; // already queued, one wake is as good as two
+    }
+
+    mj_scheduler* owner = __atomic_load_n(&task->scheduler, __ATOMIC_ACQUIRE);
+    if (owner == NULL) {
+        owner = __atomic_load_n(&task->migrate_target, __ATOMIC_ACQUIRE);
+    }
+    if (owner == NULL) {
+        __atomic_store_n(&task->wake_posted, 0, __ATOMIC_SEQ_CST);
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_wake_push(owner, task);
+    return 0;
+}
+
+bool mj_timer_armed(const mj_timer* timer) {
+    return timer && timer->deadline_ns != 0;
+}
+
+void mj_microtask_init(mj_microtask* microtask, mj_microtask_fn fn, void* arg) {
+    if (microtask == NULL) {
+        return;
+    }
+
+    microtask->fn = fn;
+    microtask->arg = arg;
+    microtask->queued = false;
+    microtask->next = NULL;
+}
+
+int mj_scheduler_microtask(mj_scheduler* scheduler, mj_microtask* microtask) {
+    if (scheduler == NULL || microtask == NULL || microtask->fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (microtask->queued) {
+        return 0;
+    }
+
+    microtask->queued = true;
+    microtask->next = NULL;
+    if (scheduler->microtask_tail) {
+        scheduler->microtask_tail->next = microtask;
+    } else {
+        scheduler->microtask_head = microtask;
+    }
+    scheduler->microtask_tail = microtask;
+    return 0;
+}
+
+bool mj_microtask_queued(const mj_microtask* microtask) {
+    return microtask && microtask->queued;
+}
+
+const mj_allocator* mj_scheduler_get_allocator(const mj_scheduler* scheduler) {
+    return scheduler ? &scheduler->allocator : NULL;
+}
+
+int mj_scheduler_task_wait_result(const mj_scheduler* scheduler) {
+    mj_task* task = scheduler ? mj_current(scheduler) : NULL;
+    return task ? task->wait_result : EINVAL;
+}
+
+size_t mj_wait_queue_wake_one(mj_wait_queue* queue) {
+    if (queue == NULL || queue->head == NULL) {
+        return 0;
+    }
+
+    mj_waiter_wake(queue->head, 0);
+    return 1;
+}
+
+size_t mj_wait_queue_wake_all(mj_wait_queue* queue) {
+    size_t woken = 0;
+    while (mj_wait_queue_wake_one(queue)) {
+        woken++;
+    }
+    return woken;
+}
+
+bool mj_wait_queue_empty(const mj_wait_queue* queue) {
+    return queue == NULL || queue->head == NULL;
+}
+
+void mj_cancel_token_init(mj_cancel_token* token) {
+    if (token == NULL) {
+        return;
+    }
+
+    token->cancelled = false;
+    token->waiters.head = NULL;
+    token->waiters.tail = NULL;
+    token->waiters.count = 0;
+}
+
+void mj_cancel_token_cancel(mj_cancel_token* token) {
+    if (token == NULL) {
+        return;
+    }
+
+    token->cancelled = true;
+    while (token->waiters.head) {
+        mj_task_wake(token->waiters.head->task, ECANCELED);
+    }
+}
+
+bool mj_cancel_token_is_cancelled(const mj_cancel_token* token) {
+    return token && token->cancelled;
+}
+
+int mj_scheduler_set_batch_run(mj_scheduler* scheduler, mj_task_fn run, mj_task_batch_fn run_batch) {
+    if (scheduler == NULL || run == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < scheduler->batch_type_count; i++) {
+        if (scheduler->batch_run[i] != run) {
+            continue;
+        }
+        if (run_batch) {
+            scheduler->batch_fn[i] = run_batch;
+        } else {
+            size_t last = --scheduler->batch_type_count;
+            scheduler->batch_run[i] = scheduler->batch_run[last];
+            scheduler->batch_fn[i] = scheduler->batch_fn[last];
+        }
+        return 0;
+    }
+
+    if (run_batch == NULL) {
+        return 0;
+    }
+    if (scheduler->batch_type_count == MJ_BATCH_TYPES) {
+        errno = ENOSPC;
+        return -1;
+    }
+    scheduler->batch_run[scheduler->batch_type_count] = run;
+    scheduler->batch_fn[scheduler->batch_type_count] = run_batch;
+    scheduler->batch_type_count++;
+    return 0;
+}
+
+int mj_scheduler_batch_focus(mj_scheduler* scheduler, size_t index) {
+    if (scheduler == NULL || index >= scheduler->batch_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    // The slot may be empty or hold a task added during the batch
+    mj_task* task = scheduler->batch_tasks[index];
+    if (*scheduler->batch_slots[index] != task) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    scheduler->current_task = scheduler->batch_slots[index];
+    mj_thread_task_id = task->id;
+    mj_thread_task_name = task->name;
+    return 0;
+}
+
+mj_task* mj_scheduler_task_current(const mj_scheduler* scheduler) {
+    if (scheduler == NULL) {
+        return NULL;
+    }
+
+    return mj_current(scheduler);
+}
+
+uint64_t mj_task_id(const mj_task* task) {
+    return task ? task->id : 0;
+}
+
+uint64_t mj_thread_run_count(void) {
+    return mj_thread_runs;
+}
+
+bool mj_thread_running_task(uint64_t* id, const char** name) {
+    uint64_t task_id = mj_thread_task_id;
+    if (id) {
+        *id = task_id;
+    }
+    if (name) {
+        *name = task_id ? mj_thread_task_name : NULL;
+    }
+    return task_id != 0;
+}
+
+int mj_tls_key_create(mj_tls_key* key, mj_tls_destructor destructor) {
+    if (key == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tls_key_count >= MJ_TLS_SLOTS) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    tls_destructors[tls_key_count] = destructor;
+    *key = tls_key_count++;
+
+    return 0;
+}
+
+int mj_scheduler_tls_set(mj_scheduler* scheduler, mj_tls_key key, void* value) {
+    if (scheduler == NULL || scheduler->current_task == NULL || *scheduler->current_task == NULL || key >= tls_key_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    (*scheduler->current_task)->tls[key] = value;
 
     return 0;
 }
+
+// Returns NULL if the value was never set, or if called outside a task callback
+void* mj_scheduler_tls_get(const mj_scheduler* scheduler, mj_tls_key key) {
+    if (scheduler == NULL || scheduler->current_task == NULL || *scheduler->current_task == NULL || key >= MJ_TLS_SLOTS) {
+        return NULL;
+    }
+
+    return (*scheduler->current_task)->tls[key];
+}
@@ -5,30 +5,372 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// Task slots per scheduler. Override for the whole build (e.g. -DMAX_TASKS=1048576), the run loop finds
+// runnable slots through a bitmap so large tables only cost what is runnable.
+#ifndef MAX_TASKS
 #define MAX_TASKS 5
+#endif
+
+// Number of task-local storage slots every task carries
+#define MJ_TLS_SLOTS 8
+
+// Payload bytes of one task arena chunk, larger requests get a dedicated allocation
+#ifndef MJ_ARENA_CHUNK_SIZE
+#define MJ_ARENA_CHUNK_SIZE 4096
+#endif
+
+// Threads that can take part in epoch reclamation at once, every running scheduler takes one
+#ifndef MJ_EPOCH_MAX_THREADS
+#define MJ_EPOCH_MAX_THREADS 64
+#endif
+
+// Task types (run functions) per scheduler that can have a batch callback
+#ifndef MJ_BATCH_TYPES
+#define MJ_BATCH_TYPES 8
+#endif
+
+// Tasks run in a row from the wake slot before the run loop moves on to the next slot
+#ifndef MJ_LIFO_BUDGET
+#define MJ_LIFO_BUDGET 3
+#endif
 
 typedef struct mj_scheduler mj_scheduler;
 
 // Task function prototype
 typedef void (*mj_task_fn)(mj_scheduler* scheduler, void* ctx);
+// Runs count tasks of one type at once, contexts in task list order
+typedef void (*mj_task_batch_fn)(mj_scheduler* scheduler, void** contexts, size_t count);
+
+// Allocator vtable used for every allocation the scheduler makes or frees.
+// size on free / old_size on realloc is a hint, 0 when the size is unknown.
+typedef struct mj_allocator {
+    void* (*alloc)(void* user, size_t size);
+    void (*free)(void* user, void* ptr, size_t size);
+    void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size);
+    void* user; // passed as first argument to all of the above
+} mj_allocator;
+
+// Memory accounting group shared by a family of tasks. Owned by the caller and must outlive its tasks.
+typedef struct mj_mem_group {
+    const char* name;
+    size_t bytes;  // bytes currently charged to tasks in the group
+    size_t budget; // soft limit, 0 means unlimited
+} mj_mem_group;
+
+typedef struct mj_task mj_task;
+typedef struct mj_arena_chunk mj_arena_chunk;
+typedef struct mj_wait_queue mj_wait_queue;
+
+// Wait registration, links a parked task into one wait queue. Unlinking is O(1).
+typedef struct mj_waiter {
+    struct mj_waiter* prev;
+    struct mj_waiter* next;
+    mj_wait_queue* queue; // queue currently holding the waiter, NULL when unlinked
+    mj_task* task;
+} mj_waiter;
+
+// FIFO of parked tasks, embed one in any primitive tasks can block on. Zero initialise (MJ_WAIT_QUEUE_INIT).
+struct mj_wait_queue {
+    mj_waiter* head;
+    mj_waiter* tail;
+    size_t count;
+};
+#define MJ_WAIT_QUEUE_INIT {NULL, NULL, 0}
+
+// One source of a select, owned by the caller (e.g. an array in ctx) and kept valid while the task is parked
+typedef struct mj_select_case {
+    mj_wait_queue* queue; // e.g. a channel's receive queue or a future's waiters
+    mj_waiter node;       // internal
+} mj_select_case;
+
+// mj_scheduler_task_select_fired result when the fd became ready
+#define MJ_SELECT_FD (-2)
+
+// Cancellation token, attach it to any number of waits. Cancelling wakes all of them with ECANCELED.
+// Owned by the caller and must outlive the waits it is attached to.
+typedef struct mj_cancel_token {
+    bool cancelled;
+    mj_wait_queue waiters;
+} mj_cancel_token;
+#define MJ_CANCEL_TOKEN_INIT {false, MJ_WAIT_QUEUE_INIT}
 
-typedef struct mj_task {
+// Memory retired with mj_scheduler_retire, fn frees it once no thread can still be reading it.
+// Embed in the retired object.
+typedef struct mj_retired mj_retired;
+typedef void (*mj_retire_fn)(mj_scheduler* scheduler, mj_retired* node);
+struct mj_retired {
+    mj_retired* next;
+    uint64_t epoch;
+    mj_retire_fn fn;
+};
+
+// Timer callbacks run from mj_scheduler_run outside any task callback
+typedef void (*mj_timer_fn)(mj_scheduler* scheduler, void* arg);
+
+// One-shot timer in the scheduler's timer heap. Owned by the caller, initialise with mj_timer_init.
+// Armed timers do not keep mj_scheduler_run alive, only tasks do. A timer belongs to the scheduler it
+// is armed on, other threads change it only through mj_scheduler_timer_post_arm / _post_cancel.
+typedef struct mj_timer {
+    uint64_t deadline_ns; // absolute monotonic, 0 when not armed
+    size_t heap_index;
+    mj_timer_fn fn;
+    void* arg;
+    uint64_t posted_deadline_ns; // atomic, latest deadline posted from another thread, 0 cancels
+    int posted;                  // atomic, 1 while queued on the owner's timer inbox
+    struct mj_timer* posted_next;
+} mj_timer;
+
+// Microtask callbacks run from mj_scheduler_run outside any task callback
+typedef void (*mj_microtask_fn)(mj_scheduler* scheduler, void* arg);
+
+// Small callback run as soon as the task (or timer) that queued it returns. Owned by the caller,
+// initialise with mj_microtask_init. It may be queued again once its callback has started.
+typedef struct mj_microtask {
+    mj_microtask_fn fn;
+    void* arg;
+    bool queued;
+    struct mj_microtask* next;
+} mj_microtask;
+
+// Fired once each time a task (group == NULL) or a group crosses its budget. It is only a soft limit,
+// the allocation has already succeeded. Throttle or shed from here, e.g. flag the task so it removes itself.
+typedef void (*mj_mem_limit_fn)(mj_scheduler* scheduler, mj_task* task, mj_mem_group* group);
+
+// Task-local storage key, a plain index into mj_task.tls[]
+typedef size_t mj_tls_key;
+
+// Called with the slot value when a task holding a non-NULL value is removed
+typedef void (*mj_tls_destructor)(void* value);
+
+struct mj_task {
     // NOTE mj_task_fn is a pointer, look at above declaration
     mj_task_fn create; // optional factory for any internally allocated data
     mj_task_fn run;
     mj_task_fn cleanup; // optional cleanup for any internally allocated data
     void* ctx;
-} mj_task;
+    size_t ctx_size; // optional, size hint handed to the allocator when ctx is freed
+    const char* name; // optional task type, e.g. "http_conn", profiles are grouped by it. Must outlive the task.
+
+    // Internal scheduler fields below, allocate tasks zeroed (calloc) and leave them alone
+    uint64_t id;             // process-wide, assigned when first added
+    void* tls[MJ_TLS_SLOTS]; // task-local values, indexed by mj_tls_key
+    size_t mem_bytes;        // bytes charged to this task
+    size_t mem_budget;       // soft limit, 0 means unlimited
+    mj_mem_group* mem_group;
+    mj_arena_chunk* arena_head;  // chunk currently bumped into, newest first
+    mj_arena_chunk* arena_tail;  // oldest chunk, lets the whole list be spliced into the pool in O(1)
+    mj_arena_chunk* arena_large; // oversized allocations, freed one by one
+    size_t arena_offset;         // bump offset into arena_head
+    size_t arena_chunks;
+    size_t arena_bytes; // charged to the task, handed back on release
+    mj_scheduler* scheduler; // set when added
+    int state;               // runnable or waiting
+    int wait_result;         // 0, ETIMEDOUT or ECANCELED, why the last wait ended
+    mj_waiter wait_node;     // links the task into the queue it waits on
+    mj_waiter cancel_node;   // links the task into its cancellation token
+    mj_timer deadline;       // wakes the task with ETIMEDOUT
+    int io_fd;               // fd waited on, -1 when not waiting on one
+    short io_events;
+    short io_revents; // poll() revents of the last fd wait
+    uint64_t resume_deadline_ns; // deadline carried across a migration
+    struct mj_task* inbox_next;  // link in a scheduler's inbox
+    mj_scheduler* migrate_target; // where the task is headed, scheduler is NULL while it is in flight
+    int wake_posted;              // atomic, 1 while queued on a scheduler's remote wake inbox
+    struct mj_task* wake_next;
+    mj_retired retired; // the task struct is freed through epoch reclamation
+    mj_select_case* select_cases; // while parked in a select
+    size_t select_count;
+    mj_waiter* woken_by;          // waiter a queue or fd wake came through
+    int select_fired;             // case index, MJ_SELECT_FD or -1
+    uint64_t ran_pass;            // run loop pass the task last ran in, in slot order, in a batch or from the wake slot
+    size_t slot;                  // index in the scheduler's task list while attached
+};
 
+// Uses the libc allocator (malloc / free / realloc)
 mj_scheduler* mj_scheduler_create();
+// The allocator is copied, NULL selects the libc allocator
+mj_scheduler* mj_scheduler_create_with_allocator(const mj_allocator* allocator);
 int mj_scheduler_destroy(mj_scheduler** scheduler);
 
+// Blocks until all tasks are removed. Sleeps in poll() until the next timer or fd event when every task is parked.
+// A task woken while another one runs goes into the wake slot and runs right after it, so request / response
+// chains do not wait a whole pass per hop. At most MJ_LIFO_BUDGET in a row, then the pass carries on.
+// return -1 with EDEADLK if all tasks are parked and nothing can ever wake them
 int mj_scheduler_run(mj_scheduler* scheduler);
 
-// return -1 if task_list[] is full
+// return -1 if task_list[] is full. Tasks added while the run loop sweeps the list (from a task, a batch, or a
+// microtask or wake slot run between them) are staged and attached in order once the sweep ends, they first
+// run in the next pass. Timer callbacks and the microtasks drained around them run between sweeps, tasks they
+// add go straight into a slot and also first run in the next sweep. A staged task has no scheduler yet:
+// mj_task_post_wake on it fails with EINVAL, which loses nothing as it is runnable already.
 int mj_scheduler_task_add(mj_scheduler* scheduler, mj_task* task);
 
+// Thread-per-core use. Every scheduler is run by one thread, these are the only calls that may be made
+// on a scheduler from another thread. Schedulers exchanging tasks must share an allocator that allows
+// freeing on another thread, and mj_mem_groups must not be shared between them.
+
+// Safe from any thread. Hands a new task to target, it is added at the start of the target's next pass.
+int mj_scheduler_task_post(mj_scheduler* target, mj_task* task);
+
+// Only usable from within a task callback. Moves the current task, with its handle (the mj_task pointer),
+// deadline and fd wait, to target. The task leaves once this run returns and never runs on both schedulers.
+// Finish the current run right after calling this, the task is no longer current.
+// User timers stay in this scheduler's heap: while a timer embedded in the task's ctx is armed, migration is
+// refused, cancel it first and arm it again on the target. Timers kept elsewhere are not checked.
+// return -1 with EBUSY if the task is parked on a wait queue or cancellation token, or has a ctx timer armed
+int mj_scheduler_task_migrate_current(mj_scheduler* scheduler, mj_scheduler* target);
+
+// Safe from any thread. While held, mj_scheduler_run keeps waiting for posted or migrated tasks instead of
+// returning when it runs out of tasks. Release wakes the loop so it can exit.
+void mj_scheduler_hold(mj_scheduler* scheduler);
+void mj_scheduler_release(mj_scheduler* scheduler);
+
+// Task handles (mj_task pointers) stay valid for other threads while they are inside an epoch: any task
+// callback on a running scheduler, or between mj_epoch_enter and mj_epoch_exit on other threads. Removed
+// tasks are retired and only freed once every thread has left the epoch it could have seen them in.
+// Readers pay nothing per access, running schedulers report a quiescent point once per loop iteration.
+// return -1 with EAGAIN if all MJ_EPOCH_MAX_THREADS slots are taken
+int mj_epoch_enter(void);
+void mj_epoch_exit(void);
+
+// Only usable from within a task callback. fn(scheduler, node) is called on this scheduler's thread once
+// no thread can still hold a pointer read before the call, use it for objects shared across threads.
+int mj_scheduler_retire(mj_scheduler* scheduler, mj_retired* node, mj_retire_fn fn);
+
+// Safe from any thread, for deferred frees outside of a scheduler. Take a token after unlinking an object,
+// it may be freed once mj_epoch_safe(token) returns true. mj_epoch_safe also moves the global epoch along
+// when every thread has caught up, so polling it is enough to make progress.
+uint64_t mj_epoch_token(void);
+bool mj_epoch_safe(uint64_t token);
+
+// Safe from any thread inside an epoch. Wakes task if it is parked, like a wait queue wake (wait result 0),
+// through its scheduler's remote wake inbox. Follows migrated tasks, wakes of removed tasks are dropped.
+// return -1 with EINVAL if the task was never added to a scheduler
+int mj_task_post_wake(mj_task* task);
+
 // Only usable from within a task callback, removes the current task.
 int mj_scheduler_task_remove_current(mj_scheduler* scheduler);
 
+// Allocate / free through the scheduler's allocator. Tasks and contexts handed to mj_scheduler_task_add
+// must come from here, since mj_scheduler_task_remove_current frees them with mj_scheduler_free.
+void* mj_scheduler_alloc(mj_scheduler* scheduler, size_t size);
+void* mj_scheduler_calloc(mj_scheduler* scheduler, size_t count, size_t size); // zeroed
+void* mj_scheduler_realloc(mj_scheduler* scheduler, void* ptr, size_t old_size, size_t new_size);
+void mj_scheduler_free(mj_scheduler* scheduler, void* ptr, size_t size);
+
+// The scheduler's allocator, for long-lived structures that must not be charged to whichever task is running
+const mj_allocator* mj_scheduler_get_allocator(const mj_scheduler* scheduler);
+
+// Memory accounting. Allocations made while a task callback runs are charged to that task and its group,
+// the task struct and ctx_size are charged when the task is added (and handed over from the spawning task
+// when added or posted from inside a callback). Frees uncharge the size hint, so pass sizes to keep counts exact.
+int mj_task_set_mem_group(mj_task* task, mj_mem_group* group); // only before the task is added
+int mj_task_set_mem_budget(mj_task* task, size_t budget);
+size_t mj_task_mem_bytes(const mj_task* task);
+void mj_scheduler_set_mem_limit_callback(mj_scheduler* scheduler, mj_mem_limit_fn callback);
+
+// Only usable from within a task callback. Bump-allocates from the current task's arena, which is created
+// on first use and grows in MJ_ARENA_CHUNK_SIZE chunks taken from the scheduler's chunk pool.
+// There is no free, the whole arena goes back to the pool in O(1) when the task is removed.
+// Memory is 16 byte aligned and not zeroed.
+void* mj_scheduler_arena_alloc(mj_scheduler* scheduler, size_t size);
+
+// Returns the pooled arena chunks to the allocator, also done by mj_scheduler_destroy
+void mj_scheduler_arena_trim(mj_scheduler* scheduler);
+
+// Monotonic clock used for all deadlines
+uint64_t mj_time_now_ns(void);
+// Absolute deadline ms milliseconds from now, for the deadline_ns arguments below
+uint64_t mj_deadline_in_ms(uint64_t ms);
+
+// Only usable from within a task callback. Parks the current task on queue (NULL for a plain sleep) until it
+// is woken, deadline_ns passes (0 means no deadline) or token is cancelled (token may be NULL).
+// The task's run is not called while it is parked, finish the current run and return after calling this.
+// On the next run mj_scheduler_task_wait_result says why the wait ended.
+// return -1 with ECANCELED without parking if token is already cancelled
+int mj_scheduler_task_wait(mj_scheduler* scheduler, mj_wait_queue* queue, uint64_t deadline_ns, mj_cancel_token* token);
+int mj_scheduler_task_sleep_ms(mj_scheduler* scheduler, uint64_t ms);
+
+// Only usable from within a task callback. Parks the current task until fd is ready for events (POLLIN, POLLOUT),
+// the deadline passes or token is cancelled. mj_scheduler_task_io_revents returns the poll() revents afterwards.
+int mj_scheduler_task_wait_fd(mj_scheduler* scheduler, int fd, short events, uint64_t deadline_ns, mj_cancel_token* token);
+short mj_scheduler_task_io_revents(const mj_scheduler* scheduler);
+
+// Only usable from within a task callback. Parks the current task on every case's queue at once, and on fd
+// (-1 for none) for events, until the first of them fires, the deadline passes or token is cancelled. The task
+// is woken once and taken off all the other sources. Queues carry no state, so check every source (try_recv,
+// mj_future_ready, ...) before selecting. cases must stay valid until the task runs again.
+int mj_scheduler_task_select(mj_scheduler* scheduler, mj_select_case* cases, size_t count, int fd, short events, uint64_t deadline_ns,
+                             mj_cancel_token* token);
+// Only usable from within a task callback. Index of the case that ended the last select, MJ_SELECT_FD for the
+// fd, or -1 when it ended otherwise (see mj_scheduler_task_wait_result)
+int mj_scheduler_task_select_fired(const mj_scheduler* scheduler);
+
+// Only usable from within a task callback. 0 if the last wait was woken normally, ETIMEDOUT or ECANCELED otherwise.
+// A plain sleep always ends with ETIMEDOUT.
+int mj_scheduler_task_wait_result(const mj_scheduler* scheduler);
+
+// Wake parked tasks in FIFO order, returns the number of tasks woken
+size_t mj_wait_queue_wake_one(mj_wait_queue* queue);
+size_t mj_wait_queue_wake_all(mj_wait_queue* queue);
+bool mj_wait_queue_empty(const mj_wait_queue* queue);
+
+// Timers, fn is called from the run loop once deadline_ns has passed. Arming an armed timer moves it.
+void mj_timer_init(mj_timer* timer, mj_timer_fn fn, void* arg);
+int mj_scheduler_timer_arm(mj_scheduler* scheduler, mj_timer* timer, uint64_t deadline_ns);
+void mj_scheduler_timer_cancel(mj_scheduler* scheduler, mj_timer* timer);
+bool mj_timer_armed(const mj_timer* timer);
+// Safe from any thread. Arms, moves or cancels a timer owned by another scheduler: the request is queued
+// on the owner's lock-free timer inbox and applied by its run loop, so the heap is only ever touched by
+// its own thread. Requests posted before the owner gets to them collapse into the latest one. The timer
+// must stay valid until the owner has applied the request.
+int mj_scheduler_timer_post_arm(mj_scheduler* owner, mj_timer* timer, uint64_t deadline_ns);
+int mj_scheduler_timer_post_cancel(mj_scheduler* owner, mj_timer* timer);
+
+// Microtasks, run in queue order once the current task's run returns, before the run loop moves on.
+// Microtasks queued by a microtask run in the same drain, so a chain of them must end. Queueing a queued
+// microtask does nothing. Only from the scheduler's own thread.
+void mj_microtask_init(mj_microtask* microtask, mj_microtask_fn fn, void* arg);
+int mj_scheduler_microtask(mj_scheduler* scheduler, mj_microtask* microtask);
+bool mj_microtask_queued(const mj_microtask* microtask);
+
+void mj_cancel_token_init(mj_cancel_token* token);
+// Wakes every wait the token is attached to with ECANCELED, later waits fail immediately
+void mj_cancel_token_cancel(mj_cancel_token* token);
+bool mj_cancel_token_is_cancelled(const mj_cancel_token* token);
+
+// Batch callbacks. When at least two runnable tasks whose run is run are found in a pass, the scheduler
+// calls run_batch once with all their contexts instead of run on each, so the type can process their
+// states together (e.g. gather them into SoA lanes for SIMD). Every task in the batch counts as having run
+// once. A single runnable task of the type still goes through run. run_batch NULL unregisters the type.
+// return -1 with ENOSPC when MJ_BATCH_TYPES types are registered
+int mj_scheduler_set_batch_run(mj_scheduler* scheduler, mj_task_fn run, mj_task_batch_fn run_batch);
+
+// Only usable from within a run_batch callback. Makes the task of contexts[index] the current task, so
+// calls like mj_scheduler_task_wait or mj_scheduler_task_remove_current apply to it. Do not touch a
+// context after removing its task. Migrating is not possible from a batch.
+// return -1 with ENOENT if that task was removed earlier in the batch
+int mj_scheduler_batch_focus(mj_scheduler* scheduler, size_t index);
+
+// Only usable from within a task callback, returns the running task or NULL
+mj_task* mj_scheduler_task_current(const mj_scheduler* scheduler);
+
+// Unique for the life of the process, 0 until the task has been added to a scheduler
+uint64_t mj_task_id(const mj_task* task);
+// Id and name of the task whose callback the calling thread is in, false outside of task callbacks.
+// Async-signal-safe, meant for profilers and other signal handlers.
+bool mj_thread_running_task(uint64_t* id, const char** name);
+// Task runs and batches started on the calling thread so far. Async-signal-safe, a handler that sees the
+// same count twice while a task is running knows a single run spans both.
+uint64_t mj_thread_run_count(void);
+
+// Allocates a process-wide task-local storage key. Create keys once at startup, before any scheduler runs.
+// The destructor (may be NULL) runs for every non-NULL value when its task is removed.
+// return -1 with ENOMEM when all MJ_TLS_SLOTS keys are taken
+int mj_tls_key_create(mj_tls_key* key, mj_tls_destructor destructor);
+
+// Only usable from within a task callback, sets / gets the current task's value for key.
+int mj_scheduler_tls_set(mj_scheduler* scheduler, mj_tls_key key, void* value);
+void* mj_scheduler_tls_get(const mj_scheduler* scheduler, mj_tls_key key);
+
 size_t mj_scheduler_update_highest_fd(mj_scheduler* scheduler, int fd);
\ No newline at end of file
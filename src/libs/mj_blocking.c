@@ -0,0 +1,343 @@
+#include "mj_blocking.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+struct mj_blocking_job {
+    mj_blocking_fn fn;
+    void* arg;
+    void* result;
+    const mj_allocator* allocator;
+    mj_blocking_job* next;
+
+    mj_task* waiter;            // atomic, the caller until the pool thread wakes it
+    mj_scheduler* waiter_scheduler;
+    mj_wait_queue waiter_queue; // only touched by the caller's thread
+};
+
+struct mj_blocking_pool {
+    const mj_allocator* allocator;
+    pthread_mutex_t lock; // over everything below
+    pthread_cond_t work;  // a job was queued or the pool stops
+    pthread_cond_t exit;  // a thread exited
+    mj_blocking_job* head;
+    mj_blocking_job* tail;
+    size_t queued;        // linked jobs plus the ones reserved by callers that are parking
+    size_t queue_capacity;
+    size_t min_threads;
+    size_t max_threads;
+    size_t threads;
+    size_t idle;
+    size_t running;
+    bool stopping;
+    size_t peak_queued;
+    uint64_t completed;
+    uint64_t rejected;
+};
+
+// Hands the result back, the caller frees the job once woken so take everything needed first
+static void mj_blocking_complete(mj_blocking_job* job) {
+    mj_scheduler* held = job->waiter_scheduler;
+
+    // The waiter handle is only safe to use inside an epoch, wait for a free slot rather than drop the wake
+    while (mj_epoch_enter() != 0) {
+        sched_yield();
+    }
+    mj_task* waiter = __atomic_exchange_n(&job->waiter, NULL, __ATOMIC_ACQ_REL);
+    mj_task_post_wake(waiter);
+    mj_epoch_exit();
+    mj_scheduler_release(held);
+}
+
+// Waits for a job, false once the thread should exit: the pool stops, or it idled out above min_threads
+static bool mj_blocking_wait_job(mj_blocking_pool* pool) {
+    while (pool->head == NULL && !pool->stopping) {
+        pool->idle++;
+        if (pool->threads > pool->min_threads) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += MJ_BLOCKING_KEEPALIVE_MS / 1000;
+            deadline.tv_nsec += (long)(MJ_BLOCKING_KEEPALIVE_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            int error = pthread_cond_timedwait(&pool->work, &pool->lock, &deadline);
+            pool->idle--;
+            // queued also counts jobs reserved but not linked yet, grow did not start a thread for them
+            if (error == ETIMEDOUT && pool->queued == 0 && pool->threads > pool->min_threads) {
+                return false;
+            }
+        } else {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            pool->idle--;
+        }
+    }
+    return pool->head != NULL;
+}
+
+static void* mj_blocking_thread(void* arg) {
+    mj_blocking_pool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (mj_blocking_wait_job(pool)) {
+        mj_blocking_job* job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pool->queued--;
+        pool->running++;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->result = job->fn(job->arg);
+
+        // Counted before the wake, a caller that has its result finds the pool idle and can destroy it
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        pool->completed++;
+        pthread_mutex_unlock(&pool->lock);
+        mj_blocking_complete(job);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pool->threads--;
+    pthread_cond_broadcast(&pool->exit);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Called with the lock held
+static int mj_blocking_start_thread(mj_blocking_pool* pool) {
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, mj_blocking_thread, pool);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    pool->threads++;
+    return 0;
+}
+
+// Called with the lock held, starts a thread when the queued jobs outnumber the idle threads
+static void mj_blocking_grow(mj_blocking_pool* pool) {
+    if (pool->idle >= pool->queued || pool->threads >= pool->max_threads) {
+        return;
+    }
+    mj_blocking_start_thread(pool);
+}
+
+mj_blocking_pool* mj_blocking_pool_create(mj_scheduler* scheduler, size_t min_threads, size_t max_threads, size_t queue_capacity) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL || queue_capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (max_threads == 0) {
+        max_threads = 1;
+    }
+    if (min_threads > max_threads) {
+        min_threads = max_threads;
+    }
+
+    mj_blocking_pool* pool = allocator->alloc(allocator->user, sizeof(*pool));
+    if (pool == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->allocator = allocator;
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
+    pool->queue_capacity = queue_capacity;
+
+    // Keepalive deadlines are monotonic, wall clock steps must not retire or pin threads
+    pthread_condattr_t attr;
+    bool ok = pthread_condattr_init(&attr) == 0;
+    if (ok) {
+        ok = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 && pthread_cond_init(&pool->work, &attr) == 0;
+        pthread_condattr_destroy(&attr);
+    }
+    if (!ok) {
+        allocator->free(allocator->user, pool, sizeof(*pool));
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->exit, NULL) != 0) {
+        pthread_cond_destroy(&pool->work);
+        allocator->free(allocator->user, pool, sizeof(*pool));
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        pthread_cond_destroy(&pool->exit);
+        pthread_cond_destroy(&pool->work);
+        allocator->free(allocator->user, pool, sizeof(*pool));
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // The kept threads are there from the start, the first jobs do not wait for thread creation
+    pthread_mutex_lock(&pool->lock);
+    int error = 0;
+    while (pool->threads < min_threads && error == 0) {
+        error = mj_blocking_start_thread(pool) == 0 ? 0 : errno;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (error != 0) {
+        mj_blocking_pool_destroy(&pool);
+        errno = error;
+        return NULL;
+    }
+    return pool;
+}
+
+int mj_blocking_pool_destroy(mj_blocking_pool** pool) {
+    if (pool == NULL || *pool == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_blocking_pool* p = *pool;
+    pthread_mutex_lock(&p->lock);
+    if (p->queued > 0 || p->running > 0) {
+        pthread_mutex_unlock(&p->lock);
+        errno = EBUSY;
+        return 1;
+    }
+    p->stopping = true;
+    pthread_cond_broadcast(&p->work);
+    while (p->threads > 0) {
+        pthread_cond_wait(&p->exit, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->exit);
+    pthread_cond_destroy(&p->work);
+    p->allocator->free(p->allocator->user, p, sizeof(*p));
+    *pool = NULL;
+    return 0;
+}
+
+// Reserves a place in the queue and makes sure a thread will pick it up
+static int mj_blocking_reserve(mj_blocking_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queued >= pool->queue_capacity) {
+        pool->rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    pool->queued++;
+    mj_blocking_grow(pool);
+    if (pool->threads == 0) {
+        pool->queued--;
+        pool->rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (pool->queued > pool->peak_queued) {
+        pool->peak_queued = pool->queued;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int mj_spawn_blocking(mj_scheduler* scheduler, mj_blocking_pool* pool, mj_blocking_job** job, mj_blocking_fn fn, void* arg, void** result) {
+    if (job == NULL || result == NULL || mj_scheduler_task_current(scheduler) == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (*job) {
+        mj_blocking_job* j = *job;
+        if (__atomic_load_n(&j->waiter, __ATOMIC_ACQUIRE) != NULL) {
+            // Woken by something else, fn is still running or queued
+            if (mj_scheduler_task_wait(scheduler, &j->waiter_queue, 0, NULL) != 0) {
+                return -1;
+            }
+            errno = EINPROGRESS;
+            return -1;
+        }
+        *result = j->result;
+        j->allocator->free(j->allocator->user, j, sizeof(*j));
+        *job = NULL;
+        return 0;
+    }
+
+    if (pool == NULL || fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    mj_blocking_job* j = allocator->alloc(allocator->user, sizeof(*j));
+    if (j == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(j, 0, sizeof(*j));
+    j->allocator = allocator;
+    j->fn = fn;
+    j->arg = arg;
+
+    if (mj_blocking_reserve(pool) != 0) {
+        allocator->free(allocator->user, j, sizeof(*j));
+        return -1;
+    }
+
+    // Park first, the pool thread may finish before this callback returns. Nothing can fail after that.
+    if (mj_scheduler_task_wait(scheduler, &j->waiter_queue, 0, NULL) != 0) {
+        int error = errno;
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+        allocator->free(allocator->user, j, sizeof(*j));
+        errno = error;
+        return -1;
+    }
+    j->waiter = mj_scheduler_task_current(scheduler);
+    j->waiter_scheduler = scheduler;
+    mj_scheduler_hold(scheduler); // the wake comes from a pool thread
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = j;
+    } else {
+        pool->head = j;
+    }
+    pool->tail = j;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    *job = j;
+    errno = EINPROGRESS;
+    return -1;
+}
+
+void mj_blocking_pool_stats(mj_blocking_pool* pool, mj_blocking_stats* stats) {
+    if (pool == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    stats->queued = pool->queued;
+    stats->peak_queued = pool->peak_queued;
+    stats->running = pool->running;
+    stats->threads = pool->threads;
+    stats->idle = pool->idle;
+    stats->completed = pool->completed;
+    stats->rejected = pool->rejected;
+    pthread_mutex_unlock(&pool->lock);
+}
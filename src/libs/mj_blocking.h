@@ -0,0 +1,68 @@
+/* --------------------------------------------------------------------
+ * mj_blocking.h
+ *
+ * Offloading calls that can only block (compression libraries, legacy synchronous clients, ...) to a
+ * worker thread pool, so they never stall mj_scheduler_run.
+ *
+ * Example usage:
+ *   mj_blocking_pool* pool = mj_blocking_pool_create(scheduler, 1, 8, 256);  // 1..8 threads, 256 queued jobs
+ *
+ *   // run callback, ctx->job starts out NULL
+ *   void* compressed;
+ *   if (mj_spawn_blocking(scheduler, pool, &ctx->job, compress, ctx->buffer, &compressed) != 0) {
+ *       if (errno == EINPROGRESS) return;  // parked until a pool thread has run compress
+ *       shed_load();                       // EAGAIN, the queue is full
+ *   }
+ *   use(compressed);
+ *
+ * The first call queues fn(arg) on the pool and parks the task, calling again with the same job once woken
+ * returns what fn returned. The pool thread that ran fn wakes the task through its scheduler's remote wake
+ * inbox, the same completion path every cross-thread wake takes, and the scheduler is held in between so
+ * its run loop keeps waiting for the result.
+ *
+ * The queue is bounded, a full queue fails the call with EAGAIN instead of letting a backlog build up.
+ * min_threads threads are started with the pool and kept. More are started on demand while queued jobs
+ * outnumber idle threads, up to max_threads, and exit after MJ_BLOCKING_KEEPALIVE_MS without work. mj_blocking_pool_stats reports queue
+ * depth and pool size.
+ *
+ * fn runs on a pool thread outside any scheduler: it may block, but must not touch schedulers or tasks.
+ * Do not remove a task while its job is pending.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+#define MJ_BLOCKING_KEEPALIVE_MS 10000 // idle threads above min_threads exit after this long
+
+typedef struct mj_blocking_pool mj_blocking_pool;
+typedef struct mj_blocking_job mj_blocking_job;
+
+// Runs on a pool thread, the return value is handed back to the task
+typedef void* (*mj_blocking_fn)(void* arg);
+
+typedef struct mj_blocking_stats {
+    size_t queued;      // jobs waiting for a thread
+    size_t peak_queued;
+    size_t running;     // jobs a thread is in
+    size_t threads;     // live threads, idle ones included
+    size_t idle;
+    uint64_t completed;
+    uint64_t rejected;  // calls failed with EAGAIN
+} mj_blocking_stats;
+
+// scheduler provides the allocator for the pool and must outlive it. Tasks on any scheduler sharing that
+// allocator can use the pool. max_threads 0 counts as 1. Fails with the pthread_create error (EAGAIN, ...)
+// if the min_threads threads can not all be started.
+mj_blocking_pool* mj_blocking_pool_create(mj_scheduler* scheduler, size_t min_threads, size_t max_threads, size_t queue_capacity);
+// Stops the threads and waits for them to exit. return 1 with EBUSY while jobs are queued or running.
+int mj_blocking_pool_destroy(mj_blocking_pool** pool);
+
+// Only usable from within a task callback. Pass a NULL *job to start, the same job on later calls.
+// return 0 when done, *result holds what fn returned and *job is freed and set to NULL.
+// return -1 with EINPROGRESS while the task is parked on the job, EAGAIN if the queue is full or no
+// thread could be started, other errnos if it could not start.
+int mj_spawn_blocking(mj_scheduler* scheduler, mj_blocking_pool* pool, mj_blocking_job** job, mj_blocking_fn fn, void* arg, void** result);
+
+// Safe from any thread
+void mj_blocking_pool_stats(mj_blocking_pool* pool, mj_blocking_stats* stats);
@@ -0,0 +1,175 @@
+#include "mj_channel.h"
+#include <errno.h>
+#include <string.h>
+
+struct mj_channel {
+    mj_scheduler* scheduler;
+    void** items; // ring
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+    mj_wait_queue receivers;
+    mj_wait_queue senders;
+};
+
+mj_channel* mj_channel_create(mj_scheduler* scheduler, size_t capacity) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL || capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_channel* channel = allocator->alloc(allocator->user, sizeof(*channel));
+    if (channel == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(channel, 0, sizeof(*channel));
+
+    channel->items = allocator->alloc(allocator->user, capacity * sizeof(void*));
+    if (channel->items == NULL) {
+        allocator->free(allocator->user, channel, sizeof(*channel));
+        errno = ENOMEM;
+        return NULL;
+    }
+    channel->scheduler = scheduler;
+    channel->capacity = capacity;
+    return channel;
+}
+
+int mj_channel_destroy(mj_channel** channel) {
+    if (channel == NULL || *channel == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!mj_wait_queue_empty(&(*channel)->receivers) || !mj_wait_queue_empty(&(*channel)->senders)) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator((*channel)->scheduler);
+    allocator->free(allocator->user, (*channel)->items, (*channel)->capacity * sizeof(void*));
+    allocator->free(allocator->user, *channel, sizeof(**channel));
+    *channel = NULL;
+    return 0;
+}
+
+int mj_channel_try_send(mj_channel* channel, void* item) {
+    if (channel == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (channel->closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (channel->count == channel->capacity) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    channel->items[(channel->head + channel->count) % channel->capacity] = item;
+    channel->count++;
+    mj_wait_queue_wake_one(&channel->receivers);
+    return 0;
+}
+
+int mj_channel_try_recv(mj_channel* channel, void** item) {
+    if (channel == NULL || item == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (channel->count == 0) {
+        errno = channel->closed ? EPIPE : EAGAIN;
+        return -1;
+    }
+
+    *item = channel->items[channel->head];
+    channel->head = (channel->head + 1) % channel->capacity;
+    channel->count--;
+    mj_wait_queue_wake_one(&channel->senders);
+    return 0;
+}
+
+size_t mj_channel_send_batch(mj_channel* channel, void* const* items, size_t count) {
+    if (channel == NULL || (items == NULL && count > 0)) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (channel->closed) {
+        errno = EPIPE;
+        return 0;
+    }
+
+    size_t sent = 0;
+    while (sent < count && channel->count < channel->capacity) {
+        channel->items[(channel->head + channel->count) % channel->capacity] = items[sent++];
+        channel->count++;
+    }
+    if (sent == 0) {
+        errno = EAGAIN;
+        return 0;
+    }
+
+    // One wake per item at most, stops once nobody is left parked
+    size_t woken = 0;
+    while (woken < sent && mj_wait_queue_wake_one(&channel->receivers)) {
+        woken++;
+    }
+    return sent;
+}
+
+size_t mj_channel_recv_batch(mj_channel* channel, void** items, size_t max) {
+    if (channel == NULL || items == NULL || max == 0) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (channel->count == 0) {
+        errno = channel->closed ? EPIPE : EAGAIN;
+        return 0;
+    }
+
+    size_t received = 0;
+    while (received < max && channel->count > 0) {
+        items[received++] = channel->items[channel->head];
+        channel->head = (channel->head + 1) % channel->capacity;
+        channel->count--;
+    }
+
+    size_t woken = 0;
+    while (woken < received && mj_wait_queue_wake_one(&channel->senders)) {
+        woken++;
+    }
+    return received;
+}
+
+void mj_channel_close(mj_channel* channel) {
+    if (channel == NULL || channel->closed) {
+        return;
+    }
+
+    channel->closed = true;
+    mj_wait_queue_wake_all(&channel->receivers);
+    mj_wait_queue_wake_all(&channel->senders);
+}
+
+bool mj_channel_closed(const mj_channel* channel) {
+    return channel == NULL || channel->closed;
+}
+
+size_t mj_channel_len(const mj_channel* channel) {
+    return channel ? channel->count : 0;
+}
+
+size_t mj_channel_capacity(const mj_channel* channel) {
+    return channel ? channel->capacity : 0;
+}
+
+mj_wait_queue* mj_channel_recv_queue(mj_channel* channel) {
+    return channel ? &channel->receivers : NULL;
+}
+
+mj_wait_queue* mj_channel_send_queue(mj_channel* channel) {
+    return channel ? &channel->senders : NULL;
+}
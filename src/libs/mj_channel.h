@@ -0,0 +1,48 @@
+/* --------------------------------------------------------------------
+ * mj_channel.h
+ *
+ * Bounded FIFO of pointers between tasks on the same scheduler.
+ *
+ * Example usage, a consumer's run callback:
+ *   void* item;
+ *   if (mj_channel_try_recv(ch, &item) != 0) {
+ *       if (errno == EAGAIN) mj_scheduler_task_wait(scheduler, mj_channel_recv_queue(ch), 0, NULL);
+ *       else mj_scheduler_task_remove_current(scheduler);  // EPIPE: closed and drained
+ *       return;
+ *   }
+ *
+ * Sending wakes one parked receiver, receiving wakes one parked sender. The queues can also be used as
+ * cases of mj_scheduler_task_select to wait on several channels, an fd and a deadline at once. Items are
+ * passed by pointer, the channel never copies or frees them.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+typedef struct mj_channel mj_channel;
+
+mj_channel* mj_channel_create(mj_scheduler* scheduler, size_t capacity);
+// return 1 with EBUSY while tasks are parked on the channel, items still queued are not freed
+int mj_channel_destroy(mj_channel** channel);
+
+// return -1 with EAGAIN when full, EPIPE when closed
+int mj_channel_try_send(mj_channel* channel, void* item);
+// return -1 with EAGAIN when empty, EPIPE when closed and drained
+int mj_channel_try_recv(mj_channel* channel, void** item);
+
+// Move as many of the items as fit / are queued in one call, in order, waking parked tasks once per item.
+// return the number moved, 0 with EAGAIN / EPIPE as above
+size_t mj_channel_send_batch(mj_channel* channel, void* const* items, size_t count);
+size_t mj_channel_recv_batch(mj_channel* channel, void** items, size_t max);
+
+// Senders fail with EPIPE from now on, receivers drain what is left. Wakes every parked task.
+void mj_channel_close(mj_channel* channel);
+bool mj_channel_closed(const mj_channel* channel);
+
+size_t mj_channel_len(const mj_channel* channel);
+size_t mj_channel_capacity(const mj_channel* channel);
+
+// Wait queues to park on: receivers until an item arrives, senders until there is room
+mj_wait_queue* mj_channel_recv_queue(mj_channel* channel);
+mj_wait_queue* mj_channel_send_queue(mj_channel* channel);
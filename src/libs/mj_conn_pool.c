@@ -0,0 +1,275 @@
+#include "mj_conn_pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+struct mj_conn_endpoint {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    mj_conn* idle; // most recently returned first, so expired connections are always a suffix
+    size_t idle_count;
+    struct mj_conn_endpoint* next;
+};
+
+struct mj_conn_pool {
+    mj_scheduler* scheduler;
+    const mj_allocator* allocator;
+    mj_conn_endpoint* endpoints;
+    uint64_t idle_timeout_ns;
+    size_t max_idle;
+    size_t idle_count;
+    mj_timer expiry; // armed while any connection is idle
+};
+
+static void* mj_conn_pool_alloc(mj_conn_pool* pool, size_t size) {
+    void* ptr = pool->allocator->alloc(pool->allocator->user, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+static void mj_conn_close(mj_conn_pool* pool, mj_conn* conn) {
+    close(conn->fd);
+    pool->allocator->free(pool->allocator->user, conn, sizeof(*conn));
+}
+
+static mj_conn_endpoint* mj_conn_endpoint_get(mj_conn_pool* pool, const struct sockaddr* addr, socklen_t addrlen) {
+    for (mj_conn_endpoint* endpoint = pool->endpoints; endpoint; endpoint = endpoint->next) {
+        if (endpoint->addrlen == addrlen && memcmp(&endpoint->addr, addr, addrlen) == 0) {
+            return endpoint;
+        }
+    }
+
+    mj_conn_endpoint* endpoint = mj_conn_pool_alloc(pool, sizeof(*endpoint));
+    if (endpoint == NULL) {
+        return NULL;
+    }
+    memcpy(&endpoint->addr, addr, addrlen);
+    endpoint->addrlen = addrlen;
+    endpoint->next = pool->endpoints;
+    pool->endpoints = endpoint;
+    return endpoint;
+}
+
+// An idle connection should have nothing to read. Readable means the peer closed it, sent a stray
+// response or the socket errored, none of which we want to hand to a new request.
+static bool mj_conn_healthy(const mj_conn* conn) {
+    struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// Timer callback, closes every connection idle for longer than the timeout and re-arms for the next one
+static void mj_conn_pool_expire(mj_scheduler* scheduler, void* arg) {
+    mj_conn_pool* pool = arg;
+    uint64_t now = mj_time_now_ns();
+    uint64_t next_deadline = 0;
+
+    for (mj_conn_endpoint* endpoint = pool->endpoints; endpoint; endpoint = endpoint->next) {
+        mj_conn** link = &endpoint->idle;
+        while (*link && (*link)->idle_deadline_ns > now) {
+            link = &(*link)->next;
+        }
+
+        mj_conn* expired = *link;
+        *link = NULL;
+        while (expired) {
+            mj_conn* next = expired->next;
+            mj_conn_close(pool, expired);
+            endpoint->idle_count--;
+            pool->idle_count--;
+            expired = next;
+        }
+
+        // The oldest survivor expires first
+        for (mj_conn* conn = endpoint->idle; conn; conn = conn->next) {
+            if (conn->next == NULL && (next_deadline == 0 || conn->idle_deadline_ns < next_deadline)) {
+                next_deadline = conn->idle_deadline_ns;
+            }
+        }
+    }
+
+    if (next_deadline) {
+        mj_scheduler_timer_arm(scheduler, &pool->expiry, next_deadline);
+    }
+}
+
+mj_conn_pool* mj_conn_pool_create(mj_scheduler* scheduler, uint64_t idle_timeout_ms, size_t max_idle) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_conn_pool* pool = allocator->alloc(allocator->user, sizeof(*pool));
+    if (pool == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->scheduler = scheduler;
+    pool->allocator = allocator;
+    pool->idle_timeout_ns = idle_timeout_ms * 1000000ULL;
+    pool->max_idle = max_idle;
+    mj_timer_init(&pool->expiry, mj_conn_pool_expire, pool);
+
+    return pool;
+}
+
+int mj_conn_pool_destroy(mj_conn_pool** pool) {
+    if (pool == NULL || *pool == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_conn_pool* p = *pool;
+    mj_scheduler_timer_cancel(p->scheduler, &p->expiry);
+
+    mj_conn_endpoint* endpoint = p->endpoints;
+    while (endpoint) {
+        mj_conn_endpoint* next_endpoint = endpoint->next;
+        mj_conn* conn = endpoint->idle;
+        while (conn) {
+            mj_conn* next = conn->next;
+            mj_conn_close(p, conn);
+            conn = next;
+        }
+        p->allocator->free(p->allocator->user, endpoint, sizeof(*endpoint));
+        endpoint = next_endpoint;
+    }
+
+    p->allocator->free(p->allocator->user, p, sizeof(*p));
+    *pool = NULL;
+    return 0;
+}
+
+// Second half of a checkout, the task was woken after parking on the connecting socket
+static int mj_conn_pool_finish_connect(mj_conn_pool* pool, mj_conn** conn) {
+    int wait_result = mj_scheduler_task_wait_result(pool->scheduler);
+    int error = wait_result;
+    if (error == 0) {
+        socklen_t len = sizeof(error);
+        if (getsockopt((*conn)->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+            error = errno;
+        }
+    }
+
+    if (error) {
+        mj_conn_close(pool, *conn);
+        *conn = NULL;
+        errno = error;
+        return -1;
+    }
+
+    (*conn)->connected = true;
+    return 0;
+}
+
+int mj_conn_pool_checkout(mj_conn_pool* pool, mj_conn** conn, const struct sockaddr* addr, socklen_t addrlen, uint64_t deadline_ns,
+                          mj_cancel_token* token) {
+    if (pool == NULL || conn == NULL || addr == NULL || addrlen == 0 || addrlen > sizeof(struct sockaddr_storage)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (*conn) {
+        return (*conn)->connected ? 0 : mj_conn_pool_finish_connect(pool, conn);
+    }
+
+    mj_conn_endpoint* endpoint = mj_conn_endpoint_get(pool, addr, addrlen);
+    if (endpoint == NULL) {
+        return -1;
+    }
+
+    // Reuse the most recently returned connection that is still healthy
+    while (endpoint->idle) {
+        mj_conn* idle = endpoint->idle;
+        endpoint->idle = idle->next;
+        endpoint->idle_count--;
+        pool->idle_count--;
+        idle->next = NULL;
+
+        if (mj_conn_healthy(idle)) {
+            *conn = idle;
+            return 0;
+        }
+        mj_conn_close(pool, idle);
+    }
+
+    int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    mj_conn* new_conn = mj_conn_pool_alloc(pool, sizeof(*new_conn));
+    if (new_conn == NULL) {
+        close(fd);
+        return -1;
+    }
+    new_conn->fd = fd;
+    new_conn->endpoint = endpoint;
+
+    if (connect(fd, addr, addrlen) == 0) {
+        new_conn->connected = true;
+        *conn = new_conn;
+        return 0;
+    }
+    if (errno != EINPROGRESS) {
+        int error = errno;
+        mj_conn_close(pool, new_conn);
+        errno = error;
+        return -1;
+    }
+
+    // Park until the socket is writable, the connect result is read on the next run
+    if (mj_scheduler_task_wait_fd(pool->scheduler, fd, POLLOUT, deadline_ns, token) != 0) {
+        int error = errno;
+        mj_conn_close(pool, new_conn);
+        errno = error;
+        return -1;
+    }
+
+    *conn = new_conn;
+    errno = EINPROGRESS;
+    return -1;
+}
+
+void mj_conn_pool_return(mj_conn_pool* pool, mj_conn* conn, bool reusable) {
+    if (pool == NULL || conn == NULL) {
+        return;
+    }
+
+    mj_conn_endpoint* endpoint = conn->endpoint;
+    if (!reusable || !conn->connected || endpoint->idle_count >= pool->max_idle) {
+        mj_conn_close(pool, conn);
+        return;
+    }
+
+    conn->idle_deadline_ns = mj_time_now_ns() + pool->idle_timeout_ns;
+    conn->next = endpoint->idle;
+    endpoint->idle = conn;
+    endpoint->idle_count++;
+    pool->idle_count++;
+
+    // Every connection gets the same timeout, an armed timer is always due no later than this one
+    if (!mj_timer_armed(&pool->expiry)) {
+        mj_scheduler_timer_arm(pool->scheduler, &pool->expiry, conn->idle_deadline_ns);
+    }
+}
+
+size_t mj_conn_pool_idle_count(const mj_conn_pool* pool) {
+    return pool ? pool->idle_count : 0;
+}
@@ -0,0 +1,54 @@
+/* --------------------------------------------------------------------
+ * mj_conn_pool.h
+ *
+ * Per-scheduler pool of outbound TCP connections, keyed by endpoint address.
+ *
+ * Example usage, from inside a task's run callback:
+ *   if (mj_conn_pool_checkout(pool, &ctx->conn, addr, addrlen, mj_deadline_in_ms(500), NULL) != 0) {
+ *       if (errno == EINPROGRESS) return;  // parked until the connect completes, run is called again
+ *       ...                                // connect failed, timed out (ETIMEDOUT) or was cancelled
+ *   }
+ *   ... use ctx->conn->fd ...
+ *   mj_conn_pool_return(pool, ctx->conn, true);
+ *   ctx->conn = NULL;
+ *
+ * Checkout hands out an idle connection when one is healthy, otherwise it starts a non-blocking connect and
+ * parks the task on the socket until it is writable. Connections move between tasks by pointer, nothing is
+ * copied. Idle connections are closed by a scheduler timer once they have been idle for idle_timeout_ms.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+#include <sys/socket.h>
+
+typedef struct mj_conn_pool mj_conn_pool;
+typedef struct mj_conn_endpoint mj_conn_endpoint;
+
+typedef struct mj_conn {
+    int fd;
+    // Internal pool fields below
+    bool connected;
+    uint64_t idle_deadline_ns;
+    mj_conn_endpoint* endpoint;
+    struct mj_conn* next; // idle list link
+} mj_conn;
+
+// max_idle caps idle connections kept per endpoint, extra returns are closed
+mj_conn_pool* mj_conn_pool_create(mj_scheduler* scheduler, uint64_t idle_timeout_ms, size_t max_idle);
+// Closes all idle connections, connections still checked out must be returned or closed first
+int mj_conn_pool_destroy(mj_conn_pool** pool);
+
+// Only usable from within a task callback. *conn must be NULL for a fresh checkout, keep it in ctx between runs.
+// return 0 with *conn connected, or -1 with errno:
+//   EINPROGRESS         a connect is in flight and the task is parked, call again with the same *conn on the next run
+//   ETIMEDOUT/ECANCELED the connect did not finish before the deadline / token, *conn is reset to NULL
+//   anything else       socket or connect error, *conn is reset to NULL
+int mj_conn_pool_checkout(mj_conn_pool* pool, mj_conn** conn, const struct sockaddr* addr, socklen_t addrlen, uint64_t deadline_ns,
+                          mj_cancel_token* token);
+
+// Gives a checked out connection back. Pass reusable = false after protocol errors or when the peer may have
+// closed it, the connection is closed instead of kept idle.
+void mj_conn_pool_return(mj_conn_pool* pool, mj_conn* conn, bool reusable);
+
+size_t mj_conn_pool_idle_count(const mj_conn_pool* pool);
@@ -0,0 +1,571 @@
+#include "mj_dag.h"
+#include <errno.h>
+#include <string.h>
+
+#define MJ_DAG_CACHE_LINE 64
+#define MJ_DAG_BURST 32 // jobs per worker run before the other tasks of the scheduler get a turn
+
+// Stored in waiter by the last worker to exit, as its last access to the DAG
+static char mj_dag_finished;
+#define MJ_DAG_FINISHED ((mj_task*)&mj_dag_finished)
+
+typedef struct mj_dag_job {
+    mj_dag_fn fn;
+    void* arg;
+    uint32_t cost;
+    uint64_t rank;      // cost of the longest chain starting here
+    size_t pending;     // atomic, dependencies not completed yet
+    size_t succ_start;  // successors are succ[succ_start .. succ_start + succ_count)
+    size_t succ_count;
+} mj_dag_job;
+
+typedef struct mj_dag_edge {
+    uint32_t from; // dependency
+    uint32_t to;   // job waiting on it
+} mj_dag_edge;
+
+typedef struct mj_dag_worker {
+    mj_task* task;          // handle for remote wakes
+    bool lock;              // spinlock over the heap
+    uint32_t* heap;         // ready jobs, max-heap on rank, job_count long
+    size_t heap_count;      // atomic, written under the lock, peeked without it
+    bool idle;              // atomic, set while parked or about to park
+    mj_wait_queue idle_queue; // only touched by the worker's own thread
+    char pad[MJ_DAG_CACHE_LINE];
+} mj_dag_worker;
+
+typedef struct mj_dag_worker_ctx {
+    mj_dag* dag;
+    size_t index;
+} mj_dag_worker_ctx;
+
+struct mj_dag {
+    mj_scheduler* scheduler; // allocator
+    const mj_allocator* allocator;
+    mj_dag_job* jobs;
+    size_t job_count;
+    size_t job_capacity;
+    mj_dag_edge* edges;
+    size_t edge_count;
+    size_t edge_capacity;
+    uint32_t* succ; // edge targets grouped by dependency, built by run, one spare entry so it is never empty
+
+    bool started;
+    mj_dag_worker* workers;
+    size_t worker_count;
+    size_t remaining; // atomic, jobs not completed
+    size_t active;    // atomic, workers still running
+    uint64_t steals;  // atomic
+
+    mj_task* waiter;  // atomic, task parked in mj_dag_wait, MJ_DAG_FINISHED once the last worker is out
+    mj_wait_queue waiter_queue; // only touched by the waiter's thread
+};
+
+mj_dag* mj_dag_create(mj_scheduler* scheduler) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_dag* dag = allocator->alloc(allocator->user, sizeof(*dag));
+    if (dag == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(dag, 0, sizeof(*dag));
+
+    dag->scheduler = scheduler;
+    dag->allocator = allocator;
+    return dag;
+}
+
+int mj_dag_destroy(mj_dag** dag) {
+    if (dag == NULL || *dag == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((*dag)->started && __atomic_load_n(&(*dag)->waiter, __ATOMIC_ACQUIRE) != MJ_DAG_FINISHED) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    mj_dag* d = *dag;
+    const mj_allocator* allocator = d->allocator;
+    if (d->workers) {
+        for (size_t i = 0; i < d->worker_count; i++) {
+            allocator->free(allocator->user, d->workers[i].heap, d->job_count * sizeof(uint32_t));
+        }
+        allocator->free(allocator->user, d->workers, d->worker_count * sizeof(mj_dag_worker));
+    }
+    if (d->succ) {
+        allocator->free(allocator->user, d->succ, (d->edge_count + 1) * sizeof(uint32_t));
+    }
+    if (d->edges) {
+        allocator->free(allocator->user, d->edges, d->edge_capacity * sizeof(mj_dag_edge));
+    }
+    if (d->jobs) {
+        allocator->free(allocator->user, d->jobs, d->job_capacity * sizeof(mj_dag_job));
+    }
+    allocator->free(allocator->user, d, sizeof(*d));
+    *dag = NULL;
+    return 0;
+}
+
+int mj_dag_add(mj_dag* dag, mj_dag_fn fn, void* arg, uint32_t cost) {
+    if (dag == NULL || fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dag->started) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (dag->job_count >= INT32_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (dag->job_count == dag->job_capacity) {
+        size_t capacity = dag->job_capacity ? dag->job_capacity * 2 : 64;
+        mj_dag_job* jobs = dag->allocator->realloc(dag->allocator->user, dag->jobs, dag->job_capacity * sizeof(mj_dag_job), capacity * sizeof(mj_dag_job));
+        if (jobs == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        dag->jobs = jobs;
+        dag->job_capacity = capacity;
+    }
+
+    mj_dag_job* job = &dag->jobs[dag->job_count];
+    memset(job, 0, sizeof(*job));
+    job->fn = fn;
+    job->arg = arg;
+    job->cost = cost ? cost : 1;
+    return (int)dag->job_count++;
+}
+
+int mj_dag_depend(mj_dag* dag, int job, int dependency) {
+    if (dag == NULL || job < 0 || dependency < 0 || (size_t)job >= dag->job_count || (size_t)dependency >= dag->job_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dag->started) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (job == dependency) {
+        errno = ELOOP;
+        return -1;
+    }
+
+    if (dag->edge_count == dag->edge_capacity) {
+        size_t capacity = dag->edge_capacity ? dag->edge_capacity * 2 : 64;
+        mj_dag_edge* edges =
+            dag->allocator->realloc(dag->allocator->user, dag->edges, dag->edge_capacity * sizeof(mj_dag_edge), capacity * sizeof(mj_dag_edge));
+        if (edges == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        dag->edges = edges;
+        dag->edge_capacity = capacity;
+    }
+
+    dag->edges[dag->edge_count].from = (uint32_t)dependency;
+    dag->edges[dag->edge_count].to = (uint32_t)job;
+    dag->edge_count++;
+    return 0;
+}
+
+// Ready heaps. Each worker pushes and pops its own, other workers only steal the top.
+
+static void mj_dag_lock(mj_dag_worker* worker) {
+    while (__atomic_test_and_set(&worker->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&worker->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void mj_dag_unlock(mj_dag_worker* worker) {
+    __atomic_clear(&worker->lock, __ATOMIC_RELEASE);
+}
+
+static void mj_dag_push(mj_dag* dag, mj_dag_worker* worker, uint32_t job) {
+    mj_dag_lock(worker);
+    size_t i = worker->heap_count;
+    uint64_t rank = dag->jobs[job].rank;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (dag->jobs[worker->heap[parent]].rank >= rank) {
+            break;
+        }
+        worker->heap[i] = worker->heap[parent];
+        i = parent;
+    }
+    worker->heap[i] = job;
+    __atomic_store_n(&worker->heap_count, worker->heap_count + 1, __ATOMIC_RELAXED);
+    mj_dag_unlock(worker);
+}
+
+static bool mj_dag_pop(mj_dag* dag, mj_dag_worker* worker, uint32_t* job) {
+    if (__atomic_load_n(&worker->heap_count, __ATOMIC_RELAXED) == 0) {
+        return false;
+    }
+
+    mj_dag_lock(worker);
+    size_t count = worker->heap_count;
+    if (count == 0) {
+        mj_dag_unlock(worker);
+        return false;
+    }
+
+    *job = worker->heap[0];
+    uint32_t last = worker->heap[--count];
+    uint64_t rank = dag->jobs[last].rank;
+    size_t i = 0;
+    while (2 * i + 1 < count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < count && dag->jobs[worker->heap[child + 1]].rank > dag->jobs[worker->heap[child]].rank) {
+            child++;
+        }
+        if (rank >= dag->jobs[worker->heap[child]].rank) {
+            break;
+        }
+        worker->heap[i] = worker->heap[child];
+        i = child;
+    }
+    worker->heap[i] = last;
+    __atomic_store_n(&worker->heap_count, count, __ATOMIC_RELAXED);
+    mj_dag_unlock(worker);
+    return true;
+}
+
+// Takes the most critical job of the first other worker that has any, starting next to self
+static bool mj_dag_steal(mj_dag* dag, size_t self, uint32_t* job) {
+    for (size_t n = 1; n < dag->worker_count; n++) {
+        size_t victim = (self + n) % dag->worker_count;
+        if (mj_dag_pop(dag, &dag->workers[victim], job)) {
+            __atomic_add_fetch(&dag->steals, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool mj_dag_any_ready(mj_dag* dag) {
+    for (size_t i = 0; i < dag->worker_count; i++) {
+        if (__atomic_load_n(&dag->workers[i].heap_count, __ATOMIC_RELAXED) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wakes up to count idle workers other than self, every one of them when count is SIZE_MAX
+static void mj_dag_wake_idle(mj_dag* dag, size_t self, size_t count) {
+    // Pairs with the fence in the worker between raising its idle flag and its last look at the heaps
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t n = 1; n < dag->worker_count && count > 0; n++) {
+        mj_dag_worker* worker = &dag->workers[(self + n) % dag->worker_count];
+        if (__atomic_load_n(&worker->idle, __ATOMIC_RELAXED) && __atomic_exchange_n(&worker->idle, false, __ATOMIC_ACQ_REL)) {
+            mj_task_post_wake(worker->task);
+            count--;
+        }
+    }
+}
+
+static void mj_dag_complete(mj_scheduler* scheduler, mj_dag* dag, size_t self, uint32_t index) {
+    mj_dag_job* job = &dag->jobs[index];
+    job->fn(scheduler, job->arg);
+
+    size_t released = 0;
+    for (size_t i = 0; i < job->succ_count; i++) {
+        uint32_t next = dag->succ[job->succ_start + i];
+        if (__atomic_sub_fetch(&dag->jobs[next].pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            mj_dag_push(dag, &dag->workers[self], next);
+            released++;
+        }
+    }
+    // This worker takes one of them itself
+    if (released > 1) {
+        mj_dag_wake_idle(dag, self, released - 1);
+    }
+
+    if (__atomic_sub_fetch(&dag->remaining, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    // Last job, idle workers wake up to exit
+    mj_dag_wake_idle(dag, self, SIZE_MAX);
+}
+
+// Called by the last worker to exit, resumes the task waiting in mj_dag_wait
+static void mj_dag_notify_waiter(mj_dag* dag) {
+    // The DAG may be destroyed as soon as this lands, only the waiter is touched after it. It stays parked
+    // on this scheduler-held wait until the wake below, so its scheduler field can be read.
+    mj_task* waiter = __atomic_exchange_n(&dag->waiter, MJ_DAG_FINISHED, __ATOMIC_ACQ_REL);
+    if (waiter) {
+        mj_scheduler* held = __atomic_load_n(&waiter->scheduler, __ATOMIC_ACQUIRE);
+        mj_task_post_wake(waiter);
+        mj_scheduler_release(held);
+    }
+}
+
+static void mj_dag_worker_run(mj_scheduler* scheduler, void* ctx) {
+    mj_dag_worker_ctx* c = ctx;
+    mj_dag* dag = c->dag;
+    size_t self = c->index;
+    mj_dag_worker* worker = &dag->workers[self];
+
+    for (int n = 0; n < MJ_DAG_BURST; n++) {
+        uint32_t job;
+        if (mj_dag_pop(dag, worker, &job) || mj_dag_steal(dag, self, &job)) {
+            mj_dag_complete(scheduler, dag, self, job);
+            continue;
+        }
+
+        if (__atomic_load_n(&dag->remaining, __ATOMIC_ACQUIRE) == 0) {
+            mj_scheduler_task_remove_current(scheduler);
+            mj_scheduler_release(scheduler);
+            if (__atomic_sub_fetch(&dag->active, 1, __ATOMIC_ACQ_REL) == 0) {
+                mj_dag_notify_waiter(dag);
+            }
+            return;
+        }
+
+        // Raise the flag before the last look, a push that misses the look sees the flag and wakes us
+        __atomic_store_n(&worker->idle, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (mj_dag_any_ready(dag) || __atomic_load_n(&dag->remaining, __ATOMIC_ACQUIRE) == 0) {
+            __atomic_store_n(&worker->idle, false, __ATOMIC_RELAXED);
+            continue;
+        }
+        mj_scheduler_task_wait(scheduler, &worker->idle_queue, 0, NULL);
+        return;
+    }
+}
+
+// Successor lists, readiness counters and ranks. return -1 with ELOOP on a cycle.
+static int mj_dag_prepare(mj_dag* dag, uint32_t* order) {
+    for (size_t i = 0; i < dag->edge_count; i++) {
+        dag->jobs[dag->edges[i].from].succ_count++;
+        dag->jobs[dag->edges[i].to].pending++;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < dag->job_count; i++) {
+        dag->jobs[i].succ_start = start;
+        start += dag->jobs[i].succ_count;
+        dag->jobs[i].succ_count = 0;
+    }
+    for (size_t i = 0; i < dag->edge_count; i++) {
+        mj_dag_job* from = &dag->jobs[dag->edges[i].from];
+        dag->succ[from->succ_start + from->succ_count++] = dag->edges[i].to;
+    }
+
+    // Kahn's algorithm on a scratch copy of the counters, kept in rank until the ranks are computed
+    size_t head = 0;
+    size_t tail = 0;
+    for (size_t i = 0; i < dag->job_count; i++) {
+        dag->jobs[i].rank = dag->jobs[i].pending;
+        if (dag->jobs[i].pending == 0) {
+            order[tail++] = (uint32_t)i;
+        }
+    }
+    while (head < tail) {
+        mj_dag_job* job = &dag->jobs[order[head++]];
+        for (size_t i = 0; i < job->succ_count; i++) {
+            uint32_t next = dag->succ[job->succ_start + i];
+            if (--dag->jobs[next].rank == 0) {
+                order[tail++] = next;
+            }
+        }
+    }
+    if (tail < dag->job_count) {
+        for (size_t i = 0; i < dag->job_count; i++) {
+            dag->jobs[i].pending = 0;
+            dag->jobs[i].succ_count = 0;
+        }
+        errno = ELOOP;
+        return -1;
+    }
+
+    // Reverse topological order, every successor is ranked before its dependencies
+    for (size_t n = dag->job_count; n > 0; n--) {
+        mj_dag_job* job = &dag->jobs[order[n - 1]];
+        uint64_t longest = 0;
+        for (size_t i = 0; i < job->succ_count; i++) {
+            uint64_t rank = dag->jobs[dag->succ[job->succ_start + i]].rank;
+            longest = rank > longest ? rank : longest;
+        }
+        job->rank = job->cost + longest;
+    }
+    return 0;
+}
+
+static void mj_dag_free_workers(mj_dag* dag) {
+    const mj_allocator* allocator = dag->allocator;
+    for (size_t i = 0; i < dag->worker_count; i++) {
+        mj_dag_worker* worker = &dag->workers[i];
+        if (worker->heap) {
+            allocator->free(allocator->user, worker->heap, dag->job_count * sizeof(uint32_t));
+        }
+        if (worker->task) {
+            allocator->free(allocator->user, worker->task->ctx, sizeof(mj_dag_worker_ctx));
+            allocator->free(allocator->user, worker->task, sizeof(mj_task));
+        }
+    }
+    allocator->free(allocator->user, dag->workers, dag->worker_count * sizeof(mj_dag_worker));
+    dag->workers = NULL;
+    dag->worker_count = 0;
+}
+
+static int mj_dag_create_workers(mj_dag* dag, size_t count) {
+    const mj_allocator* allocator = dag->allocator;
+    dag->workers = allocator->alloc(allocator->user, count * sizeof(mj_dag_worker));
+    if (dag->workers == NULL) {
+        return -1;
+    }
+    memset(dag->workers, 0, count * sizeof(mj_dag_worker));
+    dag->worker_count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        mj_dag_worker* worker = &dag->workers[i];
+        worker->heap = allocator->alloc(allocator->user, dag->job_count * sizeof(uint32_t));
+        if (worker->heap == NULL) {
+            return -1;
+        }
+
+        mj_task* task = allocator->alloc(allocator->user, sizeof(*task));
+        if (task == NULL) {
+            return -1;
+        }
+        memset(task, 0, sizeof(*task));
+        mj_dag_worker_ctx* ctx = allocator->alloc(allocator->user, sizeof(*ctx));
+        if (ctx == NULL) {
+            allocator->free(allocator->user, task, sizeof(*task));
+            return -1;
+        }
+        ctx->dag = dag;
+        ctx->index = i;
+        task->run = mj_dag_worker_run;
+        task->name = "mj_dag";
+        task->ctx = ctx;
+        task->ctx_size = sizeof(*ctx);
+        worker->task = task;
+    }
+    return 0;
+}
+
+int mj_dag_run(mj_dag* dag, mj_scheduler** schedulers, size_t count) {
+    if (dag == NULL || schedulers == NULL || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dag->started) {
+        errno = EBUSY;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (schedulers[i] == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (dag->job_count == 0) {
+        dag->started = true;
+        return 0;
+    }
+
+    const mj_allocator* allocator = dag->allocator;
+    uint32_t* order = allocator->alloc(allocator->user, dag->job_count * sizeof(uint32_t));
+    dag->succ = allocator->alloc(allocator->user, (dag->edge_count + 1) * sizeof(uint32_t));
+    if (order == NULL || dag->succ == NULL) {
+        if (order) {
+            allocator->free(allocator->user, order, dag->job_count * sizeof(uint32_t));
+        }
+        if (dag->succ) {
+            allocator->free(allocator->user, dag->succ, (dag->edge_count + 1) * sizeof(uint32_t));
+        }
+        dag->succ = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    int prepared = mj_dag_prepare(dag, order);
+    allocator->free(allocator->user, order, dag->job_count * sizeof(uint32_t));
+    if (prepared != 0) {
+        allocator->free(allocator->user, dag->succ, (dag->edge_count + 1) * sizeof(uint32_t));
+        dag->succ = NULL;
+        return -1;
+    }
+
+    if (mj_dag_create_workers(dag, count) != 0) {
+        mj_dag_free_workers(dag);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Deal the roots out round robin, each heap puts its most critical one first
+    size_t next = 0;
+    for (size_t i = 0; i < dag->job_count; i++) {
+        if (dag->jobs[i].pending == 0) {
+            mj_dag_push(dag, &dag->workers[next], (uint32_t)i);
+            next = (next + 1) % count;
+        }
+    }
+
+    // Nothing can fail from here on, posted workers belong to the schedulers
+    dag->started = true;
+    __atomic_store_n(&dag->remaining, dag->job_count, __ATOMIC_RELEASE);
+    __atomic_store_n(&dag->active, count, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < count; i++) {
+        // Idle workers park with nothing else to wake them, keep the scheduler from giving up on them
+        mj_scheduler_hold(schedulers[i]);
+        mj_scheduler_task_post(schedulers[i], dag->workers[i].task);
+    }
+    return 0;
+}
+
+int mj_dag_wait(mj_scheduler* scheduler, mj_dag* dag) {
+    mj_task* task = mj_scheduler_task_current(scheduler);
+    if (task == NULL || dag == NULL || !dag->started) {
+        errno = EINVAL;
+        return -1;
+    }
+    mj_task* waiter = __atomic_load_n(&dag->waiter, __ATOMIC_ACQUIRE);
+    if (waiter == MJ_DAG_FINISHED) {
+        return 0;
+    }
+
+    if (waiter != task) {
+        // Held while parked, the wake comes from another thread. The wake is drained by this thread, so it
+        // can not arrive before the task has parked below.
+        mj_scheduler_hold(scheduler);
+        mj_task* expected = NULL;
+        if (!__atomic_compare_exchange_n(&dag->waiter, &expected, task, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            mj_scheduler_release(scheduler);
+            if (expected == MJ_DAG_FINISHED) {
+                return 0;
+            }
+            errno = EBUSY; // another task waits on the DAG
+            return -1;
+        }
+    }
+
+    if (mj_scheduler_task_wait(scheduler, &dag->waiter_queue, 0, NULL) != 0) {
+        return -1;
+    }
+    errno = EINPROGRESS;
+    return -1;
+}
+
+bool mj_dag_done(const mj_dag* dag) {
+    return dag == NULL || (dag->started && __atomic_load_n(&dag->waiter, __ATOMIC_ACQUIRE) == MJ_DAG_FINISHED);
+}
+
+size_t mj_dag_jobs(const mj_dag* dag) {
+    return dag ? dag->job_count : 0;
+}
+
+uint64_t mj_dag_steals(const mj_dag* dag) {
+    return dag ? __atomic_load_n(&dag->steals, __ATOMIC_RELAXED) : 0;
+}
@@ -0,0 +1,63 @@
+/* --------------------------------------------------------------------
+ * mj_dag.h
+ *
+ * Dependency graphs of small jobs, run across thread-per-core schedulers.
+ *
+ * Example usage:
+ *   mj_dag* dag = mj_dag_create(schedulers[0]);
+ *   int load = mj_dag_add(dag, load_fn, &job, 5);      // cost 5, in any unit, used to find the critical path
+ *   int parse = mj_dag_add(dag, parse_fn, &job, 2);
+ *   int index = mj_dag_add(dag, index_fn, &job, 1);
+ *   mj_dag_depend(dag, parse, load);                   // parse runs after load
+ *   mj_dag_depend(dag, index, parse);
+ *   mj_dag_run(dag, schedulers, core_count);
+ *
+ *   // caller task, EINPROGRESS pattern
+ *   if (mj_dag_wait(scheduler, dag) != 0) return;      // parked until the last job completes
+ *   mj_dag_destroy(&dag);
+ *
+ * Run counts the unfinished dependencies of every job and ranks jobs by the cost of the longest chain
+ * that starts at them (their critical path). Jobs with nothing left to wait for go to a per-scheduler
+ * ready heap, highest rank first. One worker task per scheduler pops its own heap and steals the top job
+ * of another scheduler's heap when its own is empty. A completed job decrements its successors' counters
+ * and pushes the ones that reach zero onto the finishing worker's heap, waking idle workers when there is
+ * more ready work than it can take. Idle workers park instead of polling, and the workers exit once every
+ * job has run.
+ *
+ * Jobs run inside a task callback on whichever scheduler picked them, they must not park or keep state in
+ * the thread. A DAG is run once, build a new one for the next batch.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+typedef struct mj_dag mj_dag;
+
+typedef void (*mj_dag_fn)(mj_scheduler* scheduler, void* arg);
+
+// scheduler provides the allocator for the DAG and its worker tasks and must outlive the DAG, the
+// schedulers it runs on must share that allocator
+mj_dag* mj_dag_create(mj_scheduler* scheduler);
+// return 1 with EBUSY while the DAG runs or a task waits on it
+int mj_dag_destroy(mj_dag** dag);
+
+// Only before run. cost 0 counts as 1. return the job index, -1 on error
+int mj_dag_add(mj_dag* dag, mj_dag_fn fn, void* arg, uint32_t cost);
+// job runs only after dependency has completed
+int mj_dag_depend(mj_dag* dag, int job, int dependency);
+
+// Posts one worker task to each scheduler, safe to call while the schedulers run. The schedulers are held
+// until the workers exit. return -1 with ELOOP if the dependencies form a cycle, nothing is posted then.
+int mj_dag_run(mj_dag* dag, mj_scheduler** schedulers, size_t count);
+
+// Only usable from within a task callback, by one task at a time.
+// return 0 once every job has completed and the workers have exited, the DAG can be destroyed then.
+// return -1 with EINPROGRESS after parking the task until then, EBUSY if another task waits already.
+int mj_dag_wait(mj_scheduler* scheduler, mj_dag* dag);
+// Same condition without parking, for threads outside the schedulers. Destroy is up to whoever waits.
+bool mj_dag_done(const mj_dag* dag);
+
+size_t mj_dag_jobs(const mj_dag* dag);
+// Jobs taken from another scheduler's heap so far
+uint64_t mj_dag_steals(const mj_dag* dag);
@@ -0,0 +1,759 @@
+#include "mj_dns.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MJ_DNS_MAX_NAME 254 // 253 characters plus terminator
+#define MJ_DNS_MAX_ADDRS 8
+#define MJ_DNS_BUCKETS 256
+#define MJ_DNS_PACKET 1500
+#define MJ_DNS_FAILURE_TTL_S 1 // failed lookups are remembered briefly so parked callers can pick up the error
+#define MJ_DNS_TYPE_A 1
+#define MJ_DNS_TYPE_SOA 6
+#define MJ_DNS_CLASS_IN 1
+
+typedef enum mj_dns_state {
+    MJ_DNS_READY = 0,
+    MJ_DNS_PENDING,
+} mj_dns_state;
+
+// One cache entry per name. A pending entry doubles as the in-flight query, which is what makes
+// concurrent lookups of the same name share one query.
+typedef struct mj_dns_entry {
+    char name[MJ_DNS_MAX_NAME]; // lower case, no trailing dot
+    uint32_t hash;
+    mj_dns_state state;
+    bool permanent; // from /etc/hosts
+    int error;      // 0, ENOENT, ETIMEDOUT or EIO
+    struct in_addr addrs[MJ_DNS_MAX_ADDRS];
+    size_t count;
+    uint64_t expires_ns;
+
+    // In-flight query
+    uint16_t id;
+    int attempt;    // sends so far, rotates through the nameservers
+    int last_error; // error from a nameserver that answered badly, reported if all attempts fail
+    uint64_t retry_ns;
+    mj_wait_queue waiters;
+
+    struct mj_dns_entry* next;         // bucket chain
+    struct mj_dns_entry* next_pending; // resolver->pending list
+} mj_dns_entry;
+
+struct mj_dns_resolver {
+    mj_scheduler* scheduler;
+    const mj_allocator* allocator;
+    int fd; // unconnected UDP socket, the kernel picks a random source port
+    struct sockaddr_in servers[MJ_DNS_MAX_NAMESERVERS];
+    int server_count;
+    uint64_t timeout_ns;
+    int attempts;
+    uint32_t negative_ttl_s;
+    size_t cache_max;
+    size_t cache_count; // entries not from /etc/hosts
+    mj_dns_entry* buckets[MJ_DNS_BUCKETS];
+    mj_dns_entry* pending;
+    bool task_running;
+    uint32_t rng;
+};
+
+// Context of the resolver task, the scheduler frees it when the task removes itself
+typedef struct mj_dns_task_ctx {
+    mj_dns_resolver* resolver;
+} mj_dns_task_ctx;
+
+static uint32_t mj_dns_hash(const char* name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (; *name; name++) {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint16_t mj_dns_random_id(mj_dns_resolver* resolver) {
+    // xorshift32, query ids only need to be unpredictable enough to not collide with stray replies
+    uint32_t x = resolver->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    resolver->rng = x;
+    return (uint16_t)(x >> 16);
+}
+
+// Lower case, strip one trailing dot. return -1 if the name can not be a valid DNS name
+static int mj_dns_normalize(const char* name, char* out) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    if (len == 0 || len >= MJ_DNS_MAX_NAME) {
+        return -1;
+    }
+
+    size_t label = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (c == '.') {
+            if (label == 0) {
+                return -1;
+            }
+            label = 0;
+        } else if (++label > 63) {
+            return -1;
+        }
+        out[i] = (char)tolower((unsigned char)c);
+    }
+    out[len] = '\0';
+    return label ? 0 : -1;
+}
+
+static mj_dns_entry* mj_dns_find(mj_dns_resolver* resolver, const char* name, uint32_t hash) {
+    for (mj_dns_entry* entry = resolver->buckets[hash % MJ_DNS_BUCKETS]; entry; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void mj_dns_entry_free(mj_dns_resolver* resolver, mj_dns_entry* entry) {
+    mj_dns_entry** link = &resolver->buckets[entry->hash % MJ_DNS_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    if (!entry->permanent) {
+        resolver->cache_count--;
+    }
+    resolver->allocator->free(resolver->allocator->user, entry, sizeof(*entry));
+}
+
+// Makes room for one more cached name: drop expired answers, then the answer closest to expiring.
+// Entries in flight and /etc/hosts entries are never evicted.
+static void mj_dns_evict(mj_dns_resolver* resolver, uint64_t now) {
+    mj_dns_entry* oldest = NULL;
+
+    for (size_t i = 0; i < MJ_DNS_BUCKETS; i++) {
+        mj_dns_entry* entry = resolver->buckets[i];
+        while (entry) {
+            mj_dns_entry* next = entry->next;
+            if (entry->state == MJ_DNS_READY && !entry->permanent) {
+                if (entry->expires_ns <= now) {
+                    mj_dns_entry_free(resolver, entry);
+                } else if (oldest == NULL || entry->expires_ns < oldest->expires_ns) {
+                    oldest = entry;
+                }
+            }
+            entry = next;
+        }
+    }
+
+    if (resolver->cache_count >= resolver->cache_max && oldest) {
+        mj_dns_entry_free(resolver, oldest);
+    }
+}
+
+static mj_dns_entry* mj_dns_entry_new(mj_dns_resolver* resolver, const char* name, uint32_t hash, bool permanent) {
+    if (!permanent && resolver->cache_count >= resolver->cache_max) {
+        mj_dns_evict(resolver, mj_time_now_ns());
+    }
+
+    mj_dns_entry* entry = resolver->allocator->alloc(resolver->allocator->user, sizeof(*entry));
+    if (entry == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(entry, 0, sizeof(*entry));
+
+    strcpy(entry->name, name);
+    entry->hash = hash;
+    entry->permanent = permanent;
+    entry->next = resolver->buckets[hash % MJ_DNS_BUCKETS];
+    resolver->buckets[hash % MJ_DNS_BUCKETS] = entry;
+    if (!permanent) {
+        resolver->cache_count++;
+    }
+    return entry;
+}
+
+static void mj_dns_parse_hosts(mj_dns_resolver* resolver, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char* save = NULL;
+        char* token = strtok_r(line, " \t\r\n", &save);
+        struct in_addr addr;
+        if (token == NULL || inet_pton(AF_INET, token, &addr) != 1) {
+            continue; // blank, or IPv6
+        }
+
+        while ((token = strtok_r(NULL, " \t\r\n", &save))) {
+            char name[MJ_DNS_MAX_NAME];
+            if (mj_dns_normalize(token, name) != 0) {
+                continue;
+            }
+            uint32_t hash = mj_dns_hash(name);
+            mj_dns_entry* entry = mj_dns_find(resolver, name, hash);
+            if (entry == NULL) {
+                entry = mj_dns_entry_new(resolver, name, hash, true);
+            }
+            if (entry && entry->count < MJ_DNS_MAX_ADDRS) {
+                entry->addrs[entry->count++] = addr;
+            }
+        }
+    }
+    fclose(file);
+}
+
+static void mj_dns_parse_resolv_conf(mj_dns_resolver* resolver, const char* path, uint64_t* timeout_s, int* attempts) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char* save = NULL;
+        char* key = strtok_r(line, " \t\r\n", &save);
+        if (key == NULL || key[0] == '#' || key[0] == ';') {
+            continue;
+        }
+
+        if (strcmp(key, "nameserver") == 0) {
+            char* value = strtok_r(NULL, " \t\r\n", &save);
+            struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(53)};
+            if (value && resolver->server_count < MJ_DNS_MAX_NAMESERVERS && inet_pton(AF_INET, value, &server.sin_addr) == 1) {
+                resolver->servers[resolver->server_count++] = server;
+            }
+        } else if (strcmp(key, "options") == 0) {
+            char* option;
+            while ((option = strtok_r(NULL, " \t\r\n", &save))) {
+                if (strncmp(option, "timeout:", 8) == 0) {
+                    *timeout_s = strtoul(option + 8, NULL, 10);
+                } else if (strncmp(option, "attempts:", 9) == 0) {
+                    *attempts = atoi(option + 9);
+                }
+            }
+        }
+    }
+    fclose(file);
+}
+
+mj_dns_resolver* mj_dns_resolver_create(mj_scheduler* scheduler, const mj_dns_config* config) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    mj_dns_config defaults = {0};
+    if (config == NULL) {
+        config = &defaults;
+    }
+
+    mj_dns_resolver* resolver = allocator->alloc(allocator->user, sizeof(*resolver));
+    if (resolver == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(resolver, 0, sizeof(*resolver));
+    resolver->scheduler = scheduler;
+    resolver->allocator = allocator;
+    resolver->cache_max = config->cache_max ? config->cache_max : 1024;
+    resolver->negative_ttl_s = config->negative_ttl_s ? config->negative_ttl_s : 60;
+    resolver->rng = (uint32_t)mj_time_now_ns() ^ ((uint32_t)getpid() << 16) ^ (uint32_t)(uintptr_t)resolver;
+    if (resolver->rng == 0) {
+        resolver->rng = 1;
+    }
+
+    uint64_t timeout_s = 5;
+    int attempts = 2;
+    const char* resolv_conf = config->resolv_conf ? config->resolv_conf : "/etc/resolv.conf";
+    const char* hosts = config->hosts ? config->hosts : "/etc/hosts";
+    if (resolv_conf[0]) {
+        mj_dns_parse_resolv_conf(resolver, resolv_conf, &timeout_s, &attempts);
+    }
+    if (hosts[0]) {
+        mj_dns_parse_hosts(resolver, hosts);
+    }
+    resolver->timeout_ns = (config->timeout_ms ? config->timeout_ms : (timeout_s ? timeout_s : 1) * 1000) * 1000000ULL;
+    resolver->attempts = config->attempts > 0 ? config->attempts : (attempts > 0 ? attempts : 1);
+
+    resolver->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int flags = resolver->fd >= 0 ? fcntl(resolver->fd, F_GETFL, 0) : -1;
+    if (flags < 0 || fcntl(resolver->fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        int error = errno;
+        mj_dns_resolver_destroy(&resolver);
+        errno = error;
+        return NULL;
+    }
+
+    return resolver;
+}
+
+int mj_dns_resolver_destroy(mj_dns_resolver** resolver) {
+    if (resolver == NULL || *resolver == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_dns_resolver* r = *resolver;
+    if (r->pending || r->task_running) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    for (size_t i = 0; i < MJ_DNS_BUCKETS; i++) {
+        while (r->buckets[i]) {
+            mj_dns_entry_free(r, r->buckets[i]);
+        }
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    r->allocator->free(r->allocator->user, r, sizeof(*r));
+    *resolver = NULL;
+    return 0;
+}
+
+int mj_dns_resolver_set_nameserver(mj_dns_resolver* resolver, const struct sockaddr_in* addr) {
+    if (resolver == NULL || addr == NULL || addr->sin_family != AF_INET) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    resolver->servers[0] = *addr;
+    resolver->server_count = 1;
+    return 0;
+}
+
+void mj_dns_resolver_flush(mj_dns_resolver* resolver) {
+    if (resolver == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < MJ_DNS_BUCKETS; i++) {
+        mj_dns_entry* entry = resolver->buckets[i];
+        while (entry) {
+            mj_dns_entry* next = entry->next;
+            if (entry->state == MJ_DNS_READY && !entry->permanent) {
+                mj_dns_entry_free(resolver, entry);
+            }
+            entry = next;
+        }
+    }
+}
+
+// Query for one A record with recursion desired, no EDNS
+static void mj_dns_send(mj_dns_resolver* resolver, mj_dns_entry* entry) {
+    uint8_t packet[MJ_DNS_PACKET];
+    size_t len = 0;
+
+    packet[len++] = (uint8_t)(entry->id >> 8);
+    packet[len++] = (uint8_t)entry->id;
+    packet[len++] = 0x01; // RD
+    packet[len++] = 0x00;
+    packet[len++] = 0x00; // QDCOUNT 1
+    packet[len++] = 0x01;
+    memset(packet + len, 0, 6); // AN, NS, AR counts
+    len += 6;
+
+    const char* label = entry->name;
+    while (*label) {
+        const char* dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+        packet[len++] = (uint8_t)label_len;
+        memcpy(packet + len, label, label_len);
+        len += label_len;
+        label += label_len + (dot ? 1 : 0);
+    }
+    packet[len++] = 0;
+    packet[len++] = 0x00;
+    packet[len++] = MJ_DNS_TYPE_A;
+    packet[len++] = 0x00;
+    packet[len++] = MJ_DNS_CLASS_IN;
+
+    const struct sockaddr_in* server = &resolver->servers[entry->attempt % resolver->server_count];
+    // A failed send is handled like a lost reply, the retry timeout moves on to the next attempt
+    sendto(resolver->fd, packet, len, 0, (const struct sockaddr*)server, sizeof(*server));
+
+    entry->attempt++;
+    entry->retry_ns = mj_time_now_ns() + resolver->timeout_ns;
+}
+
+// Finishes a query, the answer stays in the cache for ttl_s and every parked caller is woken to pick it up
+static void mj_dns_complete(mj_dns_resolver* resolver, mj_dns_entry* entry, int error, uint32_t ttl_s) {
+    mj_dns_entry** link = &resolver->pending;
+    while (*link && *link != entry) {
+        link = &(*link)->next_pending;
+    }
+    if (*link) {
+        *link = entry->next_pending;
+    }
+    entry->next_pending = NULL;
+
+    // At least a second, callers woken now must still find the answer when they run
+    if (ttl_s == 0) {
+        ttl_s = 1;
+    }
+    entry->state = MJ_DNS_READY;
+    entry->error = error;
+    entry->expires_ns = mj_time_now_ns() + (uint64_t)ttl_s * 1000000000ULL;
+    mj_wait_queue_wake_all(&entry->waiters);
+}
+
+static uint16_t mj_dns_read16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t mj_dns_read32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// return offset after the (possibly compressed) name at off, or 0 if it runs past the packet
+static size_t mj_dns_skip_name(const uint8_t* packet, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t label = packet[off];
+        if (label == 0) {
+            return off + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            return off + 2 <= len ? off + 2 : 0;
+        }
+        if (label & 0xC0) {
+            return 0;
+        }
+        off += 1 + label;
+    }
+    return 0;
+}
+
+// Reads the uncompressed question name into out, lower case with dots. return offset after it or 0
+static size_t mj_dns_read_question(const uint8_t* packet, size_t len, size_t off, char* out) {
+    size_t out_len = 0;
+    while (off < len) {
+        uint8_t label = packet[off++];
+        if (label == 0) {
+            out[out_len] = '\0';
+            return off;
+        }
+        if (label & 0xC0 || off + label > len || out_len + label + 1 >= MJ_DNS_MAX_NAME) {
+            return 0;
+        }
+        if (out_len) {
+            out[out_len++] = '.';
+        }
+        for (uint8_t i = 0; i < label; i++) {
+            out[out_len++] = (char)tolower(packet[off++]);
+        }
+    }
+    return 0;
+}
+
+// Negative TTL from the SOA in the authority section, min(SOA TTL, SOA minimum), per RFC 2308
+static uint32_t mj_dns_negative_ttl(mj_dns_resolver* resolver, const uint8_t* packet, size_t len, size_t off, uint16_t answers,
+                                    uint16_t authority) {
+    for (uint32_t i = 0; i < (uint32_t)answers + authority; i++) {
+        off = mj_dns_skip_name(packet, len, off);
+        if (off == 0 || off + 10 > len) {
+            break;
+        }
+        uint16_t type = mj_dns_read16(packet + off);
+        uint32_t ttl = mj_dns_read32(packet + off + 4);
+        uint16_t rdlength = mj_dns_read16(packet + off + 8);
+        off += 10;
+        if (off + rdlength > len) {
+            break;
+        }
+
+        if (i >= answers && type == MJ_DNS_TYPE_SOA) {
+            size_t rdata = mj_dns_skip_name(packet, len, off); // MNAME
+            rdata = rdata ? mj_dns_skip_name(packet, len, rdata) : 0; // RNAME
+            if (rdata && rdata + 20 <= off + rdlength) {
+                uint32_t minimum = mj_dns_read32(packet + rdata + 16);
+                return ttl < minimum ? ttl : minimum;
+            }
+        }
+        off += rdlength;
+    }
+    return resolver->negative_ttl_s;
+}
+
+static void mj_dns_handle_reply(mj_dns_resolver* resolver, const uint8_t* packet, size_t len) {
+    if (len < 12) {
+        return;
+    }
+    uint16_t id = mj_dns_read16(packet);
+    uint16_t flags = mj_dns_read16(packet + 2);
+    uint16_t questions = mj_dns_read16(packet + 4);
+    uint16_t answers = mj_dns_read16(packet + 6);
+    uint16_t authority = mj_dns_read16(packet + 8);
+    if (!(flags & 0x8000) || questions != 1) {
+        return; // not a response, or not one of ours
+    }
+
+    char name[MJ_DNS_MAX_NAME];
+    size_t off = mj_dns_read_question(packet, len, 12, name);
+    if (off == 0 || off + 4 > len) {
+        return;
+    }
+    off += 4; // QTYPE, QCLASS
+
+    // The id and the question must both match, otherwise it is a stray or spoofed reply
+    mj_dns_entry* entry = resolver->pending;
+    while (entry && (entry->id != id || strcmp(entry->name, name) != 0)) {
+        entry = entry->next_pending;
+    }
+    if (entry == NULL) {
+        return;
+    }
+
+    int rcode = flags & 0x000F;
+    if (rcode == 3) { // NXDOMAIN
+        mj_dns_complete(resolver, entry, ENOENT, mj_dns_negative_ttl(resolver, packet, len, off, answers, authority));
+        return;
+    }
+    if (rcode != 0) {
+        // SERVFAIL, REFUSED, ...: try the next nameserver right away
+        entry->last_error = EIO;
+        entry->retry_ns = 0;
+        return;
+    }
+
+    // Collect every A record, CNAME chains come back in the same answer section
+    size_t count = 0;
+    uint32_t min_ttl = UINT32_MAX;
+    size_t answer_off = off;
+    bool malformed = false;
+    for (uint16_t i = 0; i < answers; i++) {
+        answer_off = mj_dns_skip_name(packet, len, answer_off);
+        if (answer_off == 0 || answer_off + 10 > len) {
+            malformed = true;
+            break;
+        }
+        uint16_t type = mj_dns_read16(packet + answer_off);
+        uint16_t class = mj_dns_read16(packet + answer_off + 2);
+        uint32_t ttl = mj_dns_read32(packet + answer_off + 4);
+        uint16_t rdlength = mj_dns_read16(packet + answer_off + 8);
+        answer_off += 10;
+        if (answer_off + rdlength > len) {
+            malformed = true;
+            break;
+        }
+        if (ttl < min_ttl) {
+            min_ttl = ttl;
+        }
+        if (type == MJ_DNS_TYPE_A && class == MJ_DNS_CLASS_IN && rdlength == 4 && count < MJ_DNS_MAX_ADDRS) {
+            memcpy(&entry->addrs[count++], packet + answer_off, 4);
+        }
+        answer_off += rdlength;
+    }
+
+    if (malformed && !(flags & 0x0200)) {
+        // An answer section that runs past the packet is not a NODATA answer, retry rather than cache it
+        entry->last_error = EIO;
+        entry->retry_ns = 0;
+        return;
+    }
+    if (count == 0 && (flags & 0x0200)) {
+        // Truncated without a usable answer, there is no TCP fallback so treat it as a failed attempt
+        entry->last_error = EIO;
+        entry->retry_ns = 0;
+        return;
+    }
+
+    entry->count = count;
+    if (count == 0) { // NODATA
+        mj_dns_complete(resolver, entry, ENOENT, mj_dns_negative_ttl(resolver, packet, len, off, answers, authority));
+    } else {
+        mj_dns_complete(resolver, entry, 0, min_ttl);
+    }
+}
+
+static bool mj_dns_from_nameserver(const mj_dns_resolver* resolver, const struct sockaddr_in* from) {
+    for (int i = 0; i < resolver->server_count; i++) {
+        if (resolver->servers[i].sin_addr.s_addr == from->sin_addr.s_addr && resolver->servers[i].sin_port == from->sin_port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Resolver task: read replies, retransmit or fail timed out queries, and remove itself once idle
+static void mj_dns_task_run(mj_scheduler* scheduler, void* ctx) {
+    mj_dns_resolver* resolver = ((mj_dns_task_ctx*)ctx)->resolver;
+
+    uint8_t packet[MJ_DNS_PACKET];
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(resolver->fd, packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_len);
+        if (len < 0) {
+            break; // EAGAIN, or an ICMP error for an earlier send, the retry timeout covers both
+        }
+        if (from_len == sizeof(from) && mj_dns_from_nameserver(resolver, &from)) {
+            mj_dns_handle_reply(resolver, packet, (size_t)len);
+        }
+    }
+
+    uint64_t now = mj_time_now_ns();
+    uint64_t next_retry = 0;
+    mj_dns_entry* entry = resolver->pending;
+    while (entry) {
+        mj_dns_entry* next = entry->next_pending;
+        if (entry->retry_ns <= now) {
+            if (entry->attempt >= resolver->attempts * resolver->server_count) {
+                mj_dns_complete(resolver, entry, entry->last_error ? entry->last_error : ETIMEDOUT, MJ_DNS_FAILURE_TTL_S);
+                entry = next;
+                continue;
+            }
+            mj_dns_send(resolver, entry);
+        }
+        if (next_retry == 0 || entry->retry_ns < next_retry) {
+            next_retry = entry->retry_ns;
+        }
+        entry = next;
+    }
+
+    if (resolver->pending == NULL) {
+        resolver->task_running = false;
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    mj_scheduler_task_wait_fd(scheduler, resolver->fd, POLLIN, next_retry, NULL);
+}
+
+static int mj_dns_task_start(mj_dns_resolver* resolver) {
+    if (resolver->task_running) {
+        return 0;
+    }
+
+    mj_task* task = mj_scheduler_calloc(resolver->scheduler, 1, sizeof(*task));
+    mj_dns_task_ctx* ctx = mj_scheduler_alloc(resolver->scheduler, sizeof(*ctx));
+    if (task == NULL || ctx == NULL) {
+        mj_scheduler_free(resolver->scheduler, task, sizeof(*task));
+        mj_scheduler_free(resolver->scheduler, ctx, sizeof(*ctx));
+        errno = ENOMEM;
+        return -1;
+    }
+    ctx->resolver = resolver;
+    task->run = mj_dns_task_run;
+    task->name = "mj_dns_resolver";
+    task->ctx = ctx;
+    task->ctx_size = sizeof(*ctx);
+
+    if (mj_scheduler_task_add(resolver->scheduler, task) != 0) {
+        int error = errno;
+        mj_scheduler_free(resolver->scheduler, ctx, sizeof(*ctx));
+        mj_scheduler_free(resolver->scheduler, task, sizeof(*task));
+        errno = error;
+        return -1;
+    }
+    resolver->task_running = true;
+    return 0;
+}
+
+static int mj_dns_answer(const mj_dns_entry* entry, struct in_addr* addrs, size_t* count) {
+    if (entry->error) {
+        errno = entry->error;
+        return -1;
+    }
+
+    size_t n = entry->count < *count ? entry->count : *count;
+    memcpy(addrs, entry->addrs, n * sizeof(*addrs));
+    *count = n;
+    return 0;
+}
+
+int mj_dns_resolve(mj_dns_resolver* resolver, bool* pending, const char* name, struct in_addr* addrs, size_t* count, uint64_t deadline_ns,
+                   mj_cancel_token* token) {
+    if (resolver == NULL || pending == NULL || name == NULL || addrs == NULL || count == NULL || *count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Coming back from a wait, only a normal wake means the answer is in the cache
+    if (*pending) {
+        *pending = false;
+        int wait_result = mj_scheduler_task_wait_result(resolver->scheduler);
+        if (wait_result) {
+            errno = wait_result;
+            return -1;
+        }
+    }
+
+    // Address literals never hit the network
+    if (inet_pton(AF_INET, name, &addrs[0]) == 1) {
+        *count = 1;
+        return 0;
+    }
+
+    char normalized[MJ_DNS_MAX_NAME];
+    if (mj_dns_normalize(name, normalized) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t hash = mj_dns_hash(normalized);
+    mj_dns_entry* entry = mj_dns_find(resolver, normalized, hash);
+
+    if (entry && entry->state == MJ_DNS_READY && (entry->permanent || entry->expires_ns > mj_time_now_ns())) {
+        return mj_dns_answer(entry, addrs, count);
+    }
+
+    // Nobody asked yet, or the answer expired: this caller starts the query, later callers join it
+    if (entry == NULL || entry->state == MJ_DNS_READY) {
+        if (resolver->server_count == 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (entry == NULL) {
+            entry = mj_dns_entry_new(resolver, normalized, hash, false);
+            if (entry == NULL) {
+                return -1;
+            }
+        }
+
+        entry->state = MJ_DNS_PENDING;
+        entry->count = 0;
+        entry->error = 0;
+        entry->last_error = 0;
+        entry->attempt = 0;
+        entry->id = mj_dns_random_id(resolver);
+        entry->next_pending = resolver->pending;
+        resolver->pending = entry;
+
+        if (mj_dns_task_start(resolver) != 0) {
+            int error = errno;
+            mj_dns_complete(resolver, entry, EIO, MJ_DNS_FAILURE_TTL_S);
+            errno = error;
+            return -1;
+        }
+        mj_dns_send(resolver, entry);
+    }
+
+    if (mj_scheduler_task_wait(resolver->scheduler, &entry->waiters, deadline_ns, token) != 0) {
+        return -1;
+    }
+    *pending = true;
+    errno = EINPROGRESS;
+    return -1;
+}
@@ -0,0 +1,61 @@
+/* --------------------------------------------------------------------
+ * mj_dns.h
+ *
+ * Non-blocking stub resolver for IPv4 (A record) lookups. Never call getaddrinfo() from a task, it blocks
+ * the whole scheduler.
+ *
+ * Example usage, from inside a task's run callback:
+ *   struct in_addr addrs[4];
+ *   size_t count = 4;
+ *   if (mj_dns_resolve(resolver, &ctx->dns_pending, "example.com", addrs, &count, mj_deadline_in_ms(2000), NULL) != 0) {
+ *       if (errno == EINPROGRESS) return;  // parked until the answer arrives, run is called again
+ *       ...                                // ENOENT: no such name, ETIMEDOUT / ECANCELED / EIO: lookup failed
+ *   }
+ *
+ * Names are looked up in /etc/hosts first, then in a TTL-respecting cache (negative answers are cached too),
+ * then sent as UDP queries to the nameservers from /etc/resolv.conf. Concurrent lookups of the same name share
+ * a single query. Replies are read by a resolver task that the resolver adds to the scheduler while queries
+ * are in flight and that removes itself once they are done, so it never keeps mj_scheduler_run alive.
+ *
+ * Search domains are not applied, names are always queried as fully qualified.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+#include <netinet/in.h>
+
+#define MJ_DNS_MAX_NAMESERVERS 3
+
+typedef struct mj_dns_resolver mj_dns_resolver;
+
+typedef struct mj_dns_config {
+    const char* resolv_conf;     // NULL for /etc/resolv.conf, "" to skip
+    const char* hosts;           // NULL for /etc/hosts, "" to skip
+    uint64_t timeout_ms;         // per attempt, 0 takes resolv.conf "options timeout:" or 5 s
+    int attempts;                // per nameserver, 0 takes resolv.conf "options attempts:" or 2
+    uint32_t negative_ttl_s;     // used when a negative answer carries no SOA, 0 means 60 s
+    size_t cache_max;            // cached names, 0 means 1024
+} mj_dns_config;
+
+// config may be NULL for the defaults. Without a nameserver from resolv.conf or mj_dns_resolver_set_nameserver,
+// lookups of names not in /etc/hosts fail with ENOENT.
+mj_dns_resolver* mj_dns_resolver_create(mj_scheduler* scheduler, const mj_dns_config* config);
+// return 1 with EBUSY while queries are in flight
+int mj_dns_resolver_destroy(mj_dns_resolver** resolver);
+
+// Replaces the nameserver list with a single server, e.g. a local stub server task in tests
+int mj_dns_resolver_set_nameserver(mj_dns_resolver* resolver, const struct sockaddr_in* addr);
+
+// Only usable from within a task callback. *pending must start false, keep it in ctx between runs.
+// On success up to *count addresses are written to addrs and *count is updated.
+// return 0 or -1 with errno:
+//   EINPROGRESS         a query is in flight and the task is parked, call again with the same arguments on the next run
+//   ENOENT              the name does not exist or has no A records
+//   ETIMEDOUT/ECANCELED the task's deadline passed or token was cancelled, or (ETIMEDOUT) no nameserver answered
+//   EIO                 the nameservers answered with an error
+int mj_dns_resolve(mj_dns_resolver* resolver, bool* pending, const char* name, struct in_addr* addrs, size_t* count, uint64_t deadline_ns,
+                   mj_cancel_token* token);
+
+// Drops every cached answer, /etc/hosts entries are kept
+void mj_dns_resolver_flush(mj_dns_resolver* resolver);
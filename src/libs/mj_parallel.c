@@ -0,0 +1,336 @@
+#include "mj_parallel.h"
+#include <errno.h>
+#include <string.h>
+
+#define MJ_PARALLEL_CACHE_LINE 64
+
+// The part of the range a worker still owns, the owner takes from the front and thieves from the back
+typedef struct mj_parallel_slot {
+    bool lock;      // spinlock over begin / end
+    size_t begin;   // atomic, written under the lock, peeked without it
+    size_t end;     // atomic, written under the lock, peeked without it
+    size_t grain;   // items per chunk, only touched by the owner
+    char pad[MJ_PARALLEL_CACHE_LINE];
+} mj_parallel_slot;
+
+typedef struct mj_parallel_worker_ctx {
+    mj_parallel* job;
+    size_t index;
+} mj_parallel_worker_ctx;
+
+struct mj_parallel {
+    const mj_allocator* allocator;
+    mj_for_fn for_fn;
+    mj_reduce_fn reduce_fn;
+    mj_combine_fn combine;
+    void* arg;
+    size_t result_size;
+    unsigned char* partials; // one result_size partial per worker
+    mj_parallel_slot* slots;
+    size_t slot_count;
+    size_t active;           // atomic, workers still running
+
+    mj_task* waiter;         // atomic, the caller until the last worker wakes it
+    mj_scheduler* waiter_scheduler;
+    mj_wait_queue waiter_queue; // only touched by the caller's thread
+};
+
+static void mj_parallel_lock(mj_parallel_slot* slot) {
+    while (__atomic_test_and_set(&slot->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void mj_parallel_unlock(mj_parallel_slot* slot) {
+    __atomic_clear(&slot->lock, __ATOMIC_RELEASE);
+}
+
+// Owner side, carves the next chunk off the front of its own range
+static bool mj_parallel_take(mj_parallel_slot* slot, size_t* begin, size_t* end) {
+    mj_parallel_lock(slot);
+    size_t first = slot->begin;
+    size_t last = slot->end;
+    if (first >= last) {
+        mj_parallel_unlock(slot);
+        return false;
+    }
+    size_t chunk = last - first < slot->grain ? last - first : slot->grain;
+    __atomic_store_n(&slot->begin, first + chunk, __ATOMIC_RELAXED);
+    mj_parallel_unlock(slot);
+
+    *begin = first;
+    *end = first + chunk;
+    return true;
+}
+
+// Thief side, moves the back half of the largest range left into the thief's own, empty, slot
+static bool mj_parallel_steal(mj_parallel* job, size_t self) {
+    for (;;) {
+        size_t victim = job->slot_count;
+        size_t largest = 0;
+        for (size_t i = 0; i < job->slot_count; i++) {
+            mj_parallel_slot* slot = &job->slots[i];
+            size_t begin = __atomic_load_n(&slot->begin, __ATOMIC_RELAXED);
+            size_t end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);
+            if (i != self && end > begin && end - begin > largest) {
+                largest = end - begin;
+                victim = i;
+            }
+        }
+        if (victim == job->slot_count) {
+            return false;
+        }
+
+        mj_parallel_slot* slot = &job->slots[victim];
+        mj_parallel_lock(slot);
+        size_t begin = slot->begin;
+        size_t end = slot->end;
+        if (begin >= end) {
+            mj_parallel_unlock(slot);
+            continue; // drained since the scan, look again
+        }
+        size_t mid = begin + (end - begin) / 2;
+        __atomic_store_n(&slot->end, mid, __ATOMIC_RELAXED);
+        mj_parallel_unlock(slot);
+
+        mj_parallel_slot* own = &job->slots[self];
+        mj_parallel_lock(own);
+        __atomic_store_n(&own->begin, mid, __ATOMIC_RELAXED);
+        __atomic_store_n(&own->end, end, __ATOMIC_RELAXED);
+        mj_parallel_unlock(own);
+        return true;
+    }
+}
+
+// Next chunk size from how long the last one took, halfway between the old grain and the one that hits the target
+static size_t mj_parallel_adapt(size_t grain, size_t items, uint64_t elapsed_ns) {
+    size_t target;
+    if (elapsed_ns == 0) {
+        target = grain * 2;
+    } else {
+        uint64_t per_item_ns = elapsed_ns / items;
+        target = per_item_ns == 0 ? grain * 2 : (size_t)(MJ_PARALLEL_CHUNK_NS / per_item_ns);
+    }
+    size_t next = grain / 2 + target / 2;
+    return next > 0 ? next : 1;
+}
+
+static void mj_parallel_worker_run(mj_scheduler* scheduler, void* ctx) {
+    mj_parallel_worker_ctx* c = ctx;
+    mj_parallel* job = c->job;
+    size_t self = c->index;
+    mj_parallel_slot* slot = &job->slots[self];
+
+    uint64_t slice_end = mj_time_now_ns() + MJ_PARALLEL_SLICE_NS;
+    for (;;) {
+        size_t begin;
+        size_t end;
+        if (!mj_parallel_take(slot, &begin, &end)) {
+            if (mj_parallel_steal(job, self)) {
+                continue;
+            }
+            break;
+        }
+
+        uint64_t start = mj_time_now_ns();
+        if (job->reduce_fn) {
+            job->reduce_fn(scheduler, begin, end, job->partials + self * job->result_size, job->arg);
+        } else {
+            job->for_fn(scheduler, begin, end, job->arg);
+        }
+        uint64_t now = mj_time_now_ns();
+        slot->grain = mj_parallel_adapt(slot->grain, end - begin, now - start);
+        if (now >= slice_end) {
+            return; // still runnable, picks up where it left off next pass
+        }
+    }
+
+    // Nothing left anywhere, the last worker out resumes the caller. The caller frees the job once
+    // woken, so take everything needed from it before the wake.
+    mj_scheduler_task_remove_current(scheduler);
+    if (__atomic_sub_fetch(&job->active, 1, __ATOMIC_ACQ_REL) == 0) {
+        mj_scheduler* held = job->waiter_scheduler;
+        mj_task* waiter = __atomic_exchange_n(&job->waiter, NULL, __ATOMIC_ACQ_REL);
+        mj_task_post_wake(waiter);
+        mj_scheduler_release(held);
+    }
+}
+
+static void mj_parallel_free(mj_parallel* job) {
+    const mj_allocator* allocator = job->allocator;
+    if (job->partials) {
+        allocator->free(allocator->user, job->partials, job->slot_count * job->result_size);
+    }
+    if (job->slots) {
+        allocator->free(allocator->user, job->slots, job->slot_count * sizeof(mj_parallel_slot));
+    }
+    allocator->free(allocator->user, job, sizeof(*job));
+}
+
+static mj_task* mj_parallel_task_create(mj_parallel* job, size_t index) {
+    const mj_allocator* allocator = job->allocator;
+    mj_task* task = allocator->alloc(allocator->user, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+    memset(task, 0, sizeof(*task));
+
+    mj_parallel_worker_ctx* ctx = allocator->alloc(allocator->user, sizeof(*ctx));
+    if (ctx == NULL) {
+        allocator->free(allocator->user, task, sizeof(*task));
+        return NULL;
+    }
+    ctx->job = job;
+    ctx->index = index;
+    task->run = mj_parallel_worker_run;
+    task->name = "mj_parallel";
+    task->ctx = ctx;
+    task->ctx_size = sizeof(*ctx);
+    return task;
+}
+
+// Splits the range evenly, posts the workers and parks the caller
+static int mj_parallel_start(mj_scheduler* scheduler, mj_parallel* job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                             const void* identity) {
+    const mj_allocator* allocator = job->allocator;
+    job->slot_count = count;
+    job->slots = allocator->alloc(allocator->user, count * sizeof(mj_parallel_slot));
+    if (job->slots == NULL) {
+        return -1;
+    }
+    memset(job->slots, 0, count * sizeof(mj_parallel_slot));
+    if (job->result_size > 0) {
+        job->partials = allocator->alloc(allocator->user, count * job->result_size);
+        if (job->partials == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            memcpy(job->partials + i * job->result_size, identity, job->result_size);
+        }
+    }
+
+    size_t total = end - begin;
+    for (size_t i = 0; i < count; i++) {
+        job->slots[i].begin = begin + total * i / count;
+        job->slots[i].end = begin + total * (i + 1) / count;
+        job->slots[i].grain = 1;
+    }
+
+    mj_task** tasks = allocator->alloc(allocator->user, count * sizeof(mj_task*));
+    if (tasks == NULL) {
+        return -1;
+    }
+    memset(tasks, 0, count * sizeof(mj_task*));
+    for (size_t i = 0; i < count; i++) {
+        tasks[i] = mj_parallel_task_create(job, i);
+        if (tasks[i] == NULL) {
+            break;
+        }
+    }
+
+    // Park first, the last worker may finish before this callback returns. Nothing can fail after that.
+    if (tasks[count - 1] == NULL || mj_scheduler_task_wait(scheduler, &job->waiter_queue, 0, NULL) != 0) {
+        for (size_t i = 0; i < count && tasks[i]; i++) {
+            allocator->free(allocator->user, tasks[i]->ctx, tasks[i]->ctx_size);
+            allocator->free(allocator->user, tasks[i], sizeof(mj_task));
+        }
+        allocator->free(allocator->user, tasks, count * sizeof(mj_task*));
+        return -1;
+    }
+    job->waiter = mj_scheduler_task_current(scheduler);
+    job->waiter_scheduler = scheduler;
+    mj_scheduler_hold(scheduler); // the wake comes from another thread
+    job->active = count;
+    for (size_t i = 0; i < count; i++) {
+        mj_scheduler_task_post(schedulers[i], tasks[i]);
+    }
+    allocator->free(allocator->user, tasks, count * sizeof(mj_task*));
+    return 0;
+}
+
+static int mj_parallel_run(mj_scheduler* scheduler, mj_parallel** job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                           mj_for_fn for_fn, mj_reduce_fn reduce_fn, mj_combine_fn combine, void* result, size_t result_size, void* arg) {
+    if (job == NULL || mj_scheduler_task_current(scheduler) == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (*job) {
+        mj_parallel* j = *job;
+        if (__atomic_load_n(&j->waiter, __ATOMIC_ACQUIRE) != NULL) {
+            // Woken by something else, the workers are still going
+            if (mj_scheduler_task_wait(scheduler, &j->waiter_queue, 0, NULL) != 0) {
+                return -1;
+            }
+            errno = EINPROGRESS;
+            return -1;
+        }
+        for (size_t i = 0; j->combine && i < j->slot_count; i++) {
+            j->combine(result, j->partials + i * j->result_size, j->arg);
+        }
+        mj_parallel_free(j);
+        *job = NULL;
+        return 0;
+    }
+
+    if (schedulers == NULL || count == 0 || end < begin || (result_size > 0 && result == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (schedulers[i] == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (begin == end) {
+        return 0; // result already holds the identity
+    }
+    // No point in a worker with nothing to start from
+    if (count > end - begin) {
+        count = end - begin;
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    mj_parallel* j = allocator->alloc(allocator->user, sizeof(*j));
+    if (j == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(j, 0, sizeof(*j));
+    j->allocator = allocator;
+    j->for_fn = for_fn;
+    j->reduce_fn = reduce_fn;
+    j->combine = combine;
+    j->arg = arg;
+    j->result_size = result_size;
+
+    if (mj_parallel_start(scheduler, j, schedulers, count, begin, end, result) != 0) {
+        int error = errno == EBUSY ? EBUSY : ENOMEM;
+        mj_parallel_free(j);
+        errno = error;
+        return -1;
+    }
+    *job = j;
+    errno = EINPROGRESS;
+    return -1;
+}
+
+int mj_parallel_for(mj_scheduler* scheduler, mj_parallel** job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                    mj_for_fn fn, void* arg) {
+    if (fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return mj_parallel_run(scheduler, job, schedulers, count, begin, end, fn, NULL, NULL, NULL, 0, arg);
+}
+
+int mj_parallel_reduce(mj_scheduler* scheduler, mj_parallel** job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                       mj_reduce_fn fn, mj_combine_fn combine, void* result, size_t result_size, void* arg) {
+    if (fn == NULL || combine == NULL || result == NULL || result_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return mj_parallel_run(scheduler, job, schedulers, count, begin, end, NULL, fn, combine, result, result_size, arg);
+}
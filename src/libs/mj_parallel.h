@@ -0,0 +1,52 @@
+/* --------------------------------------------------------------------
+ * mj_parallel.h
+ *
+ * Data-parallel loops over thread-per-core schedulers, for work that would otherwise block one task.
+ *
+ * Example usage, a task summing a large array without stalling its scheduler:
+ *   void sum_range(mj_scheduler* s, size_t begin, size_t end, void* partial, void* arg) {
+ *       const uint64_t* values = arg;
+ *       for (size_t i = begin; i < end; i++) *(uint64_t*)partial += values[i];
+ *   }
+ *   void add(void* result, const void* partial, void* arg) { *(uint64_t*)result += *(const uint64_t*)partial; }
+ *
+ *   // run callback, ctx->job starts out NULL and ctx->sum holds the identity (0)
+ *   if (mj_parallel_reduce(scheduler, &ctx->job, schedulers, core_count, 0, count, sum_range, add,
+ *                          &ctx->sum, sizeof(ctx->sum), values) != 0) {
+ *       return;  // EINPROGRESS, parked until every chunk is done
+ *   }
+ *   use(ctx->sum);
+ *
+ * The first call splits [begin, end) evenly over one worker task per scheduler and parks the caller,
+ * calling again with the same job once woken returns the result. Workers carve chunks off the front of
+ * their own range, sized so a chunk takes about MJ_PARALLEL_CHUNK_NS judging by the previous ones, and give
+ * the rest of their scheduler a turn every MJ_PARALLEL_SLICE_NS. A worker whose range runs dry steals the
+ * back half of the largest range left. Ranges are only split when someone steals, never up front, so a
+ * job costs one task per scheduler however large the range is and concurrent jobs do not flood the
+ * task lists with chunks.
+ *
+ * Chunk functions run on any of the schedulers, inside a task callback, and must not park. Reduce gives
+ * every worker its own partial, a copy of the identity passed in result, and combines them into result in
+ * worker order on the caller's thread, so combine must be associative.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+#define MJ_PARALLEL_CHUNK_NS 50000   // target run-time of one chunk
+#define MJ_PARALLEL_SLICE_NS 1000000 // a worker yields after this long
+
+typedef struct mj_parallel mj_parallel;
+
+typedef void (*mj_for_fn)(mj_scheduler* scheduler, size_t begin, size_t end, void* arg);
+typedef void (*mj_reduce_fn)(mj_scheduler* scheduler, size_t begin, size_t end, void* partial, void* arg);
+typedef void (*mj_combine_fn)(void* result, const void* partial, void* arg);
+
+// Only usable from within a task callback. Pass a NULL *job to start, the same job on later calls.
+// The schedulers must share the caller's allocator. return 0 when done (*job is freed and set to NULL),
+// -1 with EINPROGRESS while the task is parked on the job, other errnos if it could not start.
+int mj_parallel_for(mj_scheduler* scheduler, mj_parallel** job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                    mj_for_fn fn, void* arg);
+int mj_parallel_reduce(mj_scheduler* scheduler, mj_parallel** job, mj_scheduler** schedulers, size_t count, size_t begin, size_t end,
+                       mj_reduce_fn fn, mj_combine_fn combine, void* result, size_t result_size, void* arg);
@@ -0,0 +1,426 @@
+#include "mj_pipeline.h"
+#include <errno.h>
+#include <string.h>
+
+typedef struct mj_stage_def {
+    const char* name;
+    mj_stage_fn fn;
+    void* user;
+} mj_stage_def;
+
+// One per lane and stage, written only by the lane's thread, read by mj_pipeline_stats from anywhere
+typedef struct mj_stage_counters {
+    uint64_t items_in;
+    uint64_t items_out;
+    uint64_t batches;
+    uint64_t run_ns;
+    uint64_t input_waits;
+    uint64_t output_waits;
+    uint64_t queue_depth;
+} mj_stage_counters;
+
+// ctx of one stage task
+struct mj_stage {
+    mj_pipeline* pipeline;
+    size_t lane;
+    size_t index;
+    mj_channel* in;
+    mj_channel* out;    // NULL for the last stage
+    void** batch;       // items taken from in, pipeline->batch long
+    void** pending;     // items emitted but not pushed downstream yet
+    size_t pending_count;
+    size_t pending_sent;
+    size_t pending_capacity;
+};
+
+struct mj_pipeline {
+    mj_scheduler* scheduler; // allocator for the pipeline and its channels
+    const mj_allocator* allocator;
+    size_t batch;
+    size_t channel_capacity;
+    mj_stage_def stages[MJ_PIPELINE_MAX_STAGES];
+    size_t stage_count;
+
+    // Set up by start, indexed lane * stage_count + stage
+    size_t lanes;
+    mj_channel** channels;       // input channel of each stage
+    mj_stage_counters* counters;
+    size_t active;               // atomic, stage tasks still running
+    uint64_t start_ns;
+};
+
+static void mj_counter_add(uint64_t* counter, uint64_t value) {
+    // Single writer, a plain read-modify-write published with a relaxed store is enough
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+mj_pipeline* mj_pipeline_create(mj_scheduler* scheduler, size_t batch, size_t channel_capacity) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL || batch == 0 || channel_capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_pipeline* pipeline = allocator->alloc(allocator->user, sizeof(*pipeline));
+    if (pipeline == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pipeline, 0, sizeof(*pipeline));
+
+    pipeline->scheduler = scheduler;
+    pipeline->allocator = allocator;
+    pipeline->batch = batch;
+    pipeline->channel_capacity = channel_capacity;
+    return pipeline;
+}
+
+// return 1 with EBUSY, freeing nothing, while a task outside the pipeline is still parked on one of its channels
+static int mj_pipeline_free_lanes(mj_pipeline* pipeline, size_t lanes) {
+    const mj_allocator* allocator = pipeline->allocator;
+    size_t slots = lanes * pipeline->stage_count;
+    if (pipeline->channels) {
+        // Check every channel first, a pipeline with half of its channels gone could not be used or retried
+        for (size_t i = 0; i < slots; i++) {
+            mj_channel* channel = pipeline->channels[i];
+            if (channel && (!mj_wait_queue_empty(mj_channel_send_queue(channel)) || !mj_wait_queue_empty(mj_channel_recv_queue(channel)))) {
+                errno = EBUSY;
+                return 1;
+            }
+        }
+        for (size_t i = 0; i < slots; i++) {
+            if (pipeline->channels[i] && mj_channel_destroy(&pipeline->channels[i]) != 0) {
+                return 1;
+            }
+        }
+        allocator->free(allocator->user, pipeline->channels, slots * sizeof(mj_channel*));
+    }
+    if (pipeline->counters) {
+        allocator->free(allocator->user, pipeline->counters, slots * sizeof(mj_stage_counters));
+    }
+    pipeline->channels = NULL;
+    pipeline->counters = NULL;
+    return 0;
+}
+
+int mj_pipeline_destroy(mj_pipeline** pipeline) {
+    if (pipeline == NULL || *pipeline == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (__atomic_load_n(&(*pipeline)->active, __ATOMIC_ACQUIRE) > 0) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    mj_pipeline* p = *pipeline;
+    if (mj_pipeline_free_lanes(p, p->lanes) != 0) {
+        return 1;
+    }
+    p->allocator->free(p->allocator->user, p, sizeof(*p));
+    *pipeline = NULL;
+    return 0;
+}
+
+int mj_pipeline_add_stage(mj_pipeline* pipeline, const char* name, mj_stage_fn fn, void* user) {
+    if (pipeline == NULL || fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (pipeline->lanes > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (pipeline->stage_count == MJ_PIPELINE_MAX_STAGES) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    mj_stage_def* def = &pipeline->stages[pipeline->stage_count];
+    def->name = name ? name : "mj_stage";
+    def->fn = fn;
+    def->user = user;
+    return (int)pipeline->stage_count++;
+}
+
+static void mj_stage_free_buffers(mj_stage* stage) {
+    const mj_allocator* allocator = stage->pipeline->allocator;
+    if (stage->batch) {
+        allocator->free(allocator->user, stage->batch, stage->pipeline->batch * sizeof(void*));
+    }
+    if (stage->pending) {
+        allocator->free(allocator->user, stage->pending, stage->pending_capacity * sizeof(void*));
+    }
+    stage->batch = NULL;
+    stage->pending = NULL;
+}
+
+// Pushes emitted items downstream, return false while some are still waiting for room
+static bool mj_stage_flush(mj_stage* stage) {
+    if (stage->pending_sent < stage->pending_count) {
+        size_t sent = mj_channel_send_batch(stage->out, stage->pending + stage->pending_sent, stage->pending_count - stage->pending_sent);
+        if (sent == 0 && errno == EAGAIN) {
+            return false;
+        }
+        stage->pending_sent += sent;
+        if (sent > 0 && stage->pending_sent < stage->pending_count) {
+            return false;
+        }
+    }
+    stage->pending_count = 0;
+    stage->pending_sent = 0;
+    return true;
+}
+
+static void mj_stage_finish(mj_scheduler* scheduler, mj_stage* stage) {
+    mj_pipeline* pipeline = stage->pipeline;
+    if (stage->out) {
+        mj_channel_close(stage->out);
+    }
+    mj_stage_free_buffers(stage);
+
+    // The pipeline may be destroyed by another thread as soon as this drops to zero
+    __atomic_sub_fetch(&pipeline->active, 1, __ATOMIC_ACQ_REL);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void mj_stage_run(mj_scheduler* scheduler, void* ctx) {
+    mj_stage* stage = ctx;
+    mj_pipeline* pipeline = stage->pipeline;
+    const mj_stage_def* def = &pipeline->stages[stage->index];
+    mj_stage_counters* counters = &pipeline->counters[stage->lane * pipeline->stage_count + stage->index];
+
+    if (!mj_stage_flush(stage)) {
+        mj_counter_add(&counters->output_waits, 1);
+        mj_scheduler_task_wait(scheduler, mj_channel_send_queue(stage->out), 0, NULL);
+        return;
+    }
+
+    size_t count = mj_channel_recv_batch(stage->in, stage->batch, pipeline->batch);
+    __atomic_store_n(&counters->queue_depth, mj_channel_len(stage->in), __ATOMIC_RELAXED);
+    if (count == 0) {
+        if (errno == EPIPE) {
+            mj_stage_finish(scheduler, stage);
+            return;
+        }
+        mj_counter_add(&counters->input_waits, 1);
+        mj_scheduler_task_wait(scheduler, mj_channel_recv_queue(stage->in), 0, NULL);
+        return;
+    }
+
+    uint64_t start = mj_time_now_ns();
+    def->fn(scheduler, stage, stage->batch, count, def->user);
+    mj_counter_add(&counters->run_ns, mj_time_now_ns() - start);
+    mj_counter_add(&counters->items_in, count);
+    mj_counter_add(&counters->items_out, stage->pending_count);
+    mj_counter_add(&counters->batches, 1);
+
+    // Push right away, the next stage can start on this batch before we run again
+    if (!mj_stage_flush(stage)) {
+        mj_counter_add(&counters->output_waits, 1);
+        mj_scheduler_task_wait(scheduler, mj_channel_send_queue(stage->out), 0, NULL);
+    }
+}
+
+static mj_task* mj_stage_task_create(mj_pipeline* pipeline, size_t lane, size_t index) {
+    const mj_allocator* allocator = pipeline->allocator;
+    mj_task* task = allocator->alloc(allocator->user, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+    memset(task, 0, sizeof(*task));
+
+    mj_stage* stage = allocator->alloc(allocator->user, sizeof(*stage));
+    if (stage == NULL) {
+        allocator->free(allocator->user, task, sizeof(*task));
+        return NULL;
+    }
+    memset(stage, 0, sizeof(*stage));
+
+    size_t slot = lane * pipeline->stage_count + index;
+    stage->pipeline = pipeline;
+    stage->lane = lane;
+    stage->index = index;
+    stage->in = pipeline->channels[slot];
+    stage->out = index + 1 < pipeline->stage_count ? pipeline->channels[slot + 1] : NULL;
+    stage->batch = allocator->alloc(allocator->user, pipeline->batch * sizeof(void*));
+    stage->pending_capacity = pipeline->batch;
+    stage->pending = stage->out ? allocator->alloc(allocator->user, stage->pending_capacity * sizeof(void*)) : NULL;
+    if (stage->batch == NULL || (stage->out && stage->pending == NULL)) {
+        mj_stage_free_buffers(stage);
+        allocator->free(allocator->user, stage, sizeof(*stage));
+        allocator->free(allocator->user, task, sizeof(*task));
+        return NULL;
+    }
+
+    task->run = mj_stage_run;
+    task->name = pipeline->stages[index].name;
+    task->ctx = stage;
+    task->ctx_size = sizeof(*stage);
+    return task;
+}
+
+static void mj_stage_task_free(mj_pipeline* pipeline, mj_task* task) {
+    mj_stage_free_buffers(task->ctx);
+    pipeline->allocator->free(pipeline->allocator->user, task->ctx, task->ctx_size);
+    pipeline->allocator->free(pipeline->allocator->user, task, sizeof(*task));
+}
+
+// Creates the channels and every stage task into tasks[], return -1 leaving whatever was built for the caller to free
+static int mj_pipeline_build(mj_pipeline* pipeline, size_t lanes, mj_task** tasks) {
+    const mj_allocator* allocator = pipeline->allocator;
+    size_t slots = lanes * pipeline->stage_count;
+
+    pipeline->channels = allocator->alloc(allocator->user, slots * sizeof(mj_channel*));
+    if (pipeline->channels) {
+        memset(pipeline->channels, 0, slots * sizeof(mj_channel*));
+    }
+    pipeline->counters = allocator->alloc(allocator->user, slots * sizeof(mj_stage_counters));
+    if (pipeline->channels == NULL || pipeline->counters == NULL) {
+        return -1;
+    }
+    memset(pipeline->counters, 0, slots * sizeof(mj_stage_counters));
+
+    for (size_t i = 0; i < slots; i++) {
+        pipeline->channels[i] = mj_channel_create(pipeline->scheduler, pipeline->channel_capacity);
+        if (pipeline->channels[i] == NULL) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        tasks[i] = mj_stage_task_create(pipeline, i / pipeline->stage_count, i % pipeline->stage_count);
+        if (tasks[i] == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int mj_pipeline_start(mj_pipeline* pipeline, mj_scheduler** schedulers, size_t lanes) {
+    if (pipeline == NULL || schedulers == NULL || lanes == 0 || pipeline->stage_count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (pipeline->lanes > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    for (size_t i = 0; i < lanes; i++) {
+        if (schedulers[i] == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    const mj_allocator* allocator = pipeline->allocator;
+    size_t task_count = lanes * pipeline->stage_count;
+    mj_task** tasks = allocator->alloc(allocator->user, task_count * sizeof(mj_task*));
+    if (tasks == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(tasks, 0, task_count * sizeof(mj_task*));
+
+    if (mj_pipeline_build(pipeline, lanes, tasks) != 0) {
+        for (size_t i = 0; i < task_count && tasks[i]; i++) {
+            mj_stage_task_free(pipeline, tasks[i]);
+        }
+        allocator->free(allocator->user, tasks, task_count * sizeof(mj_task*));
+        mj_pipeline_free_lanes(pipeline, lanes);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Nothing can fail from here on, posted tasks belong to the schedulers
+    pipeline->lanes = lanes;
+    pipeline->start_ns = mj_time_now_ns();
+    __atomic_store_n(&pipeline->active, task_count, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < task_count; i++) {
+        mj_stage* stage = tasks[i]->ctx;
+        mj_scheduler_task_post(schedulers[stage->lane], tasks[i]);
+    }
+    allocator->free(allocator->user, tasks, task_count * sizeof(mj_task*));
+    return 0;
+}
+
+mj_channel* mj_pipeline_input(mj_pipeline* pipeline, size_t lane) {
+    if (pipeline == NULL || lane >= pipeline->lanes) {
+        return NULL;
+    }
+    return pipeline->channels[lane * pipeline->stage_count];
+}
+
+bool mj_pipeline_done(const mj_pipeline* pipeline) {
+    return pipeline == NULL || (pipeline->lanes > 0 && __atomic_load_n(&pipeline->active, __ATOMIC_ACQUIRE) == 0);
+}
+
+int mj_stage_emit(mj_stage* stage, void* item) {
+    if (stage == NULL || stage->out == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (stage->pending_count == stage->pending_capacity) {
+        const mj_allocator* allocator = stage->pipeline->allocator;
+        size_t capacity = stage->pending_capacity * 2;
+        void** pending = allocator->alloc(allocator->user, capacity * sizeof(void*));
+        if (pending == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(pending, stage->pending, stage->pending_count * sizeof(void*));
+        allocator->free(allocator->user, stage->pending, stage->pending_capacity * sizeof(void*));
+        stage->pending = pending;
+        stage->pending_capacity = capacity;
+    }
+
+    stage->pending[stage->pending_count++] = item;
+    return 0;
+}
+
+size_t mj_stage_lane(const mj_stage* stage) {
+    return stage ? stage->lane : 0;
+}
+
+size_t mj_stage_index(const mj_stage* stage) {
+    return stage ? stage->index : 0;
+}
+
+int mj_pipeline_stats(const mj_pipeline* pipeline, size_t stage, mj_stage_stats* stats) {
+    if (pipeline == NULL || stats == NULL || stage >= pipeline->stage_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (size_t lane = 0; lane < pipeline->lanes; lane++) {
+        const mj_stage_counters* c = &pipeline->counters[lane * pipeline->stage_count + stage];
+        stats->items_in += __atomic_load_n(&c->items_in, __ATOMIC_RELAXED);
+        stats->items_out += __atomic_load_n(&c->items_out, __ATOMIC_RELAXED);
+        stats->batches += __atomic_load_n(&c->batches, __ATOMIC_RELAXED);
+        stats->run_ns += __atomic_load_n(&c->run_ns, __ATOMIC_RELAXED);
+        stats->input_waits += __atomic_load_n(&c->input_waits, __ATOMIC_RELAXED);
+        stats->output_waits += __atomic_load_n(&c->output_waits, __ATOMIC_RELAXED);
+        stats->queue_depth += (size_t)__atomic_load_n(&c->queue_depth, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void mj_pipeline_write_stats(const mj_pipeline* pipeline, FILE* out) {
+    if (pipeline == NULL || out == NULL) {
+        return;
+    }
+
+    uint64_t elapsed_ns = pipeline->lanes > 0 ? mj_time_now_ns() - pipeline->start_ns : 0;
+    double seconds = elapsed_ns > 0 ? (double)elapsed_ns / 1e9 : 1.0;
+    fprintf(out, "%-16s %12s %12s %10s %12s %12s %12s %8s\n", "stage", "items_in", "items/s", "batch_avg", "busy_ms", "input_waits", "output_waits",
+            "depth");
+    for (size_t s = 0; s < pipeline->stage_count; s++) {
+        mj_stage_stats stats;
+        mj_pipeline_stats(pipeline, s, &stats);
+        fprintf(out, "%-16s %12llu %12.0f %10.1f %12.1f %12llu %12llu %8zu\n", pipeline->stages[s].name, (unsigned long long)stats.items_in,
+                (double)stats.items_in / seconds, stats.batches ? (double)stats.items_in / (double)stats.batches : 0.0, (double)stats.run_ns / 1e6,
+                (unsigned long long)stats.input_waits, (unsigned long long)stats.output_waits, stats.queue_depth);
+    }
+}
@@ -0,0 +1,87 @@
+/* --------------------------------------------------------------------
+ * mj_pipeline.h
+ *
+ * Linear dataflow pipelines: stage functions run as tasks, connected by bounded channels, items move in batches.
+ *
+ * Example usage:
+ *   void parse(mj_scheduler* s, mj_stage* stage, void** items, size_t count, void* user) {
+ *       for (size_t i = 0; i < count; i++) mj_stage_emit(stage, parse_line(items[i]));
+ *   }
+ *
+ *   mj_pipeline* p = mj_pipeline_create(schedulers[0], 64, 1024);  // batches of 64, channels of 1024
+ *   mj_pipeline_add_stage(p, "parse", parse, NULL);
+ *   mj_pipeline_add_stage(p, "enrich", enrich, &db);
+ *   mj_pipeline_add_stage(p, "emit", emit, out);          // last stage is the sink, it emits nothing
+ *   mj_pipeline_start(p, schedulers, core_count);         // one lane of every stage per scheduler
+ *
+ *   // producer task on lane i's scheduler
+ *   mj_channel_send_batch(mj_pipeline_input(p, i), lines, n);  // park on mj_channel_send_queue when full
+ *   mj_channel_close(mj_pipeline_input(p, i));                 // at end of input, the lane drains and exits
+ *
+ * Every lane is a full copy of the pipeline on one scheduler, so items never cross threads inside a pipeline,
+ * shard the input over the lanes instead. A stage task only runs when its input channel has items and its
+ * output channel has room, otherwise it parks on the channel. Each run takes up to one batch from the input,
+ * calls the stage function once with it and pushes everything it emitted downstream in one go. When a lane's
+ * input is closed and drained each stage closes its output, and the tasks remove themselves.
+ *
+ * Stage functions run inside a task callback but must not park, emitted items are buffered until the stage
+ * function returns. A lane runs one task per stage: with nothing parking, extra copies of a stage on the same
+ * scheduler would only take turns, so more throughput for a slow stage comes from more lanes. Items are passed by pointer and never copied or freed by the pipeline.
+ *
+ * mj_pipeline_stats / mj_pipeline_write_stats show per stage throughput, queue depth and how often the
+ * stage waited for input or for room downstream: the bottleneck is the stage with a full input channel whose
+ * successor keeps waiting for input.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "mj_channel.h"
+#include <stdio.h>
+
+#define MJ_PIPELINE_MAX_STAGES 16
+
+typedef struct mj_pipeline mj_pipeline;
+typedef struct mj_stage mj_stage;
+
+typedef void (*mj_stage_fn)(mj_scheduler* scheduler, mj_stage* stage, void** items, size_t count, void* user);
+
+typedef struct mj_stage_stats {
+    uint64_t items_in;
+    uint64_t items_out;
+    uint64_t batches;      // stage function calls
+    uint64_t run_ns;       // time spent in the stage function
+    uint64_t input_waits;  // parks on an empty input channel
+    uint64_t output_waits; // parks on a full output channel
+    size_t queue_depth;    // items in the stage's input channels when each lane last looked
+} mj_stage_stats;
+
+// scheduler provides the allocator for the pipeline, its channels and stage tasks, and must outlive the pipeline.
+// Lanes' schedulers must share that allocator, like any schedulers exchanging tasks.
+mj_pipeline* mj_pipeline_create(mj_scheduler* scheduler, size_t batch, size_t channel_capacity);
+// return 1 with EBUSY while stage tasks are running or other tasks are parked on a lane's input channel,
+// items still queued are not freed
+int mj_pipeline_destroy(mj_pipeline** pipeline);
+
+// Only before start. name must outlive the pipeline, it also names the stage tasks.
+// return the stage index, -1 with ENOSPC past MJ_PIPELINE_MAX_STAGES or EBUSY once started
+int mj_pipeline_add_stage(mj_pipeline* pipeline, const char* name, mj_stage_fn fn, void* user);
+
+// Posts the stage tasks of lane i to schedulers[i], safe to call while the schedulers run.
+// Nothing is posted if it fails.
+int mj_pipeline_start(mj_pipeline* pipeline, mj_scheduler** schedulers, size_t lanes);
+
+// Input channel of a lane, fed and closed by tasks on that lane's scheduler
+mj_channel* mj_pipeline_input(mj_pipeline* pipeline, size_t lane);
+// true once every stage task of every lane has exited
+bool mj_pipeline_done(const mj_pipeline* pipeline);
+
+// Only from a stage function. Queues item for the next stage.
+// return -1 with EINVAL from the last stage, ENOMEM if the emit buffer can not grow
+int mj_stage_emit(mj_stage* stage, void* item);
+size_t mj_stage_lane(const mj_stage* stage);
+size_t mj_stage_index(const mj_stage* stage);
+
+// Safe from any thread, sums the lanes. Counters are read one by one, not as a consistent snapshot.
+int mj_pipeline_stats(const mj_pipeline* pipeline, size_t stage, mj_stage_stats* stats);
+// One line per stage with items/s since start, wait counts and queue depth
+void mj_pipeline_write_stats(const mj_pipeline* pipeline, FILE* out);
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE // SIGEV_THREAD_ID
+#include "mj_preempt.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc only added the name in 2.36, before that the field is reachable through the union it aliases
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static __thread timer_t mj_preempt_timer;
+static __thread bool mj_preempt_armed = false;
+static __thread uint64_t mj_preempt_seen = 0;     // run count at the previous tick
+static __thread uint64_t mj_preempt_flagged = 0;  // atomic, run count of the run found overrunning
+static __thread uint64_t mj_preempt_overrun_count = 0;
+
+static pthread_mutex_t mj_preempt_lock = PTHREAD_MUTEX_INITIALIZER; // serialises install and uninstall
+static size_t mj_preempt_threads = 0; // threads with a timer, the handler is installed while > 0
+static struct sigaction mj_preempt_old_action;
+
+static void mj_preempt_signal(int sig, siginfo_t* info, void* context) {
+    if (info->si_code != SI_TIMER) {
+        // Not ours, hand it to whoever had the signal before
+        if (mj_preempt_old_action.sa_flags & SA_SIGINFO) {
+            mj_preempt_old_action.sa_sigaction(sig, info, context);
+        } else if (mj_preempt_old_action.sa_handler != SIG_DFL && mj_preempt_old_action.sa_handler != SIG_IGN) {
+            mj_preempt_old_action.sa_handler(sig);
+        }
+        return;
+    }
+
+    uint64_t runs = mj_thread_run_count();
+    if (mj_thread_running_task(NULL, NULL) && runs == mj_preempt_seen && __atomic_load_n(&mj_preempt_flagged, __ATOMIC_RELAXED) != runs) {
+        __atomic_store_n(&mj_preempt_flagged, runs, __ATOMIC_RELAXED);
+        mj_preempt_overrun_count++;
+    }
+    mj_preempt_seen = runs;
+}
+
+// The count only goes up once the handler is in place, a second thread never arms its timer before that
+static int mj_preempt_install(void) {
+    pthread_mutex_lock(&mj_preempt_lock);
+    if (mj_preempt_threads == 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = mj_preempt_signal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(MJ_PREEMPT_SIGNAL, &action, &mj_preempt_old_action) != 0) {
+            int error = errno;
+            pthread_mutex_unlock(&mj_preempt_lock);
+            errno = error;
+            return -1;
+        }
+    }
+    mj_preempt_threads++;
+    pthread_mutex_unlock(&mj_preempt_lock);
+    return 0;
+}
+
+static void mj_preempt_uninstall(void) {
+    pthread_mutex_lock(&mj_preempt_lock);
+    if (--mj_preempt_threads == 0) {
+        sigaction(MJ_PREEMPT_SIGNAL, &mj_preempt_old_action, NULL);
+    }
+    pthread_mutex_unlock(&mj_preempt_lock);
+}
+
+int mj_preempt_start(uint64_t slice_ns) {
+    if (slice_ns == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!mj_preempt_armed) {
+        if (mj_preempt_install() != 0) {
+            return -1;
+        }
+
+        // Ticks of the thread's own CPU clock, delivered to the thread itself
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = MJ_PREEMPT_SIGNAL;
+        event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &mj_preempt_timer) != 0) {
+            int error = errno;
+            mj_preempt_uninstall();
+            errno = error;
+            return -1;
+        }
+        mj_preempt_armed = true;
+    }
+
+    struct itimerspec interval;
+    interval.it_interval.tv_sec = (time_t)(slice_ns / 1000000000u);
+    interval.it_interval.tv_nsec = (long)(slice_ns % 1000000000u);
+    interval.it_value = interval.it_interval;
+    if (timer_settime(mj_preempt_timer, 0, &interval, NULL) != 0) {
+        int error = errno;
+        mj_preempt_stop();
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void mj_preempt_stop(void) {
+    if (!mj_preempt_armed) {
+        return;
+    }
+
+    timer_delete(mj_preempt_timer);
+    mj_preempt_armed = false;
+    mj_preempt_uninstall();
+}
+
+bool mj_preempt_should_yield(void) {
+    uint64_t flagged = __atomic_load_n(&mj_preempt_flagged, __ATOMIC_RELAXED);
+    return flagged != 0 && flagged == mj_thread_run_count();
+}
+
+uint64_t mj_preempt_overruns(void) {
+    return mj_preempt_overrun_count;
+}
@@ -0,0 +1,48 @@
+/* --------------------------------------------------------------------
+ * mj_preempt.h
+ *
+ * Time-slice watchdog for task callbacks that run too long.
+ *
+ * Example usage, on the thread that runs the scheduler:
+ *   mj_preempt_start(2000000);   // flag runs that take more than 2 ms of CPU
+ *   mj_scheduler_run(scheduler);
+ *   mj_preempt_stop();
+ *
+ *   // in a long loop inside a run callback, a safe point
+ *   for (; ctx->next < ctx->count; ctx->next++) {
+ *       if (mj_preempt_should_yield()) return;   // picks up at ctx->next next pass
+ *       process(ctx->items[ctx->next]);
+ *   }
+ *
+ * Scheduling is cooperative and tasks are plain callbacks, there is no stack to switch away from, so a
+ * runaway run can not be forced back into mj_scheduler_run. Instead, a per-thread CPU-time interval timer
+ * sends MJ_PREEMPT_SIGNAL to the scheduler thread every slice. The handler compares the run count
+ * (mj_thread_run_count) with the one it saw on the previous tick, and when one task run spans both it
+ * flags that run as overrun. Tasks poll the flag at their safe points for the price of two thread-local
+ * loads and return, the flag clears itself when the next run starts. A run is flagged between one and two
+ * slices after it started.
+ *
+ * The timer counts the thread's CPU time, so it does not tick while the scheduler sleeps in poll().
+ * SIGURG is ignored by default and rarely used otherwise, other SIGURGs are passed to the handler that was
+ * installed before. Linux only, the signal is directed at the thread with SIGEV_THREAD_ID.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+#include <signal.h>
+
+#ifndef MJ_PREEMPT_SIGNAL
+#define MJ_PREEMPT_SIGNAL SIGURG
+#endif
+
+// Starts flagging runs on the calling thread that take longer than slice_ns of CPU time. Calling it again
+// changes the slice. return -1 with EINVAL for a slice of 0.
+int mj_preempt_start(uint64_t slice_ns);
+// Stops the calling thread's timer
+void mj_preempt_stop(void);
+
+// Only meaningful from within a task callback: true once the current run has used up its slice
+bool mj_preempt_should_yield(void);
+// Runs flagged on the calling thread so far
+uint64_t mj_preempt_overruns(void);
@@ -0,0 +1,52 @@
+/* --------------------------------------------------------------------
+ * mj_probes.h
+ *
+ * USDT (sys/sdt.h) static probes at the scheduler's hot points, provider "majjen". Each probe compiles to
+ * a single nop plus an ELF note, tools like bpftrace or perf turn it into a breakpoint only while they are
+ * attached, so the probes stay compiled into production builds.
+ *
+ * Example, scheduling delay from wake-up to run and run-time per task type:
+ *   bpftrace -e 'usdt:./app:majjen:task__wake { @woke[arg1] = nsecs; }
+ *                usdt:./app:majjen:task__run__begin /@woke[arg1]/ { @delay_ns = hist(nsecs - @woke[arg1]); delete(@woke[arg1]); }
+ *                usdt:./app:majjen:task__run__begin { @start[tid] = nsecs; }
+ *                usdt:./app:majjen:task__run__end /@start[tid]/ { @run_ns[str(arg2)] = hist(nsecs - @start[tid]); delete(@start[tid]); }'
+ *
+ * Probes and arguments (scheduler is always arg0, task ids are mj_task_id):
+ *   task__add        scheduler, task id, name        task added or posted
+ *   task__remove     scheduler, task id, name        mj_scheduler_task_remove_current
+ *   task__migrate    scheduler, task id, target      mj_scheduler_task_migrate_current
+ *   task__run__begin scheduler, task id, name
+ *   task__run__end   scheduler, task id, name        task id is 0 if the task removed or migrated itself
+ *   task__batch__begin scheduler, count, name        run_batch over count tasks of one type
+ *   task__batch__end   scheduler, count, name
+ *   task__wait       scheduler, task id, deadline_ns every park, fd waits fire task__wait__fd right after
+ *   task__wait__fd   scheduler, task id, fd, events, deadline_ns
+ *   task__wake       scheduler, task id, result      0, ETIMEDOUT or ECANCELED
+ *   timer__fire      scheduler, timer, deadline_ns
+ *   poll__begin      scheduler, fd count, timeout_ms
+ *   poll__end        scheduler, ready count
+ *
+ * Enabled whenever <sys/sdt.h> is available (systemtap-sdt-dev / systemtap-sdt-devel), build with
+ * MJ_NO_USDT defined (make USDT=0) to leave them out entirely.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#if !defined(MJ_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MJ_USDT 1
+#endif
+#endif
+
+#ifdef MJ_USDT
+#define MJ_PROBE1(name, a) DTRACE_PROBE1(majjen, name, a)
+#define MJ_PROBE2(name, a, b) DTRACE_PROBE2(majjen, name, a, b)
+#define MJ_PROBE3(name, a, b, c) DTRACE_PROBE3(majjen, name, a, b, c)
+#define MJ_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(majjen, name, a, b, c, d, e)
+#else
+#define MJ_PROBE1(name, a) ((void)0)
+#define MJ_PROBE2(name, a, b) ((void)0)
+#define MJ_PROBE3(name, a, b, c) ((void)0)
+#define MJ_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
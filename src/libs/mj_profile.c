@@ -0,0 +1,239 @@
+#define _GNU_SOURCE // dladdr
+#include "mj_profile.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define MJ_PROFILE_SKIP 2 // the signal handler and the kernel's signal trampoline
+
+typedef struct mj_profile_sample {
+    int ready; // atomic, set once the handler has filled in the record
+    int depth;
+    uint64_t task_id;
+    const char* task_name;
+    void* frames[MJ_PROFILE_MAX_DEPTH]; // innermost first
+} mj_profile_sample;
+
+static mj_profile_sample* mj_profile_samples = NULL;
+static size_t mj_profile_capacity = 0;
+static size_t mj_profile_next = 0;    // atomic, next free slot, keeps counting past capacity
+static size_t mj_profile_dropped = 0; // atomic
+static bool mj_profile_running = false;
+static struct sigaction mj_profile_old_action;
+
+static void mj_profile_signal(int sig) {
+    int saved_errno = errno;
+
+    size_t index = __atomic_fetch_add(&mj_profile_next, 1, __ATOMIC_RELAXED);
+    if (index >= mj_profile_capacity) {
+        __atomic_add_fetch(&mj_profile_dropped, 1, __ATOMIC_RELAXED);
+        errno = saved_errno;
+        return;
+    }
+
+    mj_profile_sample* sample = &mj_profile_samples[index];
+    mj_thread_running_task(&sample->task_id, &sample->task_name);
+    sample->depth = backtrace(sample->frames, MJ_PROFILE_MAX_DEPTH);
+    __atomic_store_n(&sample->ready, 1, __ATOMIC_RELEASE);
+
+    errno = saved_errno;
+}
+
+int mj_profiler_start(unsigned int hz, size_t max_samples) {
+    if (hz == 0 || hz > 1000000) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mj_profile_running) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (max_samples == 0) {
+        max_samples = (size_t)hz * 60;
+    }
+    mj_profiler_discard();
+    mj_profile_samples = calloc(max_samples, sizeof(*mj_profile_samples));
+    if (mj_profile_samples == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    mj_profile_capacity = max_samples;
+    mj_profile_next = 0;
+    mj_profile_dropped = 0;
+
+    // The first backtrace() loads the unwinder, which allocates, get that done outside of the handler
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = mj_profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &mj_profile_old_action) != 0) {
+        int error = errno;
+        mj_profiler_discard();
+        errno = error;
+        return -1;
+    }
+
+    // tv_usec must stay below a second, 1 Hz is a whole second
+    struct itimerval interval;
+    interval.it_interval.tv_sec = (time_t)(1 / hz);
+    interval.it_interval.tv_usec = (suseconds_t)(1000000 / hz % 1000000);
+    interval.it_value = interval.it_interval;
+    if (setitimer(ITIMER_PROF, &interval, NULL) != 0) {
+        int error = errno;
+        sigaction(SIGPROF, &mj_profile_old_action, NULL);
+        mj_profiler_discard();
+        errno = error;
+        return -1;
+    }
+
+    mj_profile_running = true;
+    return 0;
+}
+
+int mj_profiler_stop(void) {
+    if (!mj_profile_running) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+    sigaction(SIGPROF, &mj_profile_old_action, NULL);
+    mj_profile_running = false;
+    return 0;
+}
+
+void mj_profiler_stats(size_t* samples, size_t* dropped) {
+    size_t next = __atomic_load_n(&mj_profile_next, __ATOMIC_RELAXED);
+    size_t lost = __atomic_load_n(&mj_profile_dropped, __ATOMIC_RELAXED);
+    if (samples) {
+        *samples = next - lost;
+    }
+    if (dropped) {
+        *dropped = lost;
+    }
+}
+
+void mj_profiler_discard(void) {
+    if (mj_profile_running) {
+        return;
+    }
+
+    free(mj_profile_samples);
+    mj_profile_samples = NULL;
+    mj_profile_capacity = 0;
+    mj_profile_next = 0;
+    mj_profile_dropped = 0;
+}
+
+// Sort order for grouping identical stacks, set before qsort
+static bool mj_profile_by_task = false;
+
+static int mj_profile_compare(const void* a, const void* b) {
+    const mj_profile_sample* x = *(mj_profile_sample* const*)a;
+    const mj_profile_sample* y = *(mj_profile_sample* const*)b;
+
+    const char* xn = x->task_name ? x->task_name : "";
+    const char* yn = y->task_name ? y->task_name : "";
+    int order = strcmp(xn, yn);
+    if (order != 0) {
+        return order;
+    }
+    if ((x->task_id != 0) != (y->task_id != 0)) {
+        return x->task_id != 0 ? 1 : -1; // samples outside of tasks first
+    }
+    if (mj_profile_by_task && x->task_id != y->task_id) {
+        return x->task_id < y->task_id ? -1 : 1;
+    }
+    if (x->depth != y->depth) {
+        return x->depth < y->depth ? -1 : 1;
+    }
+    return memcmp(x->frames, y->frames, (size_t)x->depth * sizeof(void*));
+}
+
+static void mj_profile_write_frame(FILE* out, void* pc) {
+    Dl_info info;
+    if (dladdr(pc, &info) && info.dli_sname) {
+        fprintf(out, ";%s", info.dli_sname);
+    } else {
+        fprintf(out, ";%p", pc);
+    }
+}
+
+static void mj_profile_write_stack(FILE* out, const mj_profile_sample* sample, bool per_task, size_t count) {
+    if (sample->task_id == 0) {
+        fputs("[scheduler]", out);
+    } else {
+        fputs(sample->task_name ? sample->task_name : "task", out);
+        if (per_task) {
+            fprintf(out, "#%llu", (unsigned long long)sample->task_id);
+        }
+    }
+    for (int i = sample->depth - 1; i >= MJ_PROFILE_SKIP; i--) {
+        mj_profile_write_frame(out, sample->frames[i]);
+    }
+    fprintf(out, " %zu\n", count);
+}
+
+int mj_profiler_write_folded(FILE* out, bool per_task) {
+    if (out == NULL || mj_profile_running) {
+        errno = mj_profile_running ? EBUSY : EINVAL;
+        return -1;
+    }
+
+    size_t count = __atomic_load_n(&mj_profile_next, __ATOMIC_ACQUIRE);
+    if (count > mj_profile_capacity) {
+        count = mj_profile_capacity;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    mj_profile_sample** sorted = malloc(count * sizeof(*sorted));
+    if (sorted == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Return addresses differ from line to line, fold every frame to the start of its function so all
+    // samples in the same call path compare equal
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        mj_profile_sample* sample = &mj_profile_samples[i];
+        if (!__atomic_load_n(&sample->ready, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        for (int j = MJ_PROFILE_SKIP; j < sample->depth; j++) {
+            Dl_info info;
+            if (dladdr(sample->frames[j], &info) && info.dli_saddr) {
+                sample->frames[j] = info.dli_saddr;
+            }
+        }
+        sorted[n++] = sample;
+    }
+
+    mj_profile_by_task = per_task;
+    qsort(sorted, n, sizeof(*sorted), mj_profile_compare);
+
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        run++;
+        if (i + 1 == n || mj_profile_compare(&sorted[i], &sorted[i + 1]) != 0) {
+            mj_profile_write_stack(out, sorted[i], per_task, run);
+            run = 0;
+        }
+    }
+
+    free(sorted);
+    return ferror(out) ? -1 : 0;
+}
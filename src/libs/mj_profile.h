@@ -0,0 +1,47 @@
+/* --------------------------------------------------------------------
+ * mj_profile.h
+ *
+ * Sampling CPU profiler that knows which task a sample was taken in.
+ *
+ * Example usage:
+ *   mj_profiler_start(1000, 0);          // 1 kHz, default buffer
+ *   mj_scheduler_run(scheduler);
+ *   mj_profiler_stop();
+ *   FILE* out = fopen("app.folded", "w");
+ *   mj_profiler_write_folded(out, false); // then: flamegraph.pl app.folded > app.svg
+ *   fclose(out);
+ *
+ * A CPU-time interval timer (ITIMER_PROF) delivers SIGPROF to whichever thread is burning CPU, so one
+ * profiler covers every per-core scheduler in the process. The handler records the running task's id and
+ * name (mj_thread_running_task) and a backtrace into a preallocated buffer, claiming slots with a single
+ * atomic increment, no locks and no allocation. Samples taken outside of a task callback are filed under
+ * "[scheduler]".
+ *
+ * Folded output puts the task name as the root frame, so flame graphs split by task type first. Frames are
+ * named with dladdr(), link with -rdynamic to get names for non-static functions. Static functions show up
+ * under the closest exported symbol before them, or as a raw address.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+#include <stdio.h>
+
+#ifndef MJ_PROFILE_MAX_DEPTH
+#define MJ_PROFILE_MAX_DEPTH 32
+#endif
+
+// Process-wide, only one profiler runs at a time. Discards the samples of an earlier run.
+// max_samples 0 keeps one minute at hz. return -1 with EBUSY if already running.
+int mj_profiler_start(unsigned int hz, size_t max_samples);
+// Stops sampling, the samples are kept for mj_profiler_write_folded
+int mj_profiler_stop(void);
+
+// One line per distinct stack: "task;outermost;...;innermost count". per_task splits task types into
+// instances, "name#id". Call after mj_profiler_stop.
+int mj_profiler_write_folded(FILE* out, bool per_task);
+
+// Samples recorded and samples lost because the buffer was full
+void mj_profiler_stats(size_t* samples, size_t* dropped);
+// Frees the sample buffer
+void mj_profiler_discard(void);
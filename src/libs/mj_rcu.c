@@ -0,0 +1,102 @@
+#include "mj_rcu.h"
+#include <errno.h>
+#include <string.h>
+
+// A replaced snapshot, waiting in the publishing scheduler's retire list for every reader to move on
+typedef struct mj_rcu_retired {
+    mj_retired retired; // first, the retire callback gets a pointer to it
+    void* snapshot;
+    mj_rcu_cell* cell;
+} mj_rcu_retired;
+
+struct mj_rcu_cell {
+    void* current; // atomic
+    mj_rcu_free_fn free_fn;
+    void* user;
+    mj_allocator allocator; // copied, retired snapshots may be freed while the scheduler is destroyed
+    size_t retired_count; // atomic, snapshots retired but not freed yet
+};
+
+mj_rcu_cell* mj_rcu_create(mj_scheduler* scheduler, void* initial, mj_rcu_free_fn free_fn, void* user) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_rcu_cell* cell = allocator->alloc(allocator->user, sizeof(*cell));
+    if (cell == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(cell, 0, sizeof(*cell));
+
+    cell->current = initial;
+    cell->free_fn = free_fn;
+    cell->user = user;
+    cell->allocator = *allocator;
+    return cell;
+}
+
+static void mj_rcu_free_snapshot(mj_rcu_cell* cell, void* snapshot) {
+    if (snapshot && cell->free_fn) {
+        cell->free_fn(snapshot, cell->user);
+    }
+}
+
+int mj_rcu_destroy(mj_rcu_cell** cell) {
+    if (cell == NULL || *cell == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_rcu_cell* c = *cell;
+    if (__atomic_load_n(&c->retired_count, __ATOMIC_ACQUIRE) > 0) {
+        errno = EBUSY;
+        return 1;
+    }
+    mj_rcu_free_snapshot(c, c->current);
+
+    c->allocator.free(c->allocator.user, c, sizeof(*c));
+    *cell = NULL;
+    return 0;
+}
+
+void* mj_rcu_read(const mj_rcu_cell* cell) {
+    return cell ? __atomic_load_n(&cell->current, __ATOMIC_ACQUIRE) : NULL;
+}
+
+// Retire callback, runs on the publishing scheduler's thread once no reader can see the snapshot
+static void mj_rcu_reclaim(mj_scheduler* scheduler, mj_retired* node) {
+    mj_rcu_retired* retired = (mj_rcu_retired*)node;
+    mj_rcu_cell* cell = retired->cell;
+
+    mj_rcu_free_snapshot(cell, retired->snapshot);
+    cell->allocator.free(cell->allocator.user, retired, sizeof(*retired));
+    __atomic_sub_fetch(&cell->retired_count, 1, __ATOMIC_RELEASE); // last access, destroy may go ahead after this
+}
+
+int mj_rcu_publish(mj_scheduler* scheduler, mj_rcu_cell* cell, void* snapshot) {
+    if (scheduler == NULL || cell == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Allocate first, a failed publish leaves the old snapshot in place
+    mj_rcu_retired* retired = cell->allocator.alloc(cell->allocator.user, sizeof(*retired));
+    if (retired == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    retired->cell = cell;
+    __atomic_add_fetch(&cell->retired_count, 1, __ATOMIC_RELAXED);
+    // Retired after the swap, readers announcing a later epoch can not see the old snapshot
+    retired->snapshot = __atomic_exchange_n(&cell->current, snapshot, __ATOMIC_SEQ_CST);
+    mj_scheduler_retire(scheduler, &retired->retired, mj_rcu_reclaim);
+    return 0;
+}
+
+size_t mj_rcu_pending(const mj_rcu_cell* cell) {
+    return cell ? __atomic_load_n(&cell->retired_count, __ATOMIC_ACQUIRE) : 0;
+}
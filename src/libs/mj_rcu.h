@@ -0,0 +1,48 @@
+/* --------------------------------------------------------------------
+ * mj_rcu.h
+ *
+ * Read-mostly shared data (routing tables, config) for thread-per-core schedulers, RCU style.
+ *
+ * Example usage:
+ *   // startup
+ *   mj_rcu_cell* routes = mj_rcu_create(scheduler, load_routes(), free_routes, NULL);
+ *
+ *   // inside any task callback, on any scheduler thread
+ *   const route_table* table = mj_rcu_read(routes);  // plain pointer load, no locks, no atomics RMW
+ *
+ *   // task callback, when the routes change
+ *   mj_rcu_publish(scheduler, routes, load_routes());
+ *
+ * Snapshots are immutable once published. Publishing swaps the pointer atomically, readers pick up the new
+ * snapshot on their next read. The old snapshot is retired with mj_scheduler_retire on the publishing
+ * scheduler and freed by its run loop once every scheduler has passed a quiescent point (the top of its loop)
+ * since the swap, the same epoch reclamation that frees removed tasks. Nothing has to poll for it.
+ * A pointer returned by mj_rcu_read stays valid until the current task callback returns, do not keep it in
+ * ctx across runs. Threads that are not running a scheduler read between mj_epoch_enter and mj_epoch_exit.
+ *
+ * Publishing is meant for one writer at a time, serialise concurrent publishers. A thread that does not run a
+ * scheduler publishes through a task handed over with mj_scheduler_task_post.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+typedef struct mj_rcu_cell mj_rcu_cell;
+
+// Called with the user pointer given at create, once no reader can see the snapshot any more
+typedef void (*mj_rcu_free_fn)(void* snapshot, void* user);
+
+// scheduler is only used for its allocator, which is copied. The cell can be read from every scheduler.
+mj_rcu_cell* mj_rcu_create(mj_scheduler* scheduler, void* initial, mj_rcu_free_fn free_fn, void* user);
+// Frees the current snapshot, only once no thread reads the cell any more.
+// return 1 with EBUSY while retired snapshots are still waiting to be freed (see mj_rcu_pending)
+int mj_rcu_destroy(mj_rcu_cell** cell);
+
+void* mj_rcu_read(const mj_rcu_cell* cell);
+
+// Only usable from within a task callback. Swaps in snapshot and retires the previous one on scheduler,
+// whose run loop frees it once no reader can see it any more.
+int mj_rcu_publish(mj_scheduler* scheduler, mj_rcu_cell* cell, void* snapshot);
+// Safe from any thread. Retired snapshots not freed yet, destroy fails while this is not 0.
+size_t mj_rcu_pending(const mj_rcu_cell* cell);
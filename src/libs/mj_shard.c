@@ -0,0 +1,440 @@
+#include "mj_shard.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MJ_SHARD_CACHE_LINE 64
+
+typedef struct mj_shard_msg {
+    mj_shard_fn fn;
+    void* arg;
+    mj_future* future; // NULL for fire-and-forget
+} mj_shard_msg;
+
+// Single-producer single-consumer ring from one core to another. The consumer, producer and shared indices
+// sit on separate cache lines. The producer keeps private copies of what it has written, published and last
+// seen consumed, so it only touches the shared lines when publishing a batch or when the ring looks full.
+typedef struct mj_shard_ring {
+    mj_shard_msg* slots; // read only after create
+    char pad0[MJ_SHARD_CACHE_LINE - sizeof(mj_shard_msg*)];
+    size_t head; // atomic, written by the consumer
+    char pad1[MJ_SHARD_CACHE_LINE - sizeof(size_t)];
+    size_t tail; // atomic, written by the producer when it publishes
+    char pad2[MJ_SHARD_CACHE_LINE - sizeof(size_t)];
+    size_t staged;      // producer private, written up to here
+    size_t published;   // producer private, last tail stored
+    size_t cached_head; // producer private, head as last read
+    char pad3[MJ_SHARD_CACHE_LINE - 3 * sizeof(size_t)];
+} mj_shard_ring;
+
+// Written by other cores, so each core gets its own cache line. The alignment rounds the size up to a whole
+// line, whatever padding the compiler puts between the fields.
+typedef struct __attribute__((aligned(MJ_SHARD_CACHE_LINE))) mj_shard_core {
+    mj_scheduler* scheduler;
+    mj_future* completed; // atomic, lock-free stack of futures finished on other cores
+    int wake_fds[2];      // the shard task parks on the read end
+    int wake_signalled;   // atomic, 1 while a wake byte is pending
+    mj_task* task;        // shard task, until it is posted
+} mj_shard_core;
+
+struct mj_shard_group {
+    const mj_allocator* allocator;
+    size_t count;
+    size_t mask; // ring capacity - 1
+    int stopping; // atomic
+    size_t active; // atomic, shard tasks that have not removed themselves yet
+    mj_shard_core* cores;
+    mj_shard_ring* rings; // rings[from * count + to]
+    mj_shard_msg* slots;
+    void* block; // cores and rings, over-allocated so they start on a cache line
+    size_t block_size;
+};
+
+// Context of a shard task, the scheduler frees it when the task removes itself
+typedef struct mj_shard_task_ctx {
+    mj_shard_group* group;
+    size_t index;
+} mj_shard_task_ctx;
+
+static size_t mj_shard_core_index(const mj_shard_group* group, const mj_scheduler* scheduler) {
+    for (size_t i = 0; i < group->count; i++) {
+        if (group->cores[i].scheduler == scheduler) {
+            return i;
+        }
+    }
+    return group->count;
+}
+
+static void mj_shard_wake(mj_shard_core* core) {
+    // Same protocol as the scheduler's own wake pipe, one pending byte is enough
+    if (__atomic_exchange_n(&core->wake_signalled, 1, __ATOMIC_SEQ_CST) == 0) {
+        char byte = 0;
+        ssize_t written = write(core->wake_fds[1], &byte, 1);
+        (void)written;
+    }
+}
+
+static void mj_shard_publish(mj_shard_group* group, mj_shard_ring* ring, size_t to) {
+    if (ring->staged == ring->published) {
+        return;
+    }
+    ring->published = ring->staged;
+    __atomic_store_n(&ring->tail, ring->staged, __ATOMIC_SEQ_CST);
+    mj_shard_wake(&group->cores[to]);
+}
+
+static void mj_shard_flush_core(mj_shard_group* group, size_t from) {
+    for (size_t to = 0; to < group->count; to++) {
+        if (to != from) {
+            mj_shard_publish(group, &group->rings[from * group->count + to], to);
+        }
+    }
+}
+
+static void mj_future_complete(mj_future* future, void* result) {
+    future->result = result;
+    future->ready = true;
+    mj_wait_queue_wake_all(&future->waiters);
+}
+
+// Runs everything published from one core and sends the finished futures back in a single push
+static void mj_shard_drain(mj_shard_group* group, mj_scheduler* scheduler, size_t from, size_t to) {
+    mj_shard_ring* ring = &group->rings[from * group->count + to];
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    if (head == tail) {
+        return;
+    }
+
+    mj_future* first = NULL;
+    mj_future* last = NULL;
+    for (; head != tail; head++) {
+        // Copy out, fn may submit more work and the slot is the producer's again once head moves
+        mj_shard_msg msg = ring->slots[head & group->mask];
+        void* result = msg.fn(scheduler, msg.arg);
+        if (msg.future) {
+            msg.future->result = result;
+            msg.future->next = first;
+            first = msg.future;
+            if (last == NULL) {
+                last = msg.future;
+            }
+        }
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    if (first) {
+        mj_shard_core* origin = &group->cores[from];
+        mj_future* stack = __atomic_load_n(&origin->completed, __ATOMIC_RELAXED);
+        do {
+            last->next = stack;
+        } while (!__atomic_compare_exchange_n(&origin->completed, &stack, first, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        mj_shard_wake(origin);
+    }
+}
+
+static void mj_shard_task_run(mj_scheduler* scheduler, void* ctx) {
+    mj_shard_group* group = ((mj_shard_task_ctx*)ctx)->group;
+    size_t index = ((mj_shard_task_ctx*)ctx)->index;
+    mj_shard_core* core = &group->cores[index];
+
+    // Read before draining, everything published before the group was stopped is then visible below
+    bool stopping = __atomic_load_n(&group->stopping, __ATOMIC_ACQUIRE);
+
+    // Re-arm the wake signal before looking at the rings, anything published from here on writes a new byte
+    char buf[64];
+    while (read(core->wake_fds[0], buf, sizeof(buf)) > 0) {
+    }
+    __atomic_store_n(&core->wake_signalled, 0, __ATOMIC_SEQ_CST);
+
+    mj_future* completed = __atomic_exchange_n(&core->completed, NULL, __ATOMIC_SEQ_CST);
+    while (completed) {
+        mj_future* next = completed->next;
+        completed->next = NULL;
+        mj_future_complete(completed, completed->result);
+        completed = next;
+    }
+
+    for (size_t from = 0; from < group->count; from++) {
+        if (from != index) {
+            mj_shard_drain(group, scheduler, from, index);
+        }
+    }
+
+    // Submissions made by the work itself, and anything tasks on this core staged without flushing
+    mj_shard_flush_core(group, index);
+
+    if (stopping) {
+        __atomic_sub_fetch(&group->active, 1, __ATOMIC_ACQ_REL);
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    mj_scheduler_task_wait_fd(scheduler, core->wake_fds[0], POLLIN, 0, NULL);
+}
+
+static void mj_shard_free(mj_shard_group* group) {
+    const mj_allocator* allocator = group->allocator;
+    if (group->cores) {
+        for (size_t i = 0; i < group->count; i++) {
+            mj_shard_core* core = &group->cores[i];
+            for (int j = 0; j < 2; j++) {
+                if (core->wake_fds[j] >= 0) {
+                    close(core->wake_fds[j]);
+                }
+            }
+            if (core->task) {
+                if (core->task->ctx) {
+                    allocator->free(allocator->user, core->task->ctx, sizeof(mj_shard_task_ctx));
+                }
+                allocator->free(allocator->user, core->task, sizeof(mj_task));
+            }
+        }
+    }
+    if (group->slots) {
+        allocator->free(allocator->user, group->slots, group->count * group->count * (group->mask + 1) * sizeof(mj_shard_msg));
+    }
+    if (group->block) {
+        allocator->free(allocator->user, group->block, group->block_size);
+    }
+    allocator->free(allocator->user, group, sizeof(*group));
+}
+
+static mj_task* mj_shard_task_create(mj_shard_group* group, size_t index) {
+    const mj_allocator* allocator = group->allocator;
+    mj_task* task = allocator->alloc(allocator->user, sizeof(*task));
+    if (task == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(task, 0, sizeof(*task));
+
+    mj_shard_task_ctx* ctx = allocator->alloc(allocator->user, sizeof(*ctx));
+    if (ctx == NULL) {
+        allocator->free(allocator->user, task, sizeof(*task));
+        errno = ENOMEM;
+        return NULL;
+    }
+    ctx->group = group;
+    ctx->index = index;
+    task->run = mj_shard_task_run;
+    task->name = "mj_shard";
+    task->ctx = ctx;
+    task->ctx_size = sizeof(*ctx);
+    return task;
+}
+
+mj_shard_group* mj_shard_group_create(mj_scheduler** schedulers, size_t count, size_t ring_capacity) {
+    if (schedulers == NULL || count == 0 || ring_capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (schedulers[i] == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(schedulers[0]);
+    mj_shard_group* group = allocator->alloc(allocator->user, sizeof(*group));
+    if (group == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(group, 0, sizeof(*group));
+    group->allocator = allocator;
+    group->count = count;
+
+    size_t capacity = 2;
+    while (capacity < ring_capacity) {
+        capacity *= 2;
+    }
+    group->mask = capacity - 1;
+
+    // Rings start on the line after the last core
+    size_t cores_size = (count * sizeof(mj_shard_core) + MJ_SHARD_CACHE_LINE - 1) & ~(size_t)(MJ_SHARD_CACHE_LINE - 1);
+    group->block_size = cores_size + count * count * sizeof(mj_shard_ring) + MJ_SHARD_CACHE_LINE;
+    group->block = allocator->alloc(allocator->user, group->block_size);
+    group->slots = allocator->alloc(allocator->user, count * count * capacity * sizeof(mj_shard_msg));
+    if (group->block == NULL || group->slots == NULL) {
+        mj_shard_free(group);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(group->block, 0, group->block_size);
+
+    uintptr_t base = ((uintptr_t)group->block + MJ_SHARD_CACHE_LINE - 1) & ~(uintptr_t)(MJ_SHARD_CACHE_LINE - 1);
+    group->cores = (mj_shard_core*)base;
+    group->rings = (mj_shard_ring*)(base + cores_size);
+    for (size_t i = 0; i < count * count; i++) {
+        group->rings[i].slots = group->slots + i * capacity;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        mj_shard_core* core = &group->cores[i];
+        core->scheduler = schedulers[i];
+        core->wake_fds[0] = -1;
+        core->wake_fds[1] = -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        mj_shard_core* core = &group->cores[i];
+        core->task = mj_shard_task_create(group, i);
+        if (core->task == NULL) {
+            mj_shard_free(group);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (pipe(core->wake_fds) != 0) {
+            int error = errno;
+            core->wake_fds[0] = -1;
+            core->wake_fds[1] = -1;
+            mj_shard_free(group);
+            errno = error;
+            return NULL;
+        }
+        for (int j = 0; j < 2; j++) {
+            int flags = fcntl(core->wake_fds[j], F_GETFL, 0);
+            fcntl(core->wake_fds[j], F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+
+    // Nothing can fail from here on, once a shard task is posted the group belongs to the schedulers
+    group->active = count;
+    for (size_t i = 0; i < count; i++) {
+        mj_task* task = group->cores[i].task;
+        group->cores[i].task = NULL;
+        mj_scheduler_task_post(schedulers[i], task);
+    }
+
+    return group;
+}
+
+void mj_shard_group_stop(mj_shard_group* group) {
+    if (group == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&group->stopping, 1, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < group->count; i++) {
+        mj_shard_wake(&group->cores[i]);
+    }
+}
+
+int mj_shard_group_destroy(mj_shard_group** group) {
+    if (group == NULL || *group == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (__atomic_load_n(&(*group)->active, __ATOMIC_ACQUIRE) > 0) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    mj_shard_free(*group);
+    *group = NULL;
+    return 0;
+}
+
+size_t mj_shard_owner(const mj_shard_group* group, uint64_t key_hash) {
+    return group ? (size_t)(key_hash % group->count) : 0;
+}
+
+uint64_t mj_shard_hash(const void* key, size_t len) {
+    const uint8_t* bytes = key;
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int mj_shard_submit(mj_shard_group* group, mj_scheduler* scheduler, uint64_t key_hash, mj_shard_fn fn, void* arg, mj_future* future) {
+    if (group == NULL || scheduler == NULL || fn == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t from = mj_shard_core_index(group, scheduler);
+    if (from == group->count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (future) {
+        future->ready = false;
+        future->result = NULL;
+        future->group = group;
+    }
+
+    // The owner is this core, no need to go through a ring
+    size_t to = mj_shard_owner(group, key_hash);
+    if (to == from) {
+        void* result = fn(scheduler, arg);
+        if (future) {
+            mj_future_complete(future, result);
+        }
+        return 0;
+    }
+
+    mj_shard_ring* ring = &group->rings[from * group->count + to];
+    if (ring->staged - ring->cached_head > group->mask) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->staged - ring->cached_head > group->mask) {
+            mj_shard_publish(group, ring, to); // let the owner catch up
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    mj_shard_msg* msg = &ring->slots[ring->staged & group->mask];
+    msg->fn = fn;
+    msg->arg = arg;
+    msg->future = future;
+    ring->staged++;
+
+    if (ring->staged - ring->published >= MJ_SHARD_BATCH) {
+        mj_shard_publish(group, ring, to);
+    }
+    return 0;
+}
+
+void mj_shard_flush(mj_shard_group* group, mj_scheduler* scheduler) {
+    if (group == NULL) {
+        return;
+    }
+    size_t from = mj_shard_core_index(group, scheduler);
+    if (from < group->count) {
+        mj_shard_flush_core(group, from);
+    }
+}
+
+void mj_future_init(mj_future* future) {
+    if (future == NULL) {
+        return;
+    }
+
+    memset(future, 0, sizeof(*future));
+}
+
+bool mj_future_ready(const mj_future* future) {
+    return future && future->ready;
+}
+
+void* mj_future_result(const mj_future* future) {
+    return future ? future->result : NULL;
+}
+
+int mj_future_wait(mj_scheduler* scheduler, mj_future* future, uint64_t deadline_ns, mj_cancel_token* token) {
+    if (scheduler == NULL || future == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (future->ready) {
+        return 0;
+    }
+
+    mj_shard_flush(future->group, scheduler);
+    return mj_scheduler_task_wait(scheduler, &future->waiters, deadline_ns, token);
+}
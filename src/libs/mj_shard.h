@@ -0,0 +1,76 @@
+/* --------------------------------------------------------------------
+ * mj_shard.h
+ *
+ * Shared-nothing routing between per-core schedulers. Every scheduler in a group owns a partition of the key
+ * space, and work for a key is executed on the owning core only, so the data behind it needs no locks.
+ *
+ * Example usage, from inside a task's run callback on one of the group's schedulers:
+ *   if (!ctx->submitted) {
+ *       mj_shard_submit(group, scheduler, key_hash, kv_get, key, &ctx->reply);  // runs kv_get on the owner core
+ *       ctx->submitted = true;
+ *   }
+ *   if (!mj_future_ready(&ctx->reply)) {
+ *       mj_future_wait(scheduler, &ctx->reply, 0, NULL);  // parked until the owner core answers
+ *       return;
+ *   }
+ *   value = mj_future_result(&ctx->reply);
+ *
+ * Cores talk through one single-producer single-consumer ring per ordered core pair. Submissions are staged
+ * and published in batches (every MJ_SHARD_BATCH messages, on mj_shard_flush, or when the task waits on a
+ * future), so the ring's shared cache lines move once per batch instead of once per message. Each core runs
+ * one shard task that drains its incoming rings, runs the work and hands the finished futures back to their
+ * core in one lock-free push per ring drained. Futures are only ever marked ready on their own core.
+ *
+ * Stop the group only once no submissions are in flight, results for a core that has stopped are dropped.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+// Messages staged before a ring is published without an explicit flush
+#define MJ_SHARD_BATCH 16
+
+typedef struct mj_shard_group mj_shard_group;
+
+// Executed on the owning core, inside its shard task. The return value completes the caller's future.
+typedef void* (*mj_shard_fn)(mj_scheduler* scheduler, void* arg);
+
+// Result of a submission. Lives on the submitting core, owned by the caller (e.g. in ctx) and must stay valid
+// until it is ready, so do not remove a task while one of its futures is pending.
+typedef struct mj_future {
+    bool ready;
+    void* result;
+    // Internal shard fields below
+    mj_wait_queue waiters;
+    mj_shard_group* group;   // flushed before waiting
+    struct mj_future* next;  // completion stack link
+} mj_future;
+
+// Connects count schedulers, ring_capacity is rounded up to a power of two. Call before the schedulers run
+// or from any thread while they do: the per-core shard tasks are posted to them.
+mj_shard_group* mj_shard_group_create(mj_scheduler** schedulers, size_t count, size_t ring_capacity);
+// Safe from any thread. Shard tasks finish the messages already published and remove themselves.
+void mj_shard_group_stop(mj_shard_group* group);
+// Only once every scheduler in the group has returned from mj_scheduler_run
+int mj_shard_group_destroy(mj_shard_group** group);
+
+// Index of the core owning key_hash, which should be well mixed
+size_t mj_shard_owner(const mj_shard_group* group, uint64_t key_hash);
+// FNV-1a, for keys without a hash of their own
+uint64_t mj_shard_hash(const void* key, size_t len);
+
+// Only usable from within a task callback on one of the group's schedulers. Runs fn(arg) on the core owning
+// key_hash, inline when that is this core. future may be NULL for fire-and-forget.
+// return -1 with EAGAIN when the ring to the owner is full, the staged messages were flushed, retry later
+int mj_shard_submit(mj_shard_group* group, mj_scheduler* scheduler, uint64_t key_hash, mj_shard_fn fn, void* arg, mj_future* future);
+// Publishes every message this core has staged. Needed after fire-and-forget submissions, a task that waits
+// on a future flushes implicitly.
+void mj_shard_flush(mj_shard_group* group, mj_scheduler* scheduler);
+
+void mj_future_init(mj_future* future);
+bool mj_future_ready(const mj_future* future);
+void* mj_future_result(const mj_future* future);
+// Only usable from within a task callback. Flushes the group and parks the task until the future is ready,
+// same deadline and token semantics as mj_scheduler_task_wait. Does not park if it is ready already.
+int mj_future_wait(mj_scheduler* scheduler, mj_future* future, uint64_t deadline_ns, mj_cancel_token* token);
@@ -0,0 +1,213 @@
+#include "mj_topic.h"
+#include <errno.h>
+#include <string.h>
+
+typedef struct mj_topic_slot {
+    void* msg;
+    size_t len;
+} mj_topic_slot;
+
+struct mj_topic {
+    mj_scheduler* scheduler;
+    mj_topic_slot* slots; // ring, message seq lives in slots[seq % capacity]
+    size_t capacity;
+    uint64_t next_seq;    // seq of the next message published
+    mj_topic_policy policy;
+    mj_topic_free_fn free_fn;
+    void* user;
+    bool closed;
+    size_t subscribers;
+    mj_wait_queue readers;
+};
+
+struct mj_topic_sub {
+    mj_topic* topic;
+    uint64_t cursor; // seq of the next message to read
+    uint64_t missed;
+    bool dropped;
+};
+
+mj_topic* mj_topic_create(mj_scheduler* scheduler, size_t capacity, mj_topic_policy policy, mj_topic_free_fn free_fn, void* user) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    if (allocator == NULL || capacity == 0 || (policy != MJ_TOPIC_DROP && policy != MJ_TOPIC_CATCH_UP)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mj_topic* topic = allocator->alloc(allocator->user, sizeof(*topic));
+    if (topic == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(topic, 0, sizeof(*topic));
+
+    topic->slots = allocator->alloc(allocator->user, capacity * sizeof(mj_topic_slot));
+    if (topic->slots == NULL) {
+        allocator->free(allocator->user, topic, sizeof(*topic));
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(topic->slots, 0, capacity * sizeof(mj_topic_slot));
+
+    topic->scheduler = scheduler;
+    topic->capacity = capacity;
+    topic->policy = policy;
+    topic->free_fn = free_fn;
+    topic->user = user;
+    return topic;
+}
+
+static void mj_topic_free_slot(mj_topic* topic, mj_topic_slot* slot) {
+    if (slot->msg && topic->free_fn) {
+        topic->free_fn(slot->msg, topic->user);
+    }
+    slot->msg = NULL;
+    slot->len = 0;
+}
+
+int mj_topic_destroy(mj_topic** topic) {
+    if (topic == NULL || *topic == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((*topic)->subscribers > 0 || !mj_wait_queue_empty(&(*topic)->readers)) {
+        errno = EBUSY;
+        return 1;
+    }
+
+    mj_topic* t = *topic;
+    for (size_t i = 0; i < t->capacity; i++) {
+        mj_topic_free_slot(t, &t->slots[i]);
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(t->scheduler);
+    allocator->free(allocator->user, t->slots, t->capacity * sizeof(mj_topic_slot));
+    allocator->free(allocator->user, t, sizeof(*t));
+    *topic = NULL;
+    return 0;
+}
+
+// Seq of the oldest message still held in the ring
+static uint64_t mj_topic_oldest(const mj_topic* topic) {
+    return topic->next_seq > topic->capacity ? topic->next_seq - topic->capacity : 0;
+}
+
+int mj_topic_publish(mj_topic* topic, void* msg, size_t len) {
+    if (topic == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (topic->closed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    // Overwrite the oldest message, subscribers still pointing at it notice on their next read
+    mj_topic_slot* slot = &topic->slots[topic->next_seq % topic->capacity];
+    mj_topic_free_slot(topic, slot);
+    slot->msg = msg;
+    slot->len = len;
+    topic->next_seq++;
+
+    mj_wait_queue_wake_all(&topic->readers);
+    return 0;
+}
+
+void mj_topic_close(mj_topic* topic) {
+    if (topic == NULL || topic->closed) {
+        return;
+    }
+
+    topic->closed = true;
+    mj_wait_queue_wake_all(&topic->readers);
+}
+
+mj_topic_sub* mj_topic_subscribe(mj_topic* topic) {
+    if (topic == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(topic->scheduler);
+    mj_topic_sub* sub = allocator->alloc(allocator->user, sizeof(*sub));
+    if (sub == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(sub, 0, sizeof(*sub));
+
+    sub->topic = topic;
+    sub->cursor = topic->next_seq;
+    topic->subscribers++;
+    return sub;
+}
+
+int mj_topic_unsubscribe(mj_topic_sub** sub) {
+    if (sub == NULL || *sub == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mj_topic* topic = (*sub)->topic;
+    topic->subscribers--;
+
+    const mj_allocator* allocator = mj_scheduler_get_allocator(topic->scheduler);
+    allocator->free(allocator->user, *sub, sizeof(**sub));
+    *sub = NULL;
+    return 0;
+}
+
+int mj_topic_next(mj_topic_sub* sub, const void** msg, size_t* len) {
+    if (sub == NULL || msg == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sub->dropped) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    mj_topic* topic = sub->topic;
+    uint64_t oldest = mj_topic_oldest(topic);
+    if (sub->cursor < oldest) {
+        if (topic->policy == MJ_TOPIC_DROP) {
+            sub->dropped = true;
+            errno = ECONNRESET;
+            return -1;
+        }
+        sub->missed += oldest - sub->cursor;
+        sub->cursor = oldest;
+    }
+    if (sub->cursor == topic->next_seq) {
+        errno = topic->closed ? EPIPE : EAGAIN;
+        return -1;
+    }
+
+    const mj_topic_slot* slot = &topic->slots[sub->cursor % topic->capacity];
+    *msg = slot->msg;
+    if (len) {
+        *len = slot->len;
+    }
+    sub->cursor++;
+    return 0;
+}
+
+uint64_t mj_topic_sub_lag(const mj_topic_sub* sub) {
+    return sub ? sub->topic->next_seq - sub->cursor : 0;
+}
+
+uint64_t mj_topic_sub_missed(const mj_topic_sub* sub) {
+    return sub ? sub->missed : 0;
+}
+
+mj_wait_queue* mj_topic_queue(mj_topic* topic) {
+    return topic ? &topic->readers : NULL;
+}
+
+uint64_t mj_topic_published(const mj_topic* topic) {
+    return topic ? topic->next_seq : 0;
+}
+
+size_t mj_topic_subscribers(const mj_topic* topic) {
+    return topic ? topic->subscribers : 0;
+}
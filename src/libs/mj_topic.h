@@ -0,0 +1,73 @@
+/* --------------------------------------------------------------------
+ * mj_topic.h
+ *
+ * Broadcast topic: publishers append each message once, every subscriber task reads it through its own cursor.
+ *
+ * Example usage:
+ *   // startup
+ *   mj_topic* quotes = mj_topic_create(scheduler, 1024, MJ_TOPIC_CATCH_UP, free_quote, NULL);
+ *
+ *   // publisher, the topic owns quote from now on
+ *   mj_topic_publish(quotes, quote, sizeof(*quote));
+ *
+ *   // subscriber's run callback, sub comes from mj_topic_subscribe(quotes)
+ *   const void* msg;
+ *   size_t len;
+ *   while (mj_topic_next(c->sub, &msg, &len) == 0) handle_quote(msg, len);
+ *   if (errno == EAGAIN) {
+ *       mj_scheduler_task_wait(scheduler, mj_topic_queue(quotes), 0, NULL);
+ *   } else {  // EPIPE or ECONNRESET
+ *       mj_topic_unsubscribe(&c->sub);
+ *       mj_scheduler_task_remove_current(scheduler);
+ *   }
+ *
+ * Messages are never copied: the ring holds the publisher's pointers, a publish is O(1) whatever the message
+ * size and the number of subscribers, plus waking the subscribers that are parked. A subscriber falls behind
+ * once the ring has wrapped past its cursor, the oldest message was freed to make room. Depending on the
+ * policy it is then dropped (mj_topic_next fails with ECONNRESET) or forced to catch up (its cursor jumps to
+ * the oldest message still held and mj_topic_sub_missed counts what it skipped). Detection is lazy, on the
+ * subscriber's next read, so publishers never scan the subscriber list.
+ *
+ * A topic belongs to one scheduler, publish and read from tasks running on it.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+
+typedef struct mj_topic mj_topic;
+typedef struct mj_topic_sub mj_topic_sub;
+
+typedef enum {
+    MJ_TOPIC_DROP,     // a subscriber that falls behind gets ECONNRESET and must unsubscribe
+    MJ_TOPIC_CATCH_UP, // a subscriber that falls behind skips to the oldest message still held
+} mj_topic_policy;
+
+// Called with the user pointer given at create when a message leaves the ring
+typedef void (*mj_topic_free_fn)(void* msg, void* user);
+
+mj_topic* mj_topic_create(mj_scheduler* scheduler, size_t capacity, mj_topic_policy policy, mj_topic_free_fn free_fn, void* user);
+// return 1 with EBUSY while subscriptions exist, frees every message still held
+int mj_topic_destroy(mj_topic** topic);
+
+// return -1 with EPIPE when closed, on failure the caller keeps ownership of msg
+int mj_topic_publish(mj_topic* topic, void* msg, size_t len);
+// No more publishes, subscribers drain what is left and then get EPIPE. Wakes every parked subscriber.
+void mj_topic_close(mj_topic* topic);
+
+// New subscribers start at the next message published
+mj_topic_sub* mj_topic_subscribe(mj_topic* topic);
+int mj_topic_unsubscribe(mj_topic_sub** sub);
+
+// msg stays valid until the next publish on the topic.
+// return -1 with EAGAIN when caught up, EPIPE when closed and drained, ECONNRESET when dropped for lagging
+int mj_topic_next(mj_topic_sub* sub, const void** msg, size_t* len);
+// Messages published but not read yet, including ones already overwritten
+uint64_t mj_topic_sub_lag(const mj_topic_sub* sub);
+// Messages skipped by MJ_TOPIC_CATCH_UP so far
+uint64_t mj_topic_sub_missed(const mj_topic_sub* sub);
+
+// Wait queue woken on every publish and on close
+mj_wait_queue* mj_topic_queue(mj_topic* topic);
+uint64_t mj_topic_published(const mj_topic* topic);
+size_t mj_topic_subscribers(const mj_topic* topic);
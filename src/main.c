@@ -9,9 +9,9 @@ int main() {
     // Create scheduler
     mj_scheduler* scheduler = mj_scheduler_create();
 
-    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(4));
-    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(3));
-    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(2));
+    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(scheduler, 4));
+    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(scheduler, 3));
+    mj_scheduler_task_add(scheduler, demo_task_counter_create_task(scheduler, 2));
 
     // run tasks, blocks until task list is empty
     mj_scheduler_run(scheduler);
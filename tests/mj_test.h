@@ -0,0 +1,50 @@
+/* --------------------------------------------------------------------
+ * mj_test.h
+ *
+ * Minimal helpers shared by the behavioural tests in tests/, built and run by `make test`.
+ *
+ * Example usage:
+ *   MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+ *   MJ_CHECK(mj_test_task_add(scheduler, my_run, "my_task", &ctx, sizeof(ctx)) != NULL);
+ *
+ * A failed check prints the file, line and expression and exits with status 1, so a test binary either
+ * runs to the end and exits 0 or stops at the first failure.
+ * -------------------------------------------------------------------- */
+
+#pragma once
+
+#include "majjen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MJ_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+// Builds a task whose ctx is a copy of ctx, both from the scheduler's allocator so it can free them on
+// removal. Safe from any thread, e.g. for mj_scheduler_task_post.
+static inline mj_task* mj_test_task_new(mj_scheduler* scheduler, mj_task_fn run, const char* name, const void* ctx, size_t ctx_size) {
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    mj_task* task = allocator->alloc(allocator->user, sizeof(*task));
+    MJ_CHECK(task != NULL);
+    memset(task, 0, sizeof(*task));
+    task->ctx = allocator->alloc(allocator->user, ctx_size);
+    MJ_CHECK(task->ctx != NULL);
+    memcpy(task->ctx, ctx, ctx_size);
+    task->ctx_size = ctx_size;
+    task->run = run;
+    task->name = name;
+    return task;
+}
+
+// mj_test_task_new and mj_scheduler_task_add in one, checks the add succeeded
+static inline mj_task* mj_test_task_add(mj_scheduler* scheduler, mj_task_fn run, const char* name, const void* ctx, size_t ctx_size) {
+    mj_task* task = mj_test_task_new(scheduler, run, name, ctx, ctx_size);
+    MJ_CHECK(mj_scheduler_task_add(scheduler, task) == 0);
+    return task;
+}
@@ -0,0 +1,166 @@
+// A custom allocator that records every live block: a scheduler created with it makes and frees all of its
+// memory through it, tasks, ctx, timer heap, poll set, arena chunks and task allocations included, hands back
+// the size it allocated as the free hint, and leaves nothing behind once destroyed. Failures surface as ENOMEM.
+#include "mj_test.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define MAX_BLOCKS 256
+
+typedef struct block {
+    void* ptr;
+    size_t size;
+} block;
+
+typedef struct tracker {
+    block blocks[MAX_BLOCKS];
+    size_t live;
+    size_t allocs;
+    size_t frees;
+    size_t reallocs;
+    bool failing; // every allocation fails while set
+} tracker;
+
+static tracker tracked;
+
+static block* tracker_find(tracker* t, void* ptr) {
+    for (size_t i = 0; i < MAX_BLOCKS; i++) {
+        if (t->blocks[i].ptr == ptr) {
+            return &t->blocks[i];
+        }
+    }
+    return NULL;
+}
+
+static void* tracker_alloc(void* user, size_t size) {
+    tracker* t = user;
+    MJ_CHECK(t == &tracked);
+    if (t->failing) {
+        return NULL;
+    }
+    block* b = tracker_find(t, NULL);
+    MJ_CHECK(b != NULL);
+    b->ptr = malloc(size ? size : 1);
+    MJ_CHECK(b->ptr != NULL);
+    b->size = size;
+    t->live++;
+    t->allocs++;
+    return b->ptr;
+}
+
+static void tracker_free(void* user, void* ptr, size_t size) {
+    tracker* t = user;
+    MJ_CHECK(ptr != NULL);
+    block* b = tracker_find(t, ptr);
+    MJ_CHECK(b != NULL);
+    MJ_CHECK(size == b->size); // the scheduler always knows what it allocated
+    free(ptr);
+    b->ptr = NULL;
+    t->live--;
+    t->frees++;
+}
+
+static void* tracker_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    tracker* t = user;
+    t->reallocs++;
+    if (ptr == NULL) {
+        MJ_CHECK(old_size == 0);
+        return tracker_alloc(user, new_size);
+    }
+    block* b = tracker_find(t, ptr);
+    MJ_CHECK(b != NULL && b->size == old_size);
+    void* moved = realloc(ptr, new_size);
+    MJ_CHECK(moved != NULL);
+    b->ptr = moved;
+    b->size = new_size;
+    return moved;
+}
+
+static const mj_allocator tracker_allocator = {
+    .alloc = tracker_alloc,
+    .free = tracker_free,
+    .realloc = tracker_realloc,
+    .user = &tracked,
+};
+
+static void child_run(mj_scheduler* scheduler, void* ctx) {
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+typedef struct worker_ctx {
+    int runs;
+    int pipe_fds[2];
+    mj_timer timer;
+} worker_ctx;
+
+static void timer_fired(mj_scheduler* scheduler, void* arg) {
+}
+
+// Touches every path that allocates: its own allocations, a timer, an fd wait, the arena and a spawned task
+static void worker_run(mj_scheduler* scheduler, void* ctx) {
+    worker_ctx* worker = ctx;
+    switch (worker->runs++) {
+    case 0: {
+        char* buf = mj_scheduler_calloc(scheduler, 4, 16);
+        MJ_CHECK(buf != NULL && tracker_find(&tracked, buf)->size == 64);
+        buf = mj_scheduler_realloc(scheduler, buf, 64, 4096);
+        MJ_CHECK(buf != NULL && tracker_find(&tracked, buf)->size == 4096);
+        mj_scheduler_free(scheduler, buf, 4096);
+
+        MJ_CHECK(mj_scheduler_arena_alloc(scheduler, 32) != NULL);
+        MJ_CHECK(mj_scheduler_arena_alloc(scheduler, MJ_ARENA_CHUNK_SIZE * 2) != NULL); // its own block
+
+        mj_task* child = mj_scheduler_calloc(scheduler, 1, sizeof(*child));
+        MJ_CHECK(child != NULL);
+        child->ctx = mj_scheduler_alloc(scheduler, 8);
+        child->ctx_size = 8;
+        child->run = child_run;
+        MJ_CHECK(mj_scheduler_task_add(scheduler, child) == 0);
+
+        mj_timer_init(&worker->timer, timer_fired, NULL);
+        MJ_CHECK(mj_scheduler_timer_arm(scheduler, &worker->timer, mj_deadline_in_ms(1)) == 0);
+        MJ_CHECK(pipe(worker->pipe_fds) == 0);
+        MJ_CHECK(write(worker->pipe_fds[1], "", 1) == 1);
+        MJ_CHECK(mj_scheduler_task_wait_fd(scheduler, worker->pipe_fds[0], POLLIN, 0, NULL) == 0);
+        return;
+    }
+    case 1:
+        // Out of memory is reported, not hidden
+        tracked.failing = true;
+        MJ_CHECK(mj_scheduler_alloc(scheduler, 16) == NULL && errno == ENOMEM);
+        MJ_CHECK(mj_scheduler_realloc(scheduler, NULL, 0, 16) == NULL && errno == ENOMEM);
+        tracked.failing = false;
+        MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 5) == 0);
+        return;
+    default:
+        close(worker->pipe_fds[0]);
+        close(worker->pipe_fds[1]);
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+int main(void) {
+    mj_allocator incomplete = tracker_allocator;
+    incomplete.realloc = NULL;
+    MJ_CHECK(mj_scheduler_create_with_allocator(&incomplete) == NULL && errno == EINVAL);
+    tracked.failing = true;
+    MJ_CHECK(mj_scheduler_create_with_allocator(&tracker_allocator) == NULL && errno == ENOMEM);
+    MJ_CHECK(tracked.live == 0);
+    tracked.failing = false;
+
+    mj_scheduler* scheduler = mj_scheduler_create_with_allocator(&tracker_allocator);
+    MJ_CHECK(scheduler != NULL);
+    MJ_CHECK(mj_scheduler_get_allocator(scheduler)->user == &tracked);
+    MJ_CHECK(tracked.live > 0); // the scheduler itself
+
+    worker_ctx worker = {0};
+    mj_test_task_add(scheduler, worker_run, "worker", &worker, sizeof(worker));
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(worker.runs == 0); // the scheduler ran on its own copy
+    MJ_CHECK(tracked.reallocs >= 4); // the task's two, the timer heap and the poll set
+
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    MJ_CHECK(tracked.live == 0 && tracked.allocs == tracked.frees);
+    return 0;
+}
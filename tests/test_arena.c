@@ -0,0 +1,110 @@
+// Task arenas on one scheduler: allocations bump through MJ_ARENA_CHUNK_SIZE chunks and are charged to the
+// task, removal hands the chunks to the scheduler's pool and frees oversized blocks, the next task reuses
+// the pooled chunks without touching the allocator, and mj_scheduler_arena_trim gives them back.
+#include "mj_test.h"
+#include <errno.h>
+#include <stdint.h>
+
+#define PIECES 6 // two per chunk
+#define PIECE (MJ_ARENA_CHUNK_SIZE / 2)
+
+typedef struct counter {
+    size_t big_allocs; // chunks and oversized blocks, everything else the scheduler allocates is smaller
+    size_t big_frees;
+} counter;
+
+static counter counted;
+
+static void* counter_alloc(void* user, size_t size) {
+    if (size > MJ_ARENA_CHUNK_SIZE) {
+        counted.big_allocs++;
+    }
+    return malloc(size);
+}
+
+static void counter_free(void* user, void* ptr, size_t size) {
+    if (size > MJ_ARENA_CHUNK_SIZE) {
+        counted.big_frees++;
+    }
+    free(ptr);
+}
+
+static void* counter_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+static const mj_allocator counter_allocator = {
+    .alloc = counter_alloc,
+    .free = counter_free,
+    .realloc = counter_realloc,
+};
+
+static char* first_pieces[PIECES]; // the first task's pieces, for the second task to find its chunks among
+
+static void fill(mj_scheduler* scheduler, char** pieces) {
+    mj_task* self = mj_scheduler_task_current(scheduler);
+    size_t before = mj_task_mem_bytes(self);
+    for (int i = 0; i < PIECES; i++) {
+        pieces[i] = mj_scheduler_arena_alloc(scheduler, PIECE);
+        MJ_CHECK(pieces[i] != NULL && (uintptr_t)pieces[i] % 16 == 0);
+        memset(pieces[i], i, PIECE);
+        if (i % 2 == 1) {
+            MJ_CHECK(pieces[i] == pieces[i - 1] + PIECE); // bumped within the chunk
+        }
+    }
+    MJ_CHECK(mj_task_mem_bytes(self) > before + PIECES * PIECE);
+}
+
+static void second_run(mj_scheduler* scheduler, void* ctx) {
+    char* pieces[PIECES];
+    size_t big_allocs = counted.big_allocs;
+    fill(scheduler, pieces);
+    MJ_CHECK(counted.big_allocs == big_allocs); // all from the pool
+
+    // The newest chunk of the first task comes back first
+    MJ_CHECK(pieces[0] == first_pieces[PIECES - 2]);
+    for (int i = 0; i < PIECES; i += 2) {
+        bool reused = false;
+        for (int j = 0; j < PIECES; j += 2) {
+            reused = reused || pieces[i] == first_pieces[j];
+        }
+        MJ_CHECK(reused);
+    }
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void first_run(mj_scheduler* scheduler, void* ctx) {
+    MJ_CHECK(mj_scheduler_arena_alloc(scheduler, 0) == NULL && errno == EINVAL);
+    size_t big_allocs = counted.big_allocs;
+    fill(scheduler, first_pieces);
+    MJ_CHECK(counted.big_allocs == big_allocs + PIECES / 2);
+
+    // Oversized requests get a block of their own, freed on removal rather than pooled
+    char* large = mj_scheduler_arena_alloc(scheduler, MJ_ARENA_CHUNK_SIZE * 2);
+    MJ_CHECK(large != NULL && counted.big_allocs == big_allocs + PIECES / 2 + 1);
+    memset(large, 0, MJ_ARENA_CHUNK_SIZE * 2);
+
+    char unused = 0;
+    mj_test_task_add(scheduler, second_run, "second", &unused, sizeof(unused));
+    size_t big_frees = counted.big_frees;
+    mj_scheduler_task_remove_current(scheduler);
+    MJ_CHECK(counted.big_frees == big_frees + 1);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create_with_allocator(&counter_allocator);
+    MJ_CHECK(scheduler != NULL);
+    MJ_CHECK(mj_scheduler_arena_alloc(scheduler, 16) == NULL && errno == EINVAL); // outside a task callback
+
+    char unused = 0;
+    mj_test_task_add(scheduler, first_run, "first", &unused, sizeof(unused));
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(counted.big_allocs == PIECES / 2 + 1 && counted.big_frees == 1);
+
+    // The pooled chunks go back to the allocator
+    mj_scheduler_arena_trim(scheduler);
+    MJ_CHECK(counted.big_frees == counted.big_allocs);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    MJ_CHECK(counted.big_frees == counted.big_allocs);
+    return 0;
+}
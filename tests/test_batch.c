@@ -0,0 +1,105 @@
+// Batch run callbacks on one scheduler: runnable tasks of a type are gathered in slot order into one call,
+// a task that already ran from the wake slot is left out, and the batch can park and remove its members.
+// The log holds O for the other task, a bare digit for a lane run on its own and [..] for a batch.
+#include "mj_test.h"
+#include <errno.h>
+
+#define LANES 4
+
+static char log_buf[64];
+static size_t log_len;
+static int pass; // counted by the other task, which runs first in every pass
+static mj_wait_queue* lane1_queue;
+
+static void note(char c) {
+    MJ_CHECK(log_len + 1 < sizeof(log_buf));
+    log_buf[log_len++] = c;
+    log_buf[log_len] = '\0';
+}
+
+typedef struct lane_ctx {
+    int id;
+    mj_wait_queue queue;
+} lane_ctx;
+
+// A lane that is the only runnable one of its type, or runs from the wake slot, comes through here
+static void lane_run(mj_scheduler* scheduler, void* ctx) {
+    lane_ctx* lane = ctx;
+    note((char)('0' + lane->id));
+    if (pass == 3) {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+static void lane_batch(mj_scheduler* scheduler, void** contexts, size_t count) {
+    MJ_CHECK(mj_scheduler_task_current(scheduler) == NULL);
+    note('[');
+    for (size_t i = 0; i < count; i++) {
+        lane_ctx* lane = contexts[i];
+        MJ_CHECK(i == 0 || lane->id > ((lane_ctx*)contexts[i - 1])->id);
+        note((char)('0' + lane->id));
+    }
+    note(']');
+
+    for (size_t i = 0; i < count; i++) {
+        lane_ctx* lane = contexts[i];
+        if (pass == 1 && lane->id == 1) {
+            MJ_CHECK(mj_scheduler_batch_focus(scheduler, i) == 0);
+            MJ_CHECK(mj_scheduler_task_current(scheduler)->ctx == lane);
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, &lane->queue, 0, NULL) == 0);
+        }
+        if ((pass == 1 && lane->id == 3) || (pass == 3 && lane->id != 0)) {
+            MJ_CHECK(mj_scheduler_batch_focus(scheduler, i) == 0);
+            MJ_CHECK(mj_scheduler_task_remove_current(scheduler) == 0);
+            MJ_CHECK(mj_scheduler_batch_focus(scheduler, i) == -1 && errno == ENOENT);
+        }
+    }
+    MJ_CHECK(mj_scheduler_batch_focus(scheduler, count) == -1 && errno == EINVAL);
+}
+
+// Wakes lane 1 in pass 2 before the batch is gathered, so lane 1 runs from the wake slot first
+static void other_run(mj_scheduler* scheduler, void* ctx) {
+    pass++;
+    note('O');
+    if (pass == 2) {
+        MJ_CHECK(mj_wait_queue_wake_one(lane1_queue) == 1);
+    }
+    if (pass == 3) {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    MJ_CHECK(mj_scheduler_set_batch_run(scheduler, lane_run, lane_batch) == 0);
+
+    char unused = 0;
+    mj_test_task_add(scheduler, other_run, "other", &unused, sizeof(unused));
+    for (int i = 0; i < LANES; i++) {
+        lane_ctx lane = {.id = i};
+        mj_task* task = mj_test_task_add(scheduler, lane_run, "lane", &lane, sizeof(lane));
+        if (i == 1) {
+            lane1_queue = &((lane_ctx*)task->ctx)->queue;
+        }
+    }
+
+    // 1: all four lanes, 1 parks and 3 leaves. 2: lane 1 is woken and runs alone, the batch skips it.
+    // 3: the batch removes 1 and 2. 4: lane 0 is the last of its type and runs on its own.
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "O[0123]O1[02]O[012]0") == 0);
+
+    // Unregistering the type takes the batch callback out again
+    MJ_CHECK(mj_scheduler_set_batch_run(scheduler, lane_run, NULL) == 0);
+    log_len = 0;
+    pass = 3;
+    for (int i = 0; i < 2; i++) {
+        lane_ctx lane = {.id = i};
+        mj_test_task_add(scheduler, lane_run, "lane", &lane, sizeof(lane));
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "01") == 0);
+
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
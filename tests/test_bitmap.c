@@ -0,0 +1,127 @@
+// Runnable bitmap over several words: every runnable task runs exactly once per pass and parked ones never
+// do. Built by make with its own majjen.c and MAX_TASKS = 300, once per bitmap scan (AVX2, SSE2, scalar).
+// A controller in slot 0 plans which workers are runnable in every pass, wakes the parked ones it needs, and
+// checks the previous pass. Workers park themselves when the plan leaves them out of the next pass.
+#include "mj_test.h"
+
+#if MAX_TASKS <= 64 * 4
+#error "build with a MAX_TASKS that spans more than four bitmap words"
+#endif
+
+#define WORKERS (MAX_TASKS - 1)
+#define PASSES 200
+
+typedef struct worker_ctx {
+    size_t index;
+    bool parked;
+    uint64_t last_pass;
+    mj_wait_queue queue;
+} worker_ctx;
+
+static bool plan[PASSES + 2][WORKERS]; // runnable in pass p, pass PASSES + 1 removes every worker
+static bool ran[WORKERS];
+static worker_ctx* workers[WORKERS];
+static uint64_t pass;
+static uint32_t seed = 12345;
+
+static uint32_t next_random(void) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+// Dense, sparse, single word and near-empty passes, so whole words and runs of words are empty in turn
+static void plan_pass(bool* runnable, uint64_t p) {
+    switch (p % 5) {
+    case 0:
+        for (size_t i = 0; i < WORKERS; i++) {
+            runnable[i] = next_random() % 2;
+        }
+        break;
+    case 1:
+        for (int n = 0; n < 3; n++) {
+            runnable[next_random() % WORKERS] = true;
+        }
+        break;
+    case 2:
+        for (size_t i = 64 * 4 - 1; i < WORKERS; i++) {
+            runnable[i] = true; // slots in the last word, behind four empty ones on the AVX2 path
+        }
+        break;
+    case 3:
+        runnable[0] = true;
+        runnable[WORKERS - 1] = true;
+        break;
+    default:
+        break; // only the controller runs
+    }
+}
+
+static void worker_run(mj_scheduler* scheduler, void* ctx) {
+    worker_ctx* worker = ctx;
+    MJ_CHECK(!worker->parked);
+    MJ_CHECK(plan[pass][worker->index]);
+    MJ_CHECK(worker->last_pass != pass);
+    worker->last_pass = pass;
+    ran[worker->index] = true;
+
+    if (pass == PASSES + 1) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    if (!plan[pass + 1][worker->index]) {
+        worker->parked = true;
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, &worker->queue, 0, NULL) == 0);
+    }
+}
+
+static void controller_run(mj_scheduler* scheduler, void* ctx) {
+    if (pass > 0) {
+        for (size_t i = 0; i < WORKERS; i++) {
+            MJ_CHECK(ran[i] == plan[pass][i]);
+            ran[i] = false;
+        }
+    }
+    if (pass == PASSES + 1) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    pass++;
+    for (size_t i = 0; i < WORKERS; i++) {
+        if (plan[pass][i] && workers[i]->parked) {
+            workers[i]->parked = false;
+            MJ_CHECK(mj_wait_queue_wake_one(&workers[i]->queue) == 1);
+        }
+    }
+}
+
+int main(void) {
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("skipped, this CPU has no AVX2\n");
+        return 0;
+    }
+#endif
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+
+    // Every task starts runnable, the last pass wakes everyone so they can remove themselves
+    for (size_t i = 0; i < WORKERS; i++) {
+        plan[1][i] = true;
+        plan[PASSES + 1][i] = true;
+    }
+    for (uint64_t p = 2; p <= PASSES; p++) {
+        plan_pass(plan[p], p);
+    }
+
+    char unused = 0;
+    mj_test_task_add(scheduler, controller_run, "controller", &unused, sizeof(unused));
+    for (size_t i = 0; i < WORKERS; i++) {
+        worker_ctx worker = {.index = i};
+        workers[i] = mj_test_task_add(scheduler, worker_run, "worker", &worker, sizeof(worker))->ctx;
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(pass == PASSES + 1);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
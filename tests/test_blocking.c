@@ -0,0 +1,131 @@
+// mj_spawn_blocking: min_threads are started with the pool, results come back through the EINPROGRESS
+// park and remote wake, a full queue fails with EAGAIN, a pool with jobs in flight can not be destroyed,
+// and a pool without kept threads starts them on demand.
+#include "mj_blocking.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <time.h>
+
+#define WORKERS 3
+#define ROUNDS 200
+
+static mj_blocking_pool* pool;
+static int finished; // tasks done
+
+static void* square(void* arg) {
+    long x = (long)arg;
+    return (void*)(x * x);
+}
+
+static void* nap(void* arg) {
+    struct timespec ts = {0, 20 * 1000000L};
+    nanosleep(&ts, NULL);
+    return arg;
+}
+
+typedef struct worker_ctx {
+    mj_blocking_job* job;
+    long round;
+} worker_ctx;
+
+static void worker_run(mj_scheduler* scheduler, void* ctx) {
+    worker_ctx* worker = ctx;
+    while (worker->round < ROUNDS) {
+        void* result;
+        if (mj_spawn_blocking(scheduler, pool, &worker->job, square, (void*)worker->round, &result) != 0) {
+            MJ_CHECK(errno == EINPROGRESS);
+            MJ_CHECK(worker->job != NULL);
+            return;
+        }
+        MJ_CHECK(worker->job == NULL);
+        MJ_CHECK((long)result == worker->round * worker->round);
+        worker->round++;
+    }
+    finished++;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+typedef struct napper_ctx {
+    mj_blocking_job* job;
+    int rejected;
+} napper_ctx;
+
+// One slow job each, retried after a short sleep while the single-slot queue is full
+static void napper_run(mj_scheduler* scheduler, void* ctx) {
+    napper_ctx* napper = ctx;
+    void* result;
+    if (mj_spawn_blocking(scheduler, pool, &napper->job, nap, napper, &result) != 0) {
+        if (errno == EAGAIN) {
+            napper->rejected++;
+            MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 5) == 0);
+            return;
+        }
+        MJ_CHECK(errno == EINPROGRESS);
+        // Still sleeping on a pool thread, or queued behind another nap
+        MJ_CHECK(mj_blocking_pool_destroy(&pool) == 1 && errno == EBUSY && pool != NULL);
+        return;
+    }
+    MJ_CHECK(result == napper);
+    finished++;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    mj_blocking_stats stats;
+
+    MJ_CHECK(mj_blocking_pool_create(scheduler, 1, 1, 0) == NULL && errno == EINVAL);
+
+    // min_threads are running before the first job
+    pool = mj_blocking_pool_create(scheduler, 2, 3, 4);
+    MJ_CHECK(pool != NULL);
+    mj_blocking_pool_stats(pool, &stats);
+    MJ_CHECK(stats.threads == 2 && stats.queued == 0);
+
+    for (int i = 0; i < WORKERS; i++) {
+        worker_ctx worker = {0};
+        mj_test_task_add(scheduler, worker_run, "worker", &worker, sizeof(worker));
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(finished == WORKERS);
+    mj_blocking_pool_stats(pool, &stats);
+    MJ_CHECK(stats.completed == WORKERS * ROUNDS && stats.rejected == 0);
+    MJ_CHECK(stats.queued == 0 && stats.running == 0);
+    MJ_CHECK(stats.threads >= 2 && stats.threads <= 3);
+    MJ_CHECK(mj_blocking_pool_destroy(&pool) == 0 && pool == NULL);
+
+    // One thread and one queue slot for three slow jobs, at least one submission is turned away
+    finished = 0;
+    pool = mj_blocking_pool_create(scheduler, 0, 1, 1);
+    MJ_CHECK(pool != NULL);
+    mj_blocking_pool_stats(pool, &stats);
+    MJ_CHECK(stats.threads == 0);
+    for (int i = 0; i < 3; i++) {
+        napper_ctx napper = {0};
+        mj_test_task_add(scheduler, napper_run, "napper", &napper, sizeof(napper));
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(finished == 3);
+    mj_blocking_pool_stats(pool, &stats);
+    MJ_CHECK(stats.completed == 3 && stats.rejected >= 1 && stats.peak_queued == 1);
+    MJ_CHECK(mj_blocking_pool_destroy(&pool) == 0);
+
+    // No kept threads: the first job starts one, and the threads stay around for the next rounds
+    finished = 0;
+    pool = mj_blocking_pool_create(scheduler, 0, 2, 8);
+    MJ_CHECK(pool != NULL);
+    for (int i = 0; i < WORKERS; i++) {
+        worker_ctx worker = {0};
+        mj_test_task_add(scheduler, worker_run, "worker", &worker, sizeof(worker));
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(finished == WORKERS);
+    mj_blocking_pool_stats(pool, &stats);
+    MJ_CHECK(stats.completed == WORKERS * ROUNDS && stats.rejected == 0 && stats.queued == 0);
+    MJ_CHECK(stats.threads >= 1 && stats.threads <= 2);
+    MJ_CHECK(mj_blocking_pool_destroy(&pool) == 0);
+
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Connection pool against a listener task on 127.0.0.1: an async connect, reuse of the idle connection, the
+// health check dropping a connection whose peer closed, the idle timer closing what is left, and a refused
+// connect. The listener counts accepts so a reuse can be told apart from a new connect.
+#include "mj_conn_pool.h"
+#include "mj_test.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define IDLE_TIMEOUT_MS 50
+#define MAX_ACCEPTS 4
+
+typedef struct listener_ctx {
+    int fd;
+    int accepted[MAX_ACCEPTS];
+    int accepts;
+    mj_cancel_token stop;
+} listener_ctx;
+
+static void listener_run(mj_scheduler* scheduler, void* ctx) {
+    listener_ctx* listener = ctx;
+    if (mj_scheduler_task_wait_result(scheduler) == ECANCELED) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    int fd;
+    while ((fd = accept(listener->fd, NULL, NULL)) >= 0) {
+        MJ_CHECK(listener->accepts < MAX_ACCEPTS);
+        listener->accepted[listener->accepts++] = fd;
+    }
+    MJ_CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+    MJ_CHECK(mj_scheduler_task_wait_fd(scheduler, listener->fd, POLLIN, 0, &listener->stop) == 0);
+}
+
+enum { STAGE_CONNECT, STAGE_REUSE, STAGE_HEALTH, STAGE_EXPIRE, STAGE_REFUSED };
+
+typedef struct client_ctx {
+    mj_conn_pool* pool;
+    listener_ctx* listener;
+    struct sockaddr_in addr;
+    struct sockaddr_in refused_addr;
+    mj_conn* conn;
+    mj_conn* first;
+    int stage;
+    bool in_progress; // the current checkout parked at least once
+} client_ctx;
+
+// Checks out into client->conn, true once connected. A parked checkout returns false and the run ends.
+static bool client_checkout(client_ctx* client, const struct sockaddr_in* addr) {
+    if (mj_conn_pool_checkout(client->pool, &client->conn, (const struct sockaddr*)addr, sizeof(*addr), mj_deadline_in_ms(1000), NULL) == 0) {
+        return true;
+    }
+    MJ_CHECK(errno == EINPROGRESS && client->conn != NULL);
+    client->in_progress = true;
+    return false;
+}
+
+// The listener runs on its own wake, wait for it to have seen a connect before looking at its fds
+static bool client_accepted(mj_scheduler* scheduler, client_ctx* client, int accepts) {
+    if (client->listener->accepts >= accepts) {
+        return true;
+    }
+    MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 1) == 0);
+    return false;
+}
+
+static void client_run(mj_scheduler* scheduler, void* ctx) {
+    client_ctx* client = ctx;
+    mj_conn_pool* pool = client->pool;
+    char byte;
+    switch (client->stage) {
+    case STAGE_CONNECT:
+        if (!client_checkout(client, &client->addr)) {
+            return;
+        }
+        MJ_CHECK(client->in_progress); // a non-blocking connect, even on loopback
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 0);
+        client->first = client->conn;
+        client->stage = STAGE_REUSE;
+        // fall through
+    case STAGE_REUSE:
+        if (!client_accepted(scheduler, client, 1)) {
+            return;
+        }
+        mj_conn_pool_return(pool, client->conn, true);
+        client->conn = NULL;
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 1);
+        MJ_CHECK(client_checkout(client, &client->addr) && client->conn == client->first);
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 0);
+        mj_conn_pool_return(pool, client->conn, true);
+        client->conn = NULL;
+
+        // The peer goes away while the connection sits idle
+        MJ_CHECK(close(client->listener->accepted[0]) == 0);
+        client->in_progress = false;
+        client->stage = STAGE_HEALTH;
+        MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 10) == 0);
+        return;
+    case STAGE_HEALTH:
+        if (client->conn == NULL || !client->conn->connected) {
+            if (!client_checkout(client, &client->addr)) {
+                MJ_CHECK(mj_conn_pool_idle_count(pool) == 0); // the closed one was dropped, not handed out
+                return;
+            }
+        }
+        MJ_CHECK(client->in_progress);
+        if (!client_accepted(scheduler, client, 2)) {
+            return;
+        }
+        mj_conn_pool_return(pool, client->conn, true);
+        client->conn = NULL;
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 1);
+        client->stage = STAGE_EXPIRE;
+        MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, IDLE_TIMEOUT_MS * 3) == 0);
+        return;
+    case STAGE_EXPIRE:
+        // The expiry timer closed it, the listener side sees EOF
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 0);
+        MJ_CHECK(read(client->listener->accepted[1], &byte, 1) == 0);
+        close(client->listener->accepted[1]);
+        client->in_progress = false;
+        client->stage = STAGE_REFUSED;
+        // fall through
+    default:
+        if (mj_conn_pool_checkout(pool, &client->conn, (const struct sockaddr*)&client->refused_addr, sizeof(client->refused_addr),
+                                  mj_deadline_in_ms(1000), NULL) == -1 &&
+            errno == EINPROGRESS) {
+            return;
+        }
+        MJ_CHECK(errno == ECONNREFUSED && client->conn == NULL);
+        MJ_CHECK(mj_conn_pool_idle_count(pool) == 0);
+        mj_cancel_token_cancel(&client->listener->stop);
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+// A non-blocking listener on an ephemeral loopback port
+static int listen_loopback(struct sockaddr_in* addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    MJ_CHECK(fd >= 0);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(*addr);
+    MJ_CHECK(bind(fd, (struct sockaddr*)addr, len) == 0);
+    MJ_CHECK(getsockname(fd, (struct sockaddr*)addr, &len) == 0);
+    MJ_CHECK(listen(fd, 8) == 0);
+    MJ_CHECK(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0);
+    return fd;
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    client_ctx client = {0};
+    client.pool = mj_conn_pool_create(scheduler, IDLE_TIMEOUT_MS, 2);
+    MJ_CHECK(client.pool != NULL);
+
+    // A port nobody listens on any more, for the refused connect
+    close(listen_loopback(&client.refused_addr));
+
+    listener_ctx listener = {.stop = MJ_CANCEL_TOKEN_INIT};
+    listener.fd = listen_loopback(&client.addr);
+    client.listener = mj_test_task_add(scheduler, listener_run, "listener", &listener, sizeof(listener))->ctx;
+    mj_test_task_add(scheduler, client_run, "client", &client, sizeof(client));
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+
+    MJ_CHECK(mj_conn_pool_destroy(&client.pool) == 0 && client.pool == NULL);
+    close(listener.fd);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
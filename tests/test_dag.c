@@ -0,0 +1,101 @@
+// A random DAG run on three scheduler threads: every job runs once and only after its dependencies, a task
+// on a fourth scheduler is woken once the workers have exited and destroys the DAG, and cycles are refused.
+#include "mj_dag.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define CORES 4
+#define WORKER_CORES 3 // the last scheduler only runs the waiter
+#define JOBS 2000
+#define MAX_DEPS 3
+
+static mj_dag* dag;
+static int completed[JOBS]; // atomic
+static int deps[JOBS][MAX_DEPS];
+static int dep_count[JOBS];
+static int waiter_resumed;
+
+static void job_run(mj_scheduler* scheduler, void* arg) {
+    int job = (int)(intptr_t)arg;
+    for (int i = 0; i < dep_count[job]; i++) {
+        MJ_CHECK(__atomic_load_n(&completed[deps[job][i]], __ATOMIC_ACQUIRE));
+    }
+    volatile int spin = 0; // enough work for idle workers to steal
+    for (int i = 0; i < 2000; i++) {
+        spin += i;
+    }
+    MJ_CHECK(__atomic_exchange_n(&completed[job], 1, __ATOMIC_ACQ_REL) == 0);
+}
+
+static void noop_run(mj_scheduler* scheduler, void* arg) {
+}
+
+static void waiter_run(mj_scheduler* scheduler, void* ctx) {
+    if (mj_dag_wait(scheduler, dag) != 0) {
+        MJ_CHECK(errno == EINPROGRESS);
+        return;
+    }
+    MJ_CHECK(mj_dag_done(dag));
+    for (int i = 0; i < JOBS; i++) {
+        MJ_CHECK(completed[i]);
+    }
+    MJ_CHECK(mj_dag_destroy(&dag) == 0 && dag == NULL);
+    waiter_resumed = 1;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    mj_scheduler* schedulers[CORES];
+    for (int i = 0; i < CORES; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+    }
+
+    // Two jobs waiting on each other are refused and nothing is posted
+    mj_dag* cycle = mj_dag_create(schedulers[0]);
+    MJ_CHECK(cycle != NULL);
+    int a = mj_dag_add(cycle, noop_run, NULL, 1);
+    int b = mj_dag_add(cycle, noop_run, NULL, 1);
+    MJ_CHECK(mj_dag_depend(cycle, a, b) == 0 && mj_dag_depend(cycle, b, a) == 0);
+    MJ_CHECK(mj_dag_run(cycle, schedulers, WORKER_CORES) == -1 && errno == ELOOP);
+    MJ_CHECK(mj_dag_destroy(&cycle) == 0 && cycle == NULL);
+
+    // Every job depends on up to three earlier ones
+    dag = mj_dag_create(schedulers[0]);
+    MJ_CHECK(dag != NULL);
+    srand(1);
+    for (int job = 0; job < JOBS; job++) {
+        MJ_CHECK(mj_dag_add(dag, job_run, (void*)(intptr_t)job, 1 + rand() % 5) == job);
+        dep_count[job] = job ? rand() % (MAX_DEPS + 1) : 0;
+        for (int i = 0; i < dep_count[job]; i++) {
+            deps[job][i] = rand() % job;
+            MJ_CHECK(mj_dag_depend(dag, job, deps[job][i]) == 0);
+        }
+    }
+    MJ_CHECK(mj_dag_jobs(dag) == JOBS);
+
+    char unused = 0;
+    mj_test_task_add(schedulers[WORKER_CORES], waiter_run, "dag_waiter", &unused, sizeof(unused));
+    MJ_CHECK(mj_dag_run(dag, schedulers, WORKER_CORES) == 0);
+    MJ_CHECK(mj_dag_destroy(&dag) == 1 && errno == EBUSY && dag != NULL);
+
+    pthread_t threads[CORES];
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, core_thread, schedulers[i]) == 0);
+    }
+    for (int i = 0; i < CORES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    MJ_CHECK(waiter_resumed && dag == NULL);
+
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+// Resolver against a stub DNS server task on 127.0.0.1: answers, negative caching, single-flight
+// coalescing, retry after a lost reply, truncated and malformed replies, and timeouts.
+#include "mj_dns.h"
+#include "mj_test.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define STUB_NAMES 6
+#define STUB_PACKET 512
+
+// Names the stub knows, queries[i] counts the queries it saw for names[i]
+static const char* stub_names[STUB_NAMES] = {"a.test", "missing.test", "slow.test", "trunc.test", "bad.test", "never.test"};
+
+typedef struct stub_server {
+    int fd;
+    struct sockaddr_in addr;
+    int queries[STUB_NAMES];
+    bool done; // set by the driver, the stub removes itself on its next run
+} stub_server;
+
+typedef struct stub_ctx {
+    stub_server* server;
+} stub_ctx;
+
+static int stub_queries(const stub_server* server, const char* name) {
+    for (int i = 0; i < STUB_NAMES; i++) {
+        if (strcmp(stub_names[i], name) == 0) {
+            return server->queries[i];
+        }
+    }
+    return -1;
+}
+
+static size_t stub_put16(uint8_t* p, size_t off, uint16_t v) {
+    p[off] = (uint8_t)(v >> 8);
+    p[off + 1] = (uint8_t)v;
+    return off + 2;
+}
+
+static size_t stub_put32(uint8_t* p, size_t off, uint32_t v) {
+    off = stub_put16(p, off, (uint16_t)(v >> 16));
+    return stub_put16(p, off, (uint16_t)v);
+}
+
+// Answer record for the question name (compression pointer to offset 12)
+static size_t stub_put_a(uint8_t* p, size_t off, const char* addr, uint32_t ttl, uint16_t rdlength) {
+    off = stub_put16(p, off, 0xC00C);
+    off = stub_put16(p, off, 1); // A
+    off = stub_put16(p, off, 1); // IN
+    off = stub_put32(p, off, ttl);
+    off = stub_put16(p, off, rdlength);
+    MJ_CHECK(inet_pton(AF_INET, addr, p + off) == 1);
+    return off + 4;
+}
+
+static void stub_send(stub_server* server, const uint8_t* p, size_t len, const struct sockaddr_in* to) {
+    MJ_CHECK(sendto(server->fd, p, len, 0, (const struct sockaddr*)to, sizeof(*to)) == (ssize_t)len);
+}
+
+// Replies to one query. The reply starts as a copy of the query's header and question.
+static void stub_reply(stub_server* server, uint8_t* query, size_t question_end, int index, const struct sockaddr_in* to) {
+    uint8_t p[STUB_PACKET];
+    memcpy(p, query, question_end);
+    int seen = ++server->queries[index];
+    const char* name = stub_names[index];
+    size_t len = question_end;
+    stub_put16(p, 2, 0x8180); // response, RD, RA, NOERROR
+
+    if (strcmp(name, "a.test") == 0) {
+        stub_put16(p, 6, 1);
+        len = stub_put_a(p, len, "10.0.0.1", 60, 4);
+    } else if (strcmp(name, "missing.test") == 0) {
+        // NXDOMAIN with an SOA whose minimum (30 s) becomes the negative TTL
+        stub_put16(p, 2, 0x8183);
+        stub_put16(p, 8, 1);
+        len = stub_put16(p, len, 0xC00C);
+        len = stub_put16(p, len, 6); // SOA
+        len = stub_put16(p, len, 1);
+        len = stub_put32(p, len, 300);
+        len = stub_put16(p, len, 22);
+        p[len++] = 0; // MNAME, root
+        p[len++] = 0; // RNAME, root
+        for (int i = 0; i < 4; i++) {
+            len = stub_put32(p, len, 1); // serial, refresh, retry, expire
+        }
+        len = stub_put32(p, len, 30);
+    } else if (strcmp(name, "slow.test") == 0) {
+        if (seen == 1) {
+            return; // lost, the resolver retries once timeout_ms passed
+        }
+        stub_put16(p, 6, 1);
+        len = stub_put_a(p, len, "10.0.0.3", 60, 4);
+    } else if (strcmp(name, "trunc.test") == 0) {
+        stub_put16(p, 2, 0x8380); // TC, no answers
+    } else if (strcmp(name, "bad.test") == 0) {
+        if (seen == 1) {
+            // Too short to be a reply, then an answer whose rdata runs past the packet
+            stub_send(server, p, 5, to);
+            stub_put16(p, 6, 1);
+            len = stub_put_a(p, len, "10.0.0.9", 60, 200);
+        } else {
+            stub_put16(p, 6, 1);
+            len = stub_put_a(p, len, "10.0.0.4", 60, 4);
+        }
+    } else {
+        return; // never.test, never answered
+    }
+    stub_send(server, p, len, to);
+}
+
+static void stub_run(mj_scheduler* scheduler, void* ctx) {
+    stub_server* server = ((stub_ctx*)ctx)->server;
+    if (server->done) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    uint8_t query[STUB_PACKET];
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(server->fd, query, sizeof(query), 0, (struct sockaddr*)&from, &from_len);
+        if (len < 0) {
+            MJ_CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+
+        // Question name back to dotted form, the resolver never compresses it
+        char name[256];
+        size_t name_len = 0;
+        size_t off = 12;
+        MJ_CHECK(len > 12);
+        while (query[off] != 0) {
+            uint8_t label = query[off++];
+            if (name_len) {
+                name[name_len++] = '.';
+            }
+            memcpy(name + name_len, query + off, label);
+            name_len += label;
+            off += label;
+        }
+        name[name_len] = '\0';
+        size_t question_end = off + 1 + 4;
+        MJ_CHECK(question_end == (size_t)len);
+
+        int index = -1;
+        for (int i = 0; i < STUB_NAMES; i++) {
+            if (strcmp(stub_names[i], name) == 0) {
+                index = i;
+            }
+        }
+        MJ_CHECK(index >= 0);
+        stub_reply(server, query, question_end, index, &from);
+    }
+
+    // Wakes on the next query, or in a while to notice done
+    mj_scheduler_task_wait_fd(scheduler, server->fd, POLLIN, mj_deadline_in_ms(10), NULL);
+}
+
+typedef struct dns_case {
+    const char* name;
+    int error;        // expected errno, 0 for an answer
+    const char* addr; // expected answer
+    int queries;      // queries the stub has seen for the name afterwards
+} dns_case;
+
+static const dns_case dns_cases[] = {
+    {"a.test", 0, "10.0.0.1", 1},      // shared with the two joiners, a single query
+    {"A.Test.", 0, "10.0.0.1", 1},     // cached, the name is normalized
+    {"missing.test", ENOENT, NULL, 1}, // NXDOMAIN
+    {"missing.test", ENOENT, NULL, 1}, // negative answer cached
+    {"slow.test", 0, "10.0.0.3", 2},   // first reply lost, retried after the timeout
+    {"trunc.test", EIO, NULL, 2},      // truncated on both attempts
+    {"bad.test", 0, "10.0.0.4", 2},    // short and malformed replies ignored, retried at once
+    {"never.test", ETIMEDOUT, NULL, 2},
+    {"127.0.0.1", 0, "127.0.0.1", -1}, // literal, no query
+};
+#define DNS_CASES (sizeof(dns_cases) / sizeof(dns_cases[0]))
+
+typedef struct dns_test {
+    mj_dns_resolver* resolver;
+    stub_server* server;
+    int joined; // joiners that got the shared answer
+    size_t finished;
+} dns_test;
+
+typedef struct driver_ctx {
+    dns_test* test;
+    size_t step;
+    bool pending;
+} driver_ctx;
+
+typedef struct joiner_ctx {
+    dns_test* test;
+    bool pending;
+} joiner_ctx;
+
+static void check_addr(const struct in_addr* addr, const char* expected) {
+    char text[INET_ADDRSTRLEN];
+    MJ_CHECK(inet_ntop(AF_INET, addr, text, sizeof(text)) != NULL);
+    MJ_CHECK(strcmp(text, expected) == 0);
+}
+
+static void driver_run(mj_scheduler* scheduler, void* ctx) {
+    driver_ctx* driver = ctx;
+    dns_test* test = driver->test;
+
+    while (driver->step < DNS_CASES) {
+        const dns_case* c = &dns_cases[driver->step];
+        struct in_addr addrs[4];
+        size_t count = 4;
+        int result = mj_dns_resolve(test->resolver, &driver->pending, c->name, addrs, &count, mj_deadline_in_ms(5000), NULL);
+        if (result != 0 && errno == EINPROGRESS) {
+            return;
+        }
+
+        if (c->error) {
+            MJ_CHECK(result == -1 && errno == c->error);
+        } else {
+            MJ_CHECK(result == 0 && count == 1);
+            check_addr(&addrs[0], c->addr);
+        }
+        if (c->queries >= 0) {
+            MJ_CHECK(stub_queries(test->server, c->name[0] == 'A' ? "a.test" : c->name) == c->queries);
+        }
+        driver->step++;
+    }
+
+    test->finished = driver->step;
+    test->server->done = true;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void joiner_run(mj_scheduler* scheduler, void* ctx) {
+    joiner_ctx* joiner = ctx;
+    struct in_addr addr;
+    size_t count = 1;
+    if (mj_dns_resolve(joiner->test->resolver, &joiner->pending, "a.test", &addr, &count, mj_deadline_in_ms(5000), NULL) != 0) {
+        MJ_CHECK(errno == EINPROGRESS);
+        return;
+    }
+    check_addr(&addr, "10.0.0.1");
+    joiner->test->joined++;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+int main(void) {
+    stub_server server;
+    memset(&server, 0, sizeof(server));
+    server.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    MJ_CHECK(server.fd >= 0);
+    MJ_CHECK(fcntl(server.fd, F_SETFL, fcntl(server.fd, F_GETFL, 0) | O_NONBLOCK) == 0);
+    server.addr.sin_family = AF_INET;
+    server.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    MJ_CHECK(bind(server.fd, (struct sockaddr*)&server.addr, sizeof(server.addr)) == 0);
+    socklen_t addr_len = sizeof(server.addr);
+    MJ_CHECK(getsockname(server.fd, (struct sockaddr*)&server.addr, &addr_len) == 0);
+
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+
+    // No system files, short timeouts, two attempts against the stub only
+    mj_dns_config config = {.resolv_conf = "", .hosts = "", .timeout_ms = 50, .attempts = 2};
+    mj_dns_resolver* resolver = mj_dns_resolver_create(scheduler, &config);
+    MJ_CHECK(resolver != NULL);
+    MJ_CHECK(mj_dns_resolver_set_nameserver(resolver, &server.addr) == 0);
+
+    dns_test test = {.resolver = resolver, .server = &server};
+    stub_ctx stub = {.server = &server};
+    driver_ctx driver = {.test = &test};
+    joiner_ctx joiner = {.test = &test};
+    mj_test_task_add(scheduler, stub_run, "dns_stub", &stub, sizeof(stub));
+    mj_test_task_add(scheduler, driver_run, "dns_driver", &driver, sizeof(driver));
+    mj_test_task_add(scheduler, joiner_run, "dns_joiner", &joiner, sizeof(joiner));
+    mj_test_task_add(scheduler, joiner_run, "dns_joiner", &joiner, sizeof(joiner));
+
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(test.finished == DNS_CASES);
+    MJ_CHECK(test.joined == 2);
+    MJ_CHECK(mj_dns_resolver_destroy(&resolver) == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    close(server.fd);
+    return 0;
+}
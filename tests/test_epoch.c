@@ -0,0 +1,127 @@
+// Epoch reclamation: a thread inside an epoch holds back mj_epoch_safe, and task handles stay usable by
+// remote wakers on plain threads while the tasks behind them are removed and replaced on two schedulers.
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define CORES 2
+#define SLOTS 4          // worker tasks per scheduler
+#define WAKES_PER_TASK 50
+#define GENERATIONS 40   // tasks each slot goes through
+#define WAKERS 2
+
+// Handle of the worker currently in each slot, NULL while it is being replaced or gone
+static mj_task* handles[CORES][SLOTS]; // atomic
+static int live[CORES];                // atomic, slots still holding a worker
+static int stop_waking;                // atomic
+
+typedef struct worker_ctx {
+    int core;
+    int slot;
+    int generation;
+    int wakes;
+    bool parked;
+    mj_wait_queue queue; // never woken locally, only through mj_task_post_wake
+} worker_ctx;
+
+static void worker_run(mj_scheduler* scheduler, void* ctx) {
+    worker_ctx* worker = ctx;
+    mj_task* self = mj_scheduler_task_current(scheduler);
+
+    if (worker->parked) {
+        MJ_CHECK(mj_scheduler_task_wait_result(scheduler) == 0);
+        worker->wakes++;
+    }
+    if (worker->wakes == WAKES_PER_TASK) {
+        // Hand the slot to a fresh task, the old handle may still be in a waker's hands
+        __atomic_store_n(&handles[worker->core][worker->slot], NULL, __ATOMIC_RELEASE);
+        if (worker->generation + 1 < GENERATIONS) {
+            worker_ctx next = {.core = worker->core, .slot = worker->slot, .generation = worker->generation + 1};
+            mj_test_task_add(scheduler, worker_run, "worker", &next, sizeof(next));
+        } else {
+            __atomic_sub_fetch(&live[worker->core], 1, __ATOMIC_RELEASE);
+        }
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    worker->parked = true;
+    MJ_CHECK(mj_scheduler_task_wait(scheduler, &worker->queue, 0, NULL) == 0);
+    __atomic_store_n(&handles[worker->core][worker->slot], self, __ATOMIC_RELEASE);
+}
+
+static void* waker_thread(void* arg) {
+    while (!__atomic_load_n(&stop_waking, __ATOMIC_ACQUIRE)) {
+        MJ_CHECK(mj_epoch_enter() == 0);
+        for (int core = 0; core < CORES; core++) {
+            for (int slot = 0; slot < SLOTS; slot++) {
+                mj_task* task = __atomic_load_n(&handles[core][slot], __ATOMIC_ACQUIRE);
+                if (task) {
+                    MJ_CHECK(mj_task_post_wake(task) == 0);
+                }
+            }
+        }
+        mj_epoch_exit();
+    }
+    return NULL;
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    // Held back while this thread is inside, released once it leaves. Nesting keeps the outer epoch.
+    MJ_CHECK(mj_epoch_enter() == 0);
+    MJ_CHECK(mj_epoch_enter() == 0);
+    uint64_t token = mj_epoch_token();
+    mj_epoch_exit();
+    for (int i = 0; i < 100; i++) {
+        MJ_CHECK(!mj_epoch_safe(token));
+    }
+    mj_epoch_exit();
+    bool safe = false;
+    for (int i = 0; i < 100 && !safe; i++) {
+        safe = mj_epoch_safe(token);
+    }
+    MJ_CHECK(safe);
+
+    mj_scheduler* schedulers[CORES];
+    for (int core = 0; core < CORES; core++) {
+        schedulers[core] = mj_scheduler_create();
+        MJ_CHECK(schedulers[core] != NULL);
+        mj_scheduler_hold(schedulers[core]); // workers park on queues only the wakers reach
+        live[core] = SLOTS;
+        for (int slot = 0; slot < SLOTS; slot++) {
+            worker_ctx worker = {.core = core, .slot = slot};
+            mj_test_task_add(schedulers[core], worker_run, "worker", &worker, sizeof(worker));
+        }
+    }
+
+    pthread_t cores[CORES];
+    pthread_t wakers[WAKERS];
+    for (int core = 0; core < CORES; core++) {
+        MJ_CHECK(pthread_create(&cores[core], NULL, core_thread, schedulers[core]) == 0);
+    }
+    for (int i = 0; i < WAKERS; i++) {
+        MJ_CHECK(pthread_create(&wakers[i], NULL, waker_thread, NULL) == 0);
+    }
+
+    for (int core = 0; core < CORES; core++) {
+        while (__atomic_load_n(&live[core], __ATOMIC_ACQUIRE) > 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&stop_waking, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < WAKERS; i++) {
+        pthread_join(wakers[i], NULL);
+    }
+    for (int core = 0; core < CORES; core++) {
+        mj_scheduler_release(schedulers[core]);
+        pthread_join(cores[core], NULL);
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[core]) == 0);
+    }
+    return 0;
+}
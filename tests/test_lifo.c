@@ -0,0 +1,209 @@
+// Wake slot handoffs and microtasks on one scheduler: a woken task runs right after its waker, at most
+// MJ_LIFO_BUDGET in a row, no task runs twice in one pass, and microtasks drain in queue order first.
+// A timer armed in the past marks the end of a pass in the log, it fires in the timer phase between sweeps.
+#include "mj_test.h"
+#include <errno.h>
+
+static char log_buf[32];
+static size_t log_len;
+static mj_timer pass_marker;
+
+static void note(char c) {
+    MJ_CHECK(log_len + 1 < sizeof(log_buf));
+    log_buf[log_len++] = c;
+    log_buf[log_len] = '\0';
+}
+
+static void log_reset(void) {
+    log_len = 0;
+    log_buf[0] = '\0';
+}
+
+static void marker_fired(mj_scheduler* scheduler, void* arg) {
+    note('|');
+}
+
+static void mark_pass_end(mj_scheduler* scheduler) {
+    MJ_CHECK(mj_scheduler_timer_arm(scheduler, &pass_marker, mj_time_now_ns()) == 0);
+}
+
+typedef struct hop_ctx {
+    char name;
+    int runs;
+    mj_wait_queue queue;
+    mj_wait_queue* wake; // woken on the second run
+    bool trigger;        // starts the chain instead of parking on its first run
+} hop_ctx;
+
+static hop_ctx* hop(mj_task* task) {
+    return task->ctx;
+}
+
+// First run parks (or, for the trigger, just returns), the second notes the name, wakes the next hop and leaves
+static void hop_run(mj_scheduler* scheduler, void* ctx) {
+    hop_ctx* h = ctx;
+    if (h->runs++ == 0) {
+        if (!h->trigger) {
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, &h->queue, 0, NULL) == 0);
+        }
+        return;
+    }
+    if (h->trigger) {
+        mark_pass_end(scheduler);
+    }
+    note(h->name);
+    if (h->wake) {
+        MJ_CHECK(mj_wait_queue_wake_one(h->wake) == 1);
+    }
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+// The chain A -> B -> C -> D -> E is one hop longer than the budget, E sits in slot 0 so only the wake slot
+// could run it in the same pass
+static void test_budget(void) {
+    MJ_CHECK(MJ_LIFO_BUDGET == 3 && MAX_TASKS >= 5);
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    hop_ctx init = {0};
+    init.name = 'E';
+    mj_task* e = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    init.name = 'A';
+    init.trigger = true;
+    mj_task* a = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    init.trigger = false;
+    init.name = 'B';
+    mj_task* b = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    init.name = 'C';
+    mj_task* c = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    init.name = 'D';
+    mj_task* d = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    hop(a)->wake = &hop(b)->queue;
+    hop(b)->wake = &hop(c)->queue;
+    hop(c)->wake = &hop(d)->queue;
+    hop(d)->wake = &hop(e)->queue;
+
+    log_reset();
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "ABCD|E") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+}
+
+typedef struct repeat_ctx {
+    char name;
+    int runs;
+    mj_wait_queue queue;
+    mj_wait_queue* wake;
+} repeat_ctx;
+
+// P runs in its slot and parks, Q behind it wakes P. P already ran this pass, so it waits for the next one.
+static void repeat_run(mj_scheduler* scheduler, void* ctx) {
+    repeat_ctx* r = ctx;
+    int run = r->runs++;
+    if (run == 0) {
+        return;
+    }
+    note(r->name);
+    if (r->wake) {
+        mark_pass_end(scheduler);
+        MJ_CHECK(mj_wait_queue_wake_one(r->wake) == 1);
+        mj_scheduler_task_remove_current(scheduler);
+    } else if (run == 1) {
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, &r->queue, 0, NULL) == 0);
+    } else {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+static void test_once_per_pass(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    repeat_ctx init = {.name = 'P'};
+    mj_task* p = mj_test_task_add(scheduler, repeat_run, "repeat", &init, sizeof(init));
+    init.name = 'Q';
+    init.wake = &((repeat_ctx*)p->ctx)->queue;
+    mj_test_task_add(scheduler, repeat_run, "repeat", &init, sizeof(init));
+
+    log_reset();
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "PQ|P") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+}
+
+static mj_microtask micro[3];
+
+static void micro_run(mj_scheduler* scheduler, void* arg) {
+    int index = (int)(intptr_t)arg;
+    MJ_CHECK(!mj_microtask_queued(&micro[index]));
+    note((char)('1' + index));
+    if (index == 0) {
+        MJ_CHECK(mj_scheduler_microtask(scheduler, &micro[2]) == 0); // joins the drain that runs it
+    }
+}
+
+// A microtask queued before the run drains at the top of the first iteration. W sits in a slot before T,
+// the wake slot still runs it in T's pass.
+static void test_microtasks(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    for (int i = 0; i < 3; i++) {
+        mj_microtask_init(&micro[i], micro_run, (void*)(intptr_t)i);
+    }
+    hop_ctx init = {.name = 'W'};
+    mj_task* w = mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+    init.name = 'T';
+    init.trigger = true;
+    init.wake = &hop(w)->queue;
+    mj_test_task_add(scheduler, hop_run, "hop", &init, sizeof(init));
+
+    MJ_CHECK(mj_scheduler_microtask(scheduler, &micro[1]) == 0);
+    MJ_CHECK(mj_microtask_queued(&micro[1]));
+    log_reset();
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "2TW|") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+}
+
+typedef struct queuer_ctx {
+    int runs;
+    mj_wait_queue* wake;
+} queuer_ctx;
+
+static void queuer_run(mj_scheduler* scheduler, void* ctx) {
+    queuer_ctx* q = ctx;
+    if (q->runs++ == 0) {
+        return;
+    }
+    note('T');
+    MJ_CHECK(mj_scheduler_microtask(scheduler, &micro[0]) == 0);
+    MJ_CHECK(mj_scheduler_microtask(scheduler, &micro[1]) == 0);
+    MJ_CHECK(mj_scheduler_microtask(scheduler, &micro[0]) == 0); // already queued, runs once
+    MJ_CHECK(mj_wait_queue_wake_one(q->wake) == 1);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+// Microtasks queued by a run drain in order, including one queued by a microtask, before the wake slot
+static void test_drain_order(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    for (int i = 0; i < 3; i++) {
+        mj_microtask_init(&micro[i], micro_run, (void*)(intptr_t)i);
+    }
+    hop_ctx waiter = {.name = 'W'};
+    mj_task* w = mj_test_task_add(scheduler, hop_run, "hop", &waiter, sizeof(waiter));
+    queuer_ctx queuer = {.wake = &hop(w)->queue};
+    mj_test_task_add(scheduler, queuer_run, "queuer", &queuer, sizeof(queuer));
+
+    log_reset();
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "T123W") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+}
+
+int main(void) {
+    mj_timer_init(&pass_marker, marker_fired, NULL);
+    test_budget();
+    test_once_per_pass();
+    test_microtasks();
+    test_drain_order();
+    return 0;
+}
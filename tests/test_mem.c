@@ -0,0 +1,119 @@
+// Per-task memory accounting: allocations are charged to the running task and its group, a spawned task's
+// struct and ctx move from the spawner to the new task whether it is added, posted to its own scheduler or
+// posted to another, and the limit callback fires once per budget crossing, for the task and for the group.
+#include "mj_test.h"
+
+#define BUDGET 4096
+
+typedef struct limit_hit {
+    mj_task* task;
+    mj_mem_group* group;
+} limit_hit;
+
+static limit_hit hits[8];
+static int hit_count;
+static mj_mem_group group = {.name = "spawners", .budget = BUDGET * 2};
+static mj_scheduler* other;
+
+static void on_limit(mj_scheduler* scheduler, mj_task* task, mj_mem_group* hit_group) {
+    MJ_CHECK(hit_count < 8);
+    hits[hit_count].task = task;
+    hits[hit_count].group = hit_group;
+    hit_count++;
+}
+
+typedef struct child_ctx {
+    char payload[100];
+} child_ctx;
+
+// A spawned task carries exactly its own struct and ctx
+static void child_run(mj_scheduler* scheduler, void* ctx) {
+    mj_task* self = mj_scheduler_task_current(scheduler);
+    MJ_CHECK(mj_task_mem_bytes(self) == sizeof(mj_task) + sizeof(child_ctx));
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+// Built from inside a callback, so both allocations are charged to the spawner first
+static mj_task* child_new(mj_scheduler* scheduler) {
+    mj_task* task = mj_scheduler_calloc(scheduler, 1, sizeof(*task));
+    MJ_CHECK(task != NULL);
+    task->ctx = mj_scheduler_calloc(scheduler, 1, sizeof(child_ctx));
+    MJ_CHECK(task->ctx != NULL);
+    task->ctx_size = sizeof(child_ctx);
+    task->run = child_run;
+    task->name = "child";
+    return task;
+}
+
+typedef struct spawner_ctx {
+    int runs;
+} spawner_ctx;
+
+static void spawner_run(mj_scheduler* scheduler, void* ctx) {
+    spawner_ctx* spawner = ctx;
+    mj_task* self = mj_scheduler_task_current(scheduler);
+    size_t base = sizeof(mj_task) + sizeof(spawner_ctx);
+    MJ_CHECK(mj_task_mem_bytes(self) == base); // a posted child from the last run was handed over too
+    MJ_CHECK(group.bytes == base);
+    if (spawner->runs++ > 0) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    // Charged and uncharged by size, realloc moves the count both ways
+    char* buf = mj_scheduler_alloc(scheduler, 100);
+    MJ_CHECK(buf != NULL && mj_task_mem_bytes(self) == base + 100);
+    buf = mj_scheduler_realloc(scheduler, buf, 100, 300);
+    MJ_CHECK(buf != NULL && mj_task_mem_bytes(self) == base + 300 && group.bytes == base + 300);
+    buf = mj_scheduler_realloc(scheduler, buf, 300, 50);
+    MJ_CHECK(buf != NULL && mj_task_mem_bytes(self) == base + 50);
+    mj_scheduler_free(scheduler, buf, 50);
+    MJ_CHECK(mj_task_mem_bytes(self) == base && hit_count == 0);
+
+    // Staged add, post to this scheduler and post to one that is not running yet
+    MJ_CHECK(mj_scheduler_task_add(scheduler, child_new(scheduler)) == 0);
+    MJ_CHECK(mj_task_mem_bytes(self) == base);
+    MJ_CHECK(mj_scheduler_task_post(scheduler, child_new(scheduler)) == 0);
+    MJ_CHECK(mj_task_mem_bytes(self) == base);
+    MJ_CHECK(mj_scheduler_task_post(other, child_new(scheduler)) == 0);
+    MJ_CHECK(mj_task_mem_bytes(self) == base && group.bytes == base);
+
+    // Crossing the task budget fires once, further allocations above it do not
+    char* big = mj_scheduler_alloc(scheduler, BUDGET);
+    MJ_CHECK(hit_count == 1 && hits[0].task == self && hits[0].group == NULL);
+    char* more = mj_scheduler_alloc(scheduler, 10);
+    MJ_CHECK(hit_count == 1);
+
+    // Back under and over again is a new crossing, this time the group's too
+    mj_scheduler_free(scheduler, big, BUDGET);
+    MJ_CHECK(mj_task_mem_bytes(self) == base + 10);
+    big = mj_scheduler_alloc(scheduler, BUDGET * 2);
+    MJ_CHECK(hit_count == 3);
+    MJ_CHECK(hits[1].task == self && hits[1].group == NULL);
+    MJ_CHECK(hits[2].task == self && hits[2].group == &group);
+    mj_scheduler_free(scheduler, big, BUDGET * 2);
+    mj_scheduler_free(scheduler, more, 10);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    other = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL && other != NULL);
+    mj_scheduler_set_mem_limit_callback(scheduler, on_limit);
+
+    spawner_ctx spawner = {0};
+    mj_task* task = mj_test_task_new(scheduler, spawner_run, "spawner", &spawner, sizeof(spawner));
+    MJ_CHECK(mj_task_set_mem_group(task, &group) == 0);
+    MJ_CHECK(mj_task_set_mem_budget(task, sizeof(mj_task) + sizeof(spawner) + BUDGET / 2) == 0);
+    MJ_CHECK(mj_scheduler_task_add(scheduler, task) == 0);
+    MJ_CHECK(mj_task_mem_bytes(task) == sizeof(mj_task) + sizeof(spawner));
+
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(group.bytes == 0); // the spawner was the group's only task
+    MJ_CHECK(mj_scheduler_run(other) == 0);
+    MJ_CHECK(hit_count == 3);
+
+    MJ_CHECK(mj_scheduler_destroy(&other) == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Cross-thread task handling between two running schedulers: tasks posted from another thread, remote wakes
+// through the wake inbox, and a task migrating back and forth with its deadline, refused while a timer in
+// its ctx is armed.
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define HOPS 1000
+#define SLEEPY_HOPS 20
+#define POSTED 3
+
+static mj_scheduler* schedulers[2];
+static int posted_ran;          // atomic
+static mj_task* sleeper_handle; // atomic, set once the sleeper has parked
+static int sleeper_woken;       // atomic
+static int hopper_done;         // atomic
+
+static void posted_run(mj_scheduler* scheduler, void* ctx) {
+    MJ_CHECK(scheduler == schedulers[1]);
+    __atomic_add_fetch(&posted_ran, 1, __ATOMIC_RELAXED);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+typedef struct sleeper_ctx {
+    bool parked;
+    mj_wait_queue queue; // nothing on this thread ever wakes it
+} sleeper_ctx;
+
+// Parks with no deadline on a queue nobody wakes, only the main thread's mj_task_post_wake brings it back
+static void sleeper_run(mj_scheduler* scheduler, void* ctx) {
+    sleeper_ctx* sleeper = ctx;
+    if (!sleeper->parked) {
+        sleeper->parked = true;
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, &sleeper->queue, 0, NULL) == 0);
+        __atomic_store_n(&sleeper_handle, mj_scheduler_task_current(scheduler), __ATOMIC_RELEASE);
+        return;
+    }
+    MJ_CHECK(mj_scheduler_task_wait_result(scheduler) == 0);
+    __atomic_store_n(&sleeper_woken, 1, __ATOMIC_RELEASE);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+typedef struct hopper_ctx {
+    int hops;
+    bool slept;
+    mj_timer timer; // in ctx, so it pins the task to the scheduler it is armed on
+    mj_wait_queue fired;
+    mj_scheduler* fired_on;
+} hopper_ctx;
+
+static void hopper_timer(mj_scheduler* scheduler, void* arg) {
+    hopper_ctx* hopper = arg;
+    hopper->fired_on = scheduler;
+    mj_wait_queue_wake_all(&hopper->fired);
+}
+
+static void hopper_run(mj_scheduler* scheduler, void* ctx) {
+    hopper_ctx* hopper = ctx;
+    mj_scheduler* other = schedulers[scheduler == schedulers[0]];
+    MJ_CHECK(scheduler == schedulers[hopper->hops % 2]);
+
+    if (hopper->hops < HOPS) {
+        // The first hops sleep before they move, the deadline travels with the task
+        if (hopper->hops < SLEEPY_HOPS && !hopper->slept) {
+            MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 1) == 0);
+            MJ_CHECK(mj_scheduler_task_migrate_current(scheduler, other) == 0);
+            hopper->slept = true;
+            hopper->hops++;
+            return;
+        }
+        if (hopper->slept) {
+            MJ_CHECK(mj_scheduler_task_wait_result(scheduler) == ETIMEDOUT);
+            hopper->slept = false;
+        }
+        if (hopper->hops < SLEEPY_HOPS) {
+            return; // sleep again on this side before the next hop
+        }
+        MJ_CHECK(mj_scheduler_task_migrate_current(scheduler, other) == 0);
+        hopper->hops++;
+        return;
+    }
+
+    if (hopper->hops == HOPS) {
+        // A timer in ctx stays in this heap, so the task stays too until it is cancelled
+        mj_timer_init(&hopper->timer, hopper_timer, hopper);
+        MJ_CHECK(mj_scheduler_timer_arm(scheduler, &hopper->timer, mj_deadline_in_ms(1)) == 0);
+        MJ_CHECK(mj_scheduler_task_migrate_current(scheduler, other) == -1 && errno == EBUSY);
+        mj_scheduler_timer_cancel(scheduler, &hopper->timer);
+        MJ_CHECK(mj_scheduler_task_migrate_current(scheduler, other) == 0);
+        hopper->hops++;
+        return;
+    }
+
+    if (hopper->fired_on == NULL) {
+        MJ_CHECK(mj_scheduler_timer_arm(scheduler, &hopper->timer, mj_deadline_in_ms(1)) == 0);
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, &hopper->fired, 0, NULL) == 0);
+        return;
+    }
+    MJ_CHECK(hopper->fired_on == scheduler);
+    __atomic_store_n(&hopper_done, 1, __ATOMIC_RELEASE);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    for (int i = 0; i < 2; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+        mj_scheduler_hold(schedulers[i]); // keep running while tasks are in flight between them
+    }
+    hopper_ctx hopper = {0};
+    sleeper_ctx sleeper = {0};
+    mj_test_task_add(schedulers[0], hopper_run, "hopper", &hopper, sizeof(hopper));
+    mj_test_task_add(schedulers[0], sleeper_run, "sleeper", &sleeper, sizeof(sleeper));
+
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, core_thread, schedulers[i]) == 0);
+    }
+
+    // Posted from a thread that runs no scheduler
+    for (int i = 0; i < POSTED; i++) {
+        char unused = 0;
+        MJ_CHECK(mj_scheduler_task_post(schedulers[1], mj_test_task_new(schedulers[1], posted_run, "posted", &unused, sizeof(unused))) == 0);
+    }
+
+    // The handle is only safe to use inside an epoch
+    mj_task* handle;
+    while ((handle = __atomic_load_n(&sleeper_handle, __ATOMIC_ACQUIRE)) == NULL) {
+        sched_yield();
+    }
+    MJ_CHECK(mj_epoch_enter() == 0);
+    MJ_CHECK(mj_task_post_wake(handle) == 0);
+    mj_epoch_exit();
+
+    while (!__atomic_load_n(&hopper_done, __ATOMIC_ACQUIRE) || !__atomic_load_n(&sleeper_woken, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&posted_ran, __ATOMIC_RELAXED) < POSTED) {
+        sched_yield();
+    }
+    for (int i = 0; i < 2; i++) {
+        mj_scheduler_release(schedulers[i]);
+        pthread_join(threads[i], NULL);
+    }
+    MJ_CHECK(posted_ran == POSTED);
+    for (int i = 0; i < 2; i++) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Parallel loops over three scheduler threads: mj_parallel_for visits every index exactly once even when
+// the ranges are uneven enough to be stolen, mj_parallel_reduce combines the partials, and small and empty
+// ranges finish without trouble.
+#include "mj_parallel.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define CORES 3
+#define COUNT 200000
+#define SLOW_COUNT (COUNT / 4) // the front of the range costs more, so its worker falls behind
+
+static mj_scheduler* schedulers[CORES];
+static uint8_t visits[COUNT]; // chunks never overlap, so plain bytes are enough
+
+static void visit_range(mj_scheduler* scheduler, size_t begin, size_t end, void* arg) {
+    for (size_t i = begin; i < end; i++) {
+        if (i < SLOW_COUNT) {
+            volatile int spin = 0;
+            for (int k = 0; k < 200; k++) {
+                spin += k;
+            }
+        }
+        visits[i]++;
+    }
+}
+
+static void sum_range(mj_scheduler* scheduler, size_t begin, size_t end, void* partial, void* arg) {
+    for (size_t i = begin; i < end; i++) {
+        *(uint64_t*)partial += i;
+    }
+}
+
+static void add(void* result, const void* partial, void* arg) {
+    *(uint64_t*)result += *(const uint64_t*)partial;
+}
+
+static void check_visited_once(size_t end) {
+    for (size_t i = 0; i < COUNT; i++) {
+        MJ_CHECK(visits[i] == (i < end));
+        visits[i] = 0;
+    }
+}
+
+typedef struct caller_ctx {
+    int phase;
+    mj_parallel* job;
+    uint64_t sum;
+} caller_ctx;
+
+static void caller_run(mj_scheduler* scheduler, void* ctx) {
+    caller_ctx* caller = ctx;
+    switch (caller->phase) {
+    case 0:
+        if (mj_parallel_for(scheduler, &caller->job, schedulers, CORES, 0, COUNT, visit_range, NULL) != 0) {
+            MJ_CHECK(errno == EINPROGRESS && caller->job != NULL);
+            return;
+        }
+        MJ_CHECK(caller->job == NULL);
+        check_visited_once(COUNT);
+        caller->phase++;
+        return;
+    case 1:
+        if (mj_parallel_reduce(scheduler, &caller->job, schedulers, CORES, 7, COUNT, sum_range, add, &caller->sum,
+                               sizeof(caller->sum), NULL) != 0) {
+            MJ_CHECK(errno == EINPROGRESS);
+            return;
+        }
+        MJ_CHECK(caller->sum == (uint64_t)COUNT * (COUNT - 1) / 2 - 21);
+        caller->phase++;
+        return;
+    case 2:
+        // Fewer indices than schedulers
+        if (mj_parallel_for(scheduler, &caller->job, schedulers, CORES, 0, 2, visit_range, NULL) != 0) {
+            MJ_CHECK(errno == EINPROGRESS);
+            return;
+        }
+        check_visited_once(2);
+        caller->phase++;
+        return;
+    default:
+        // An empty range is done at once and leaves the identity in result
+        caller->sum = 42;
+        MJ_CHECK(mj_parallel_reduce(scheduler, &caller->job, schedulers, CORES, 5, 5, sum_range, add, &caller->sum,
+                                    sizeof(caller->sum), NULL) == 0);
+        MJ_CHECK(caller->sum == 42 && caller->job == NULL);
+        MJ_CHECK(mj_parallel_for(scheduler, &caller->job, schedulers, CORES, 5, 4, visit_range, NULL) == -1 && errno == EINVAL);
+        for (int i = 0; i < CORES; i++) {
+            mj_scheduler_release(schedulers[i]);
+        }
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    for (int i = 0; i < CORES; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+        mj_scheduler_hold(schedulers[i]); // idle until the caller posts workers to them
+    }
+    caller_ctx caller = {0};
+    mj_test_task_add(schedulers[0], caller_run, "parallel_caller", &caller, sizeof(caller));
+
+    pthread_t threads[CORES];
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, core_thread, schedulers[i]) == 0);
+    }
+    for (int i = 0; i < CORES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    return 0;
+}
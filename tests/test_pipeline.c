@@ -0,0 +1,117 @@
+// Two-lane pipeline on two scheduler threads: every item reaches the sink of its own lane, emits fan out,
+// closing the input drains each lane stage by stage, and the pipeline can be destroyed once done.
+#include "mj_pipeline.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define LANES 2
+#define ITEMS 10000
+#define PRODUCER_BATCH 7
+
+static mj_pipeline* pipeline;
+static long sums[LANES];
+static long counts[LANES];
+
+// Each item x becomes 2x and a 1
+static void double_stage(mj_scheduler* scheduler, mj_stage* stage, void** items, size_t count, void* user) {
+    for (size_t i = 0; i < count; i++) {
+        MJ_CHECK(mj_stage_emit(stage, (void*)((long)items[i] * 2)) == 0);
+        MJ_CHECK(mj_stage_emit(stage, (void*)1L) == 0);
+    }
+}
+
+static void inc_stage(mj_scheduler* scheduler, mj_stage* stage, void** items, size_t count, void* user) {
+    for (size_t i = 0; i < count; i++) {
+        MJ_CHECK(mj_stage_emit(stage, (void*)((long)items[i] + 1)) == 0);
+    }
+}
+
+static void sink_stage(mj_scheduler* scheduler, mj_stage* stage, void** items, size_t count, void* user) {
+    MJ_CHECK(mj_stage_emit(stage, NULL) == -1 && errno == EINVAL);
+    for (size_t i = 0; i < count; i++) {
+        sums[mj_stage_lane(stage)] += (long)items[i];
+        counts[mj_stage_lane(stage)]++;
+    }
+}
+
+typedef struct producer_ctx {
+    size_t lane;
+    long next;
+} producer_ctx;
+
+static void producer_run(mj_scheduler* scheduler, void* ctx) {
+    producer_ctx* producer = ctx;
+    mj_channel* input = mj_pipeline_input(pipeline, producer->lane);
+
+    void* batch[PRODUCER_BATCH];
+    size_t count = 0;
+    while (count < PRODUCER_BATCH && producer->next + (long)count < ITEMS) {
+        batch[count] = (void*)(producer->next + (long)count);
+        count++;
+    }
+    if (count == 0) {
+        mj_channel_close(input);
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    size_t sent = mj_channel_send_batch(input, batch, count);
+    producer->next += (long)sent;
+    if (sent < count) {
+        mj_scheduler_task_wait(scheduler, mj_channel_send_queue(input), 0, NULL);
+    }
+}
+
+static void* lane_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    mj_scheduler* schedulers[LANES];
+    for (size_t i = 0; i < LANES; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+    }
+
+    // Small channels so stages park for input and for room downstream
+    pipeline = mj_pipeline_create(schedulers[0], 16, 32);
+    MJ_CHECK(pipeline != NULL);
+    MJ_CHECK(mj_pipeline_add_stage(pipeline, "double", double_stage, NULL) == 0);
+    MJ_CHECK(mj_pipeline_add_stage(pipeline, "inc", inc_stage, NULL) == 1);
+    MJ_CHECK(mj_pipeline_add_stage(pipeline, "sink", sink_stage, NULL) == 2);
+    MJ_CHECK(mj_pipeline_input(pipeline, 0) == NULL);
+    MJ_CHECK(mj_pipeline_start(pipeline, schedulers, LANES) == 0);
+    MJ_CHECK(mj_pipeline_add_stage(pipeline, "late", sink_stage, NULL) == -1 && errno == EBUSY);
+    MJ_CHECK(mj_pipeline_destroy(&pipeline) == 1 && errno == EBUSY);
+
+    for (size_t i = 0; i < LANES; i++) {
+        producer_ctx producer = {.lane = i};
+        mj_test_task_add(schedulers[i], producer_run, "producer", &producer, sizeof(producer));
+    }
+    pthread_t threads[LANES];
+    for (size_t i = 0; i < LANES; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, lane_thread, schedulers[i]) == 0);
+    }
+    for (size_t i = 0; i < LANES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Per lane: the sum of 2x + 1 over 0..ITEMS-1 plus ITEMS twos
+    MJ_CHECK(mj_pipeline_done(pipeline));
+    for (size_t i = 0; i < LANES; i++) {
+        MJ_CHECK(counts[i] == 2 * ITEMS);
+        MJ_CHECK(sums[i] == (long)ITEMS * ITEMS + 2L * ITEMS);
+    }
+    mj_stage_stats stats;
+    MJ_CHECK(mj_pipeline_stats(pipeline, 1, &stats) == 0);
+    MJ_CHECK(stats.items_in == 2 * LANES * ITEMS && stats.items_out == stats.items_in);
+    MJ_CHECK(stats.queue_depth == 0);
+
+    MJ_CHECK(mj_pipeline_destroy(&pipeline) == 0 && pipeline == NULL);
+    for (size_t i = 0; i < LANES; i++) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Time-slice watchdog on one scheduler thread: a task spinning past a short slice sees
+// mj_preempt_should_yield turn true and is counted once by mj_preempt_overruns, the flag is clear again
+// for the next task's run and for the spinner's own next run.
+#include "mj_preempt.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <time.h>
+
+#define SLICE_NS 2000000ULL
+#define SPIN_LIMIT_NS 2000000000ULL // never flagged within this much CPU time means the watchdog is broken
+
+static bool spinner_done;
+
+static uint64_t cpu_now_ns(void) {
+    struct timespec ts;
+    MJ_CHECK(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Burns CPU until the watchdog flags the run or for ns of CPU time, whichever comes first
+static bool spin(uint64_t ns) {
+    volatile uint64_t sink = 0;
+    uint64_t start = cpu_now_ns();
+    while (cpu_now_ns() - start < ns) {
+        if (mj_preempt_should_yield()) {
+            return true;
+        }
+        sink++;
+    }
+    return false;
+}
+
+typedef struct spinner_ctx {
+    int runs;
+} spinner_ctx;
+
+static void spinner_run(mj_scheduler* scheduler, void* ctx) {
+    spinner_ctx* spinner = ctx;
+    MJ_CHECK(!mj_preempt_should_yield()); // a new run starts clear
+    if (spinner->runs++ == 0) {
+        uint64_t before = mj_preempt_overruns();
+        MJ_CHECK(spin(SPIN_LIMIT_NS));
+        MJ_CHECK(mj_preempt_overruns() == before + 1);
+
+        // Ticks that land later in the same run flag nothing more
+        spin(SLICE_NS * 5);
+        MJ_CHECK(mj_preempt_should_yield());
+        MJ_CHECK(mj_preempt_overruns() == before + 1);
+        return;
+    }
+    MJ_CHECK(!spin(SLICE_NS / 10));
+    spinner_done = true;
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+// Runs right after the spinner in every pass, its short runs are never flagged
+static void quick_run(mj_scheduler* scheduler, void* ctx) {
+    MJ_CHECK(!mj_preempt_should_yield());
+    if (spinner_done) {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+int main(void) {
+    MJ_CHECK(mj_preempt_start(0) == -1 && errno == EINVAL);
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    spinner_ctx spinner = {0};
+    mj_test_task_add(scheduler, spinner_run, "spinner", &spinner, sizeof(spinner));
+    char unused = 0;
+    mj_test_task_add(scheduler, quick_run, "quick", &unused, sizeof(unused));
+
+    MJ_CHECK(mj_preempt_start(SLICE_NS) == 0);
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    mj_preempt_stop();
+    MJ_CHECK(spinner_done);
+    MJ_CHECK(mj_preempt_overruns() == 1);
+    MJ_CHECK(!mj_preempt_should_yield());
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
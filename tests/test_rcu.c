@@ -0,0 +1,108 @@
+// RCU cells read from several scheduler threads while a task publishes: readers never see a freed
+// snapshot, retired snapshots are freed by the publishing scheduler's loop, and nothing leaks.
+#include "mj_rcu.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define CORES 4
+#define PUBLISHES 2000
+#define SNAPSHOT_LIVE 0x5eed5eedu
+
+typedef struct snapshot {
+    uint32_t magic; // SNAPSHOT_LIVE until freed
+    int version;
+} snapshot;
+
+static mj_rcu_cell* cell;
+static int stop;  // atomic, the publisher is done
+static int freed; // atomic
+
+static snapshot* snapshot_new(int version) {
+    snapshot* s = malloc(sizeof(*s));
+    MJ_CHECK(s != NULL);
+    s->magic = SNAPSHOT_LIVE;
+    s->version = version;
+    return s;
+}
+
+static void snapshot_free(void* p, void* user) {
+    snapshot* s = p;
+    __atomic_store_n(&s->magic, 0, __ATOMIC_RELAXED);
+    free(s);
+    __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct reader_ctx {
+    int last_version;
+} reader_ctx;
+
+static void reader_run(mj_scheduler* scheduler, void* ctx) {
+    reader_ctx* reader = ctx;
+    const snapshot* s = mj_rcu_read(cell);
+    MJ_CHECK(__atomic_load_n(&s->magic, __ATOMIC_RELAXED) == SNAPSHOT_LIVE);
+    MJ_CHECK(s->version >= reader->last_version);
+    reader->last_version = s->version;
+    if (__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+typedef struct publisher_ctx {
+    int version;
+} publisher_ctx;
+
+static void publisher_run(mj_scheduler* scheduler, void* ctx) {
+    publisher_ctx* publisher = ctx;
+    MJ_CHECK(mj_rcu_publish(scheduler, cell, snapshot_new(++publisher->version)) == 0);
+    if (publisher->version < PUBLISHES) {
+        return;
+    }
+
+    // Reclamation kept up while the readers ran, it did not wait for the end
+    MJ_CHECK(__atomic_load_n(&freed, __ATOMIC_RELAXED) > 0);
+    MJ_CHECK(mj_rcu_pending(cell) < PUBLISHES);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    mj_scheduler* schedulers[CORES];
+    for (int i = 0; i < CORES; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+        reader_ctx reader = {0};
+        mj_test_task_add(schedulers[i], reader_run, "rcu_reader", &reader, sizeof(reader));
+    }
+    cell = mj_rcu_create(schedulers[0], snapshot_new(0), snapshot_free, NULL);
+    MJ_CHECK(cell != NULL);
+    publisher_ctx publisher = {0};
+    mj_test_task_add(schedulers[0], publisher_run, "rcu_publisher", &publisher, sizeof(publisher));
+
+    pthread_t threads[CORES];
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, core_thread, schedulers[i]) == 0);
+    }
+    for (int i = 0; i < CORES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Snapshots retired in the last iterations wait in scheduler 0's list until it is destroyed
+    for (int i = CORES - 1; i > 0; i--) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    if (mj_rcu_pending(cell) > 0) {
+        MJ_CHECK(mj_rcu_destroy(&cell) == 1 && errno == EBUSY);
+    }
+    MJ_CHECK(mj_scheduler_destroy(&schedulers[0]) == 0);
+    MJ_CHECK(mj_rcu_pending(cell) == 0);
+    MJ_CHECK(__atomic_load_n(&freed, __ATOMIC_RELAXED) == PUBLISHES);
+    MJ_CHECK(mj_rcu_destroy(&cell) == 0 && cell == NULL);
+    MJ_CHECK(freed == PUBLISHES + 1);
+    return 0;
+}
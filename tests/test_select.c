@@ -0,0 +1,130 @@
+// mj_scheduler_task_select over two channels, a pipe and a deadline on one scheduler: the fired index names
+// the source that woke the task, the sources that lost are left without a registration, and the deadline
+// and token end a select with -1. A driver task sets off one source per stage once the selector has parked.
+#include "mj_channel.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+enum { STAGE_CHANNEL, STAGE_FD, STAGE_DEADLINE, STAGE_CANCEL, STAGES };
+
+static mj_channel* channels[2];
+static int pipe_fds[2];
+static mj_cancel_token token = MJ_CANCEL_TOKEN_INIT;
+static mj_wait_queue driver_queue;
+static int stage;
+
+typedef struct selector_ctx {
+    bool selecting;
+    uint64_t selected_at;
+    mj_select_case cases[2];
+} selector_ctx;
+
+static void check_unregistered(void) {
+    MJ_CHECK(mj_wait_queue_empty(mj_channel_recv_queue(channels[0])));
+    MJ_CHECK(mj_wait_queue_empty(mj_channel_recv_queue(channels[1])));
+    MJ_CHECK(mj_wait_queue_empty(&token.waiters));
+}
+
+static void selector_run(mj_scheduler* scheduler, void* ctx) {
+    selector_ctx* selector = ctx;
+    if (selector->selecting) {
+        int fired = mj_scheduler_task_select_fired(scheduler);
+        int result = mj_scheduler_task_wait_result(scheduler);
+        check_unregistered();
+        void* item;
+        char byte;
+        switch (stage) {
+        case STAGE_CHANNEL:
+            MJ_CHECK(fired == 1 && result == 0);
+            MJ_CHECK(mj_channel_try_recv(channels[1], &item) == 0 && item == (void*)channels);
+            break;
+        case STAGE_FD:
+            MJ_CHECK(fired == MJ_SELECT_FD && result == 0);
+            MJ_CHECK(mj_scheduler_task_io_revents(scheduler) & POLLIN);
+            MJ_CHECK(read(pipe_fds[0], &byte, 1) == 1);
+            break;
+        case STAGE_DEADLINE:
+            MJ_CHECK(fired == -1 && result == ETIMEDOUT);
+            MJ_CHECK(mj_time_now_ns() - selector->selected_at >= 20 * 1000000ULL);
+            break;
+        default:
+            MJ_CHECK(fired == -1 && result == ECANCELED);
+        }
+        stage++;
+    }
+    if (stage == STAGES) {
+        MJ_CHECK(mj_wait_queue_wake_one(&driver_queue) == 1); // so it can leave too
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+
+    // Nothing is ready, every source is checked before selecting
+    void* item;
+    MJ_CHECK(mj_channel_try_recv(channels[0], &item) == -1 && errno == EAGAIN);
+    MJ_CHECK(mj_channel_try_recv(channels[1], &item) == -1 && errno == EAGAIN);
+    for (int i = 0; i < 2; i++) {
+        selector->cases[i].queue = mj_channel_recv_queue(channels[i]);
+    }
+    selector->selecting = true;
+    selector->selected_at = mj_time_now_ns();
+    MJ_CHECK(mj_scheduler_task_select(scheduler, selector->cases, 2, pipe_fds[0], POLLIN, mj_deadline_in_ms(20), &token) == 0);
+    MJ_CHECK(!mj_wait_queue_empty(mj_channel_recv_queue(channels[0])) && !mj_wait_queue_empty(&token.waiters));
+    MJ_CHECK(mj_wait_queue_wake_one(&driver_queue) == 1);
+}
+
+// Parked between stages, woken by the selector once it is parked in its next select
+static void driver_run(mj_scheduler* scheduler, void* ctx) {
+    int* started = ctx;
+    if (!*started) {
+        *started = 1;
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, &driver_queue, 0, NULL) == 0);
+        return;
+    }
+    char byte = 1;
+    switch (stage) {
+    case STAGE_CHANNEL:
+        MJ_CHECK(mj_channel_try_send(channels[1], channels) == 0);
+        break;
+    case STAGE_FD:
+        MJ_CHECK(write(pipe_fds[1], &byte, 1) == 1);
+        break;
+    case STAGE_DEADLINE:
+        break; // nothing, the deadline ends it
+    case STAGE_CANCEL:
+        mj_cancel_token_cancel(&token);
+        break;
+    default:
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    MJ_CHECK(mj_scheduler_task_wait(scheduler, &driver_queue, 0, NULL) == 0);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    for (int i = 0; i < 2; i++) {
+        channels[i] = mj_channel_create(scheduler, 4);
+        MJ_CHECK(channels[i] != NULL);
+    }
+    MJ_CHECK(pipe(pipe_fds) == 0);
+
+    int started = 0;
+    mj_test_task_add(scheduler, driver_run, "driver", &started, sizeof(started));
+    selector_ctx selector = {0};
+    mj_test_task_add(scheduler, selector_run, "selector", &selector, sizeof(selector));
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(stage == STAGES);
+
+    // The losing registrations are gone, a send now wakes nobody and the channels can be destroyed
+    MJ_CHECK(mj_channel_try_send(channels[0], channels) == 0);
+    for (int i = 0; i < 2; i++) {
+        MJ_CHECK(mj_channel_destroy(&channels[i]) == 0);
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Shard group on three scheduler threads: every submission runs on the core that owns its key, so per-key
+// state needs no locks, futures come back to the submitting core, and a full ring turns into EAGAIN.
+#include "mj_shard.h"
+#include "mj_test.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define CORES 3
+#define CLIENTS 2 // per core, next to the shard task
+#define ROUNDS 400
+#define WINDOW 12 // submissions in flight per client, more than the ring holds
+#define KEYS 64
+
+static mj_scheduler* schedulers[CORES];
+static mj_shard_group* group;
+static int counts[KEYS];  // only touched by the owning core
+static int clients_left;  // atomic
+static int rejected;      // atomic
+
+static uint64_t key_hash(int key) {
+    return mj_shard_hash(&key, sizeof(key));
+}
+
+static void* count_key(mj_scheduler* scheduler, void* arg) {
+    int key = (int)(intptr_t)arg;
+    MJ_CHECK(scheduler == schedulers[mj_shard_owner(group, key_hash(key))]);
+    counts[key]++;
+    return (void*)(intptr_t)(key + 1);
+}
+
+typedef struct client_ctx {
+    int id;
+    int next;
+    int waited;
+    int pending;
+    int keys[WINDOW];
+    mj_future futures[WINDOW];
+} client_ctx;
+
+static int client_key(int id, int round) {
+    return (id * 7 + round * 5) % KEYS;
+}
+
+// Fills a window of submissions, every other one fire-and-forget, then collects the futures in order
+static void client_run(mj_scheduler* scheduler, void* ctx) {
+    client_ctx* client = ctx;
+    for (;;) {
+        while (client->waited < client->pending) {
+            mj_future* future = &client->futures[client->waited];
+            if (!mj_future_ready(future)) {
+                MJ_CHECK(mj_future_wait(scheduler, future, 0, NULL) == 0);
+                return;
+            }
+            MJ_CHECK((intptr_t)mj_future_result(future) == client->keys[client->waited] + 1);
+            client->waited++;
+        }
+        client->waited = 0;
+        client->pending = 0;
+
+        if (client->next == ROUNDS) {
+            mj_shard_flush(group, scheduler);
+            if (__atomic_sub_fetch(&clients_left, 1, __ATOMIC_ACQ_REL) == 0) {
+                mj_shard_group_stop(group);
+            }
+            mj_scheduler_task_remove_current(scheduler);
+            return;
+        }
+
+        bool full = false;
+        while (client->pending < WINDOW && client->next < ROUNDS) {
+            int key = client_key(client->id, client->next);
+            mj_future* future = NULL;
+            if (client->next % 2 == 0) {
+                future = &client->futures[client->pending];
+                mj_future_init(future);
+                client->keys[client->pending] = key;
+            }
+            if (mj_shard_submit(group, scheduler, key_hash(key), count_key, (void*)(intptr_t)key, future) != 0) {
+                MJ_CHECK(errno == EAGAIN);
+                __atomic_add_fetch(&rejected, 1, __ATOMIC_RELAXED);
+                full = true;
+                break;
+            }
+            client->pending += future != NULL;
+            client->next++;
+        }
+        if (full && client->pending == 0) {
+            MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 1) == 0); // give the owner time to drain
+            return;
+        }
+    }
+}
+
+static void* core_thread(void* arg) {
+    MJ_CHECK(mj_scheduler_run(arg) == 0);
+    return NULL;
+}
+
+int main(void) {
+    for (int i = 0; i < CORES; i++) {
+        schedulers[i] = mj_scheduler_create();
+        MJ_CHECK(schedulers[i] != NULL);
+    }
+    group = mj_shard_group_create(schedulers, CORES, 4);
+    MJ_CHECK(group != NULL);
+
+    // Every core owns part of the key space
+    int owned[CORES] = {0};
+    for (int key = 0; key < KEYS; key++) {
+        size_t owner = mj_shard_owner(group, key_hash(key));
+        MJ_CHECK(owner < CORES);
+        owned[owner]++;
+    }
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(owned[i] > 0);
+    }
+
+    clients_left = CORES * CLIENTS;
+    for (int i = 0; i < CORES * CLIENTS; i++) {
+        client_ctx client = {.id = i};
+        mj_test_task_add(schedulers[i % CORES], client_run, "shard_client", &client, sizeof(client));
+    }
+    pthread_t threads[CORES];
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(pthread_create(&threads[i], NULL, core_thread, schedulers[i]) == 0);
+    }
+    for (int i = 0; i < CORES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Fire-and-forget submissions were flushed before the stop, so none were lost
+    int expected[KEYS] = {0};
+    for (int id = 0; id < CORES * CLIENTS; id++) {
+        for (int round = 0; round < ROUNDS; round++) {
+            expected[client_key(id, round)]++;
+        }
+    }
+    for (int key = 0; key < KEYS; key++) {
+        MJ_CHECK(counts[key] == expected[key]);
+    }
+    MJ_CHECK(rejected > 0);
+
+    MJ_CHECK(mj_shard_group_destroy(&group) == 0 && group == NULL);
+    for (int i = 0; i < CORES; i++) {
+        MJ_CHECK(mj_scheduler_destroy(&schedulers[i]) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Tasks added during a pass are staged: they first run in the next pass even when a free slot lies ahead of
+// the loop, they attach in the order they were added, their slots are reserved right away, and they have no
+// scheduler for mj_task_post_wake until attached. A timer armed in the past logs | between passes.
+#include "mj_test.h"
+#include <errno.h>
+
+static char log_buf[32];
+static size_t log_len;
+static mj_timer pass_marker;
+
+static void note(char c) {
+    MJ_CHECK(log_len + 1 < sizeof(log_buf));
+    log_buf[log_len++] = c;
+    log_buf[log_len] = '\0';
+}
+
+static void marker_fired(mj_scheduler* scheduler, void* arg) {
+    note('|');
+}
+
+typedef struct named_ctx {
+    char name;
+    int runs;
+} named_ctx;
+
+// A leaves in the first pass, freeing a slot behind the spawner. B stays for two passes, the spawned ones for one.
+static void named_run(mj_scheduler* scheduler, void* ctx) {
+    named_ctx* named = ctx;
+    note(named->name);
+    if (named->name != 'B' || ++named->runs == 2) {
+        mj_scheduler_task_remove_current(scheduler);
+    }
+}
+
+static void spawner_run(mj_scheduler* scheduler, void* ctx) {
+    named_ctx* spawner = ctx;
+    note(spawner->name);
+    if (spawner->runs++ > 0) {
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    MJ_CHECK(mj_scheduler_timer_arm(scheduler, &pass_marker, mj_time_now_ns()) == 0);
+
+    // Slot 0 is free behind this task, 3 and 4 ahead of it
+    mj_task* first = NULL;
+    for (char name = 'X'; name <= 'Z'; name++) {
+        named_ctx spawned = {.name = name};
+        mj_task* task = mj_test_task_add(scheduler, named_run, "spawned", &spawned, sizeof(spawned));
+        if (first == NULL) {
+            first = task;
+        }
+    }
+    MJ_CHECK(mj_task_post_wake(first) == -1 && errno == EINVAL);
+
+    // Every slot is promised now, to running or staged tasks
+    named_ctx extra = {.name = 'E'};
+    mj_task* task = mj_test_task_new(scheduler, named_run, "spawned", &extra, sizeof(extra));
+    MJ_CHECK(mj_scheduler_task_add(scheduler, task) == -1 && errno == ENOMEM);
+    const mj_allocator* allocator = mj_scheduler_get_allocator(scheduler);
+    allocator->free(allocator->user, task->ctx, task->ctx_size);
+    allocator->free(allocator->user, task, sizeof(*task));
+}
+
+int main(void) {
+    MJ_CHECK(MAX_TASKS == 5);
+    mj_timer_init(&pass_marker, marker_fired, NULL);
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+
+    named_ctx init = {.name = 'A'};
+    mj_test_task_add(scheduler, named_run, "named", &init, sizeof(init));
+    init.name = 'S';
+    mj_test_task_add(scheduler, spawner_run, "spawner", &init, sizeof(init));
+    init.name = 'B';
+    mj_test_task_add(scheduler, named_run, "named", &init, sizeof(init));
+
+    // X, Y and Z take slots 0, 3 and 4 in add order after the first pass
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "ASB|XSBYZ") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Task-local storage on one scheduler: values are per task, and on remove the cleanup callback still sees
+// them, then destructors run in key order for non-NULL values only, before the task's arena is released.
+// The log holds C for a cleanup and the first character of every value a destructor got.
+#include "mj_test.h"
+#include <errno.h>
+
+static char log_buf[32];
+static size_t log_len;
+static mj_tls_key name_key;  // destructor logs
+static mj_tls_key plain_key; // no destructor
+static mj_tls_key arena_key; // destructor logs, value lives in the task's arena
+
+static void note(char c) {
+    MJ_CHECK(log_len + 1 < sizeof(log_buf));
+    log_buf[log_len++] = c;
+    log_buf[log_len] = '\0';
+}
+
+static void value_destroy(void* value) {
+    note(*(const char*)value);
+}
+
+typedef struct holder_ctx {
+    const char* name;
+    bool set;
+} holder_ctx;
+
+static void holder_cleanup(mj_scheduler* scheduler, void* ctx) {
+    holder_ctx* holder = ctx;
+    note('C');
+    MJ_CHECK(mj_scheduler_tls_get(scheduler, name_key) == holder->name);
+}
+
+static void holder_run(mj_scheduler* scheduler, void* ctx) {
+    holder_ctx* holder = ctx;
+    if (!holder->set) {
+        holder->set = true;
+        MJ_CHECK(mj_scheduler_tls_get(scheduler, name_key) == NULL);
+        MJ_CHECK(mj_scheduler_tls_set(scheduler, name_key, (void*)holder->name) == 0);
+        MJ_CHECK(mj_scheduler_tls_set(scheduler, plain_key, holder) == 0);
+        if (holder->name[0] == 'a') {
+            char* value = mj_scheduler_arena_alloc(scheduler, 2);
+            MJ_CHECK(value != NULL);
+            strcpy(value, "z");
+            MJ_CHECK(mj_scheduler_tls_set(scheduler, arena_key, value) == 0);
+        } else {
+            // Set and cleared again, no destructor for it
+            MJ_CHECK(mj_scheduler_tls_set(scheduler, arena_key, "x") == 0);
+            MJ_CHECK(mj_scheduler_tls_set(scheduler, arena_key, NULL) == 0);
+        }
+        MJ_CHECK(mj_scheduler_tls_set(scheduler, MJ_TLS_SLOTS, holder) == -1 && errno == EINVAL);
+        return;
+    }
+
+    // Each task reads back its own values
+    MJ_CHECK(mj_scheduler_tls_get(scheduler, name_key) == holder->name);
+    MJ_CHECK(mj_scheduler_tls_get(scheduler, plain_key) == holder);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+int main(void) {
+    MJ_CHECK(mj_tls_key_create(&name_key, value_destroy) == 0);
+    MJ_CHECK(mj_tls_key_create(&plain_key, NULL) == 0);
+    MJ_CHECK(mj_tls_key_create(&arena_key, value_destroy) == 0);
+    MJ_CHECK(name_key < plain_key && plain_key < arena_key);
+    mj_tls_key spare;
+    for (int i = 3; i < MJ_TLS_SLOTS; i++) {
+        MJ_CHECK(mj_tls_key_create(&spare, NULL) == 0);
+    }
+    MJ_CHECK(mj_tls_key_create(&spare, NULL) == -1 && errno == ENOMEM);
+    MJ_CHECK(mj_tls_key_create(NULL, NULL) == -1 && errno == EINVAL);
+
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    MJ_CHECK(mj_scheduler_tls_set(scheduler, name_key, "x") == -1 && errno == EINVAL); // outside a task callback
+    MJ_CHECK(mj_scheduler_tls_get(scheduler, name_key) == NULL);
+
+    const char* names[] = {"a", "b"};
+    for (int i = 0; i < 2; i++) {
+        holder_ctx holder = {.name = names[i]};
+        mj_task* task = mj_test_task_add(scheduler, holder_run, "holder", &holder, sizeof(holder));
+        task->cleanup = holder_cleanup;
+    }
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(strcmp(log_buf, "CazCb") == 0);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Broadcast topics: per-subscriber cursors once the ring wraps, the DROP and CATCH_UP lag policies, free_fn
+// called exactly once per message on overwrite or destroy, and a parked subscriber task woken by publish and
+// close on one scheduler.
+#include "mj_test.h"
+#include "mj_topic.h"
+#include <errno.h>
+
+#define MESSAGES 32
+
+static int freed[MESSAGES]; // times free_fn saw each message
+
+static void* message(int id) {
+    int* msg = malloc(sizeof(*msg));
+    MJ_CHECK(msg != NULL);
+    *msg = id;
+    return msg;
+}
+
+static void message_free(void* msg, void* user) {
+    MJ_CHECK(user == freed);
+    freed[*(int*)msg]++;
+    free(msg);
+}
+
+static int read_id(mj_topic_sub* sub) {
+    const void* msg;
+    size_t len = 0;
+    MJ_CHECK(mj_topic_next(sub, &msg, &len) == 0);
+    MJ_CHECK(len == sizeof(int));
+    return *(const int*)msg;
+}
+
+static void publish_range(mj_topic* topic, int from, int to) {
+    for (int id = from; id < to; id++) {
+        MJ_CHECK(mj_topic_publish(topic, message(id), sizeof(int)) == 0);
+    }
+}
+
+static void check_freed(int count) {
+    for (int id = 0; id < MESSAGES; id++) {
+        MJ_CHECK(freed[id] == (id < count));
+        freed[id] = 0;
+    }
+}
+
+static void test_drop(mj_scheduler* scheduler) {
+    mj_topic* topic = mj_topic_create(scheduler, 4, MJ_TOPIC_DROP, message_free, freed);
+    MJ_CHECK(topic != NULL);
+    mj_topic_sub* fast = mj_topic_subscribe(topic);
+    mj_topic_sub* slow = mj_topic_subscribe(topic);
+    MJ_CHECK(fast && slow && mj_topic_subscribers(topic) == 2);
+
+    // fast keeps up while the ring wraps, the overwritten messages are freed as they go
+    for (int id = 0; id < 6; id++) {
+        publish_range(topic, id, id + 1);
+        MJ_CHECK(read_id(fast) == id);
+    }
+    MJ_CHECK(freed[0] == 1 && freed[1] == 1 && freed[2] == 0);
+    const void* msg;
+    MJ_CHECK(mj_topic_next(fast, &msg, NULL) == -1 && errno == EAGAIN);
+
+    // slow still points at message 0, it is dropped for good
+    MJ_CHECK(mj_topic_sub_lag(slow) == 6);
+    MJ_CHECK(mj_topic_next(slow, &msg, NULL) == -1 && errno == ECONNRESET);
+    publish_range(topic, 6, 7);
+    MJ_CHECK(mj_topic_next(slow, &msg, NULL) == -1 && errno == ECONNRESET);
+    MJ_CHECK(read_id(fast) == 6);
+
+    MJ_CHECK(mj_topic_destroy(&topic) == 1 && errno == EBUSY);
+    MJ_CHECK(mj_topic_unsubscribe(&slow) == 0 && slow == NULL);
+    MJ_CHECK(mj_topic_unsubscribe(&fast) == 0);
+    MJ_CHECK(mj_topic_destroy(&topic) == 0 && topic == NULL);
+    check_freed(7);
+}
+
+static void test_catch_up(mj_scheduler* scheduler) {
+    mj_topic* topic = mj_topic_create(scheduler, 4, MJ_TOPIC_CATCH_UP, message_free, freed);
+    MJ_CHECK(topic != NULL);
+    mj_topic_sub* early = mj_topic_subscribe(topic);
+    publish_range(topic, 0, 3);
+    mj_topic_sub* late = mj_topic_subscribe(topic); // starts at message 3
+    MJ_CHECK(read_id(early) == 0 && read_id(early) == 1);
+
+    // The ring now holds 6..9, each cursor jumps there and counts what it skipped
+    publish_range(topic, 3, 10);
+    MJ_CHECK(mj_topic_sub_lag(early) == 8 && mj_topic_sub_lag(late) == 7);
+    MJ_CHECK(read_id(late) == 6 && mj_topic_sub_missed(late) == 3);
+    MJ_CHECK(read_id(early) == 6 && mj_topic_sub_missed(early) == 4);
+    for (int id = 7; id < 10; id++) {
+        MJ_CHECK(read_id(early) == id);
+    }
+    const void* msg;
+    MJ_CHECK(mj_topic_next(early, &msg, NULL) == -1 && errno == EAGAIN);
+    MJ_CHECK(mj_topic_sub_lag(early) == 0 && mj_topic_sub_lag(late) == 3);
+
+    // A closed topic keeps what it holds for the subscribers that are behind, then says EPIPE
+    mj_topic_close(topic);
+    int* rejected = message(MESSAGES - 1);
+    MJ_CHECK(mj_topic_publish(topic, rejected, sizeof(int)) == -1 && errno == EPIPE);
+    free(rejected); // still ours, free_fn did not see it
+    MJ_CHECK(read_id(late) == 7 && read_id(late) == 8 && read_id(late) == 9);
+    MJ_CHECK(mj_topic_next(late, &msg, NULL) == -1 && errno == EPIPE);
+    MJ_CHECK(mj_topic_published(topic) == 10);
+
+    mj_topic_unsubscribe(&early);
+    mj_topic_unsubscribe(&late);
+    MJ_CHECK(mj_topic_destroy(&topic) == 0);
+    check_freed(10);
+}
+
+static mj_topic* live;
+
+typedef struct reader_ctx {
+    mj_topic_sub* sub;
+    int next_id;
+} reader_ctx;
+
+static void reader_run(mj_scheduler* scheduler, void* ctx) {
+    reader_ctx* reader = ctx;
+    if (reader->sub == NULL) {
+        reader->sub = mj_topic_subscribe(live);
+        MJ_CHECK(reader->sub != NULL);
+    }
+    const void* msg;
+    while (mj_topic_next(reader->sub, &msg, NULL) == 0) {
+        MJ_CHECK(*(const int*)msg == reader->next_id++);
+    }
+    if (errno == EAGAIN) {
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, mj_topic_queue(live), 0, NULL) == 0);
+        return;
+    }
+    MJ_CHECK(errno == EPIPE && reader->next_id == MESSAGES);
+    mj_topic_unsubscribe(&reader->sub);
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+typedef struct writer_ctx {
+    int next_id;
+} writer_ctx;
+
+// One message per pass so the readers park in between, then close
+static void writer_run(mj_scheduler* scheduler, void* ctx) {
+    writer_ctx* writer = ctx;
+    if (writer->next_id == MESSAGES) {
+        mj_topic_close(live);
+        mj_scheduler_task_remove_current(scheduler);
+        return;
+    }
+    MJ_CHECK(!mj_wait_queue_empty(mj_topic_queue(live)));
+    publish_range(live, writer->next_id, writer->next_id + 1);
+    writer->next_id++;
+}
+
+static void test_parked_readers(mj_scheduler* scheduler) {
+    live = mj_topic_create(scheduler, MESSAGES, MJ_TOPIC_DROP, message_free, freed);
+    MJ_CHECK(live != NULL);
+    reader_ctx reader = {0};
+    for (int i = 0; i < 2; i++) {
+        mj_test_task_add(scheduler, reader_run, "topic_reader", &reader, sizeof(reader));
+    }
+    writer_ctx writer = {0};
+    mj_test_task_add(scheduler, writer_run, "topic_writer", &writer, sizeof(writer));
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(mj_topic_subscribers(live) == 0);
+    MJ_CHECK(mj_topic_destroy(&live) == 0);
+    check_freed(MESSAGES);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    MJ_CHECK(mj_topic_create(scheduler, 0, MJ_TOPIC_DROP, NULL, NULL) == NULL && errno == EINVAL);
+    test_drop(scheduler);
+    test_catch_up(scheduler);
+    test_parked_readers(scheduler);
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}
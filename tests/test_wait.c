@@ -0,0 +1,118 @@
+// Wait queues with deadlines and cancellation tokens on one scheduler: a queue wake ends the wait with 0, the
+// deadline with ETIMEDOUT and the token with ECANCELED. A task removed while parked is taken off its queue,
+// token and deadline, and misuse of mj_scheduler_task_wait fails without parking.
+#include "mj_test.h"
+#include <errno.h>
+
+#define NEVER_MS 10000 // deadlines that must not be what ends the test
+
+enum { WOKEN, TIMED, CANCELLED, REMOVED, WAITERS };
+
+static mj_wait_queue queues[WAITERS];
+static mj_cancel_token token = MJ_CANCEL_TOKEN_INIT;
+static mj_cancel_token removed_token = MJ_CANCEL_TOKEN_INIT;
+static int results[WAITERS];
+static int done; // waiters that saw their result
+
+typedef struct waiter_ctx {
+    int kind;
+    bool parked;
+    uint64_t parked_at;
+} waiter_ctx;
+
+static void waiter_run(mj_scheduler* scheduler, void* ctx) {
+    waiter_ctx* waiter = ctx;
+    mj_wait_queue* queue = &queues[waiter->kind];
+    if (!waiter->parked) {
+        waiter->parked = true;
+        waiter->parked_at = mj_time_now_ns();
+        switch (waiter->kind) {
+        case WOKEN:
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, mj_deadline_in_ms(NEVER_MS), NULL) == 0);
+            break;
+        case TIMED:
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, mj_deadline_in_ms(20), NULL) == 0);
+            break;
+        case CANCELLED:
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, 0, &token) == 0);
+            break;
+        default:
+            // Parked on all three and gone in the same run, nothing may be left behind
+            MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, mj_deadline_in_ms(NEVER_MS), &removed_token) == 0);
+            MJ_CHECK(!mj_wait_queue_empty(queue));
+            MJ_CHECK(mj_scheduler_task_remove_current(scheduler) == 0);
+            MJ_CHECK(mj_wait_queue_empty(queue) && mj_wait_queue_empty(&removed_token.waiters));
+        }
+        return;
+    }
+
+    results[waiter->kind] = mj_scheduler_task_wait_result(scheduler);
+    done++;
+    if (waiter->kind == TIMED) {
+        MJ_CHECK(mj_time_now_ns() - waiter->parked_at >= 20 * 1000000ULL);
+    }
+    if (waiter->kind == CANCELLED) {
+        // The token stays cancelled, later waits on it fail at once
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, 0, &token) == -1 && errno == ECANCELED);
+    }
+    if (waiter->kind == WOKEN) {
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, NULL, 0, NULL) == -1 && errno == EINVAL);
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, 0, NULL) == 0);
+        MJ_CHECK(mj_scheduler_task_wait(scheduler, queue, 0, NULL) == -1 && errno == EBUSY);
+    }
+    mj_scheduler_task_remove_current(scheduler); // the WOKEN one while parked again
+}
+
+// Cleanup runs after remove has ended the wait, with the task still current
+static void removed_cleanup(mj_scheduler* scheduler, void* ctx) {
+    results[REMOVED] = mj_scheduler_task_wait_result(scheduler);
+    done++;
+}
+
+typedef struct driver_ctx {
+    bool slept;
+} driver_ctx;
+
+// Runs after the waiters have parked: wakes one, cancels another and sleeps while the third times out
+static void driver_run(mj_scheduler* scheduler, void* ctx) {
+    driver_ctx* driver = ctx;
+    if (!driver->slept) {
+        MJ_CHECK(mj_wait_queue_wake_one(&queues[WOKEN]) == 1);
+        MJ_CHECK(mj_wait_queue_wake_one(&queues[WOKEN]) == 0);
+        mj_cancel_token_cancel(&token);
+        MJ_CHECK(mj_cancel_token_is_cancelled(&token));
+        driver->slept = true;
+        MJ_CHECK(mj_scheduler_task_sleep_ms(scheduler, 50) == 0);
+        return;
+    }
+    MJ_CHECK(mj_scheduler_task_wait_result(scheduler) == ETIMEDOUT); // a plain sleep always ends this way
+    mj_scheduler_task_remove_current(scheduler);
+}
+
+int main(void) {
+    mj_scheduler* scheduler = mj_scheduler_create();
+    MJ_CHECK(scheduler != NULL);
+    for (int kind = 0; kind < WAITERS; kind++) {
+        waiter_ctx waiter = {.kind = kind};
+        mj_task* task = mj_test_task_add(scheduler, waiter_run, "waiter", &waiter, sizeof(waiter));
+        if (kind == REMOVED) {
+            task->cleanup = removed_cleanup;
+        }
+    }
+    driver_ctx driver = {0};
+    mj_test_task_add(scheduler, driver_run, "driver", &driver, sizeof(driver));
+    MJ_CHECK(mj_scheduler_task_wait_result(scheduler) == EINVAL); // outside a task callback
+
+    uint64_t start = mj_time_now_ns();
+    MJ_CHECK(mj_scheduler_run(scheduler) == 0);
+    MJ_CHECK(mj_time_now_ns() - start < NEVER_MS * 1000000ULL / 2);
+
+    MJ_CHECK(done == WAITERS);
+    MJ_CHECK(results[WOKEN] == 0);
+    MJ_CHECK(results[TIMED] == ETIMEDOUT);
+    MJ_CHECK(results[CANCELLED] == ECANCELED);
+    MJ_CHECK(results[REMOVED] == ECANCELED);
+    MJ_CHECK(mj_wait_queue_empty(&token.waiters));
+    MJ_CHECK(mj_scheduler_destroy(&scheduler) == 0);
+    return 0;
+}